@@ -0,0 +1,258 @@
+#include "analyser.hpp"
+#include "rom_index.hpp"
+
+#include <cinttypes>
+#include <cstdio>
+
+// JUMP_TABLE_MAX is the most entries an 8 bit register can select
+const size_t JUMP_TABLE_MAX = 0x80;
+
+static bool isSkip(Kind kind) {
+  switch (kind) {
+  case K_SE:
+  case K_SNE:
+  case K_SEREG:
+  case K_SNEREG:
+  case K_SKP:
+  case K_SKNP:
+    return true;
+  default:
+    return false;
+  }
+}
+
+// Walker holds the ROM while analyseRom follows its paths
+struct Walker {
+  const uint8_t *Rom;
+  size_t Len;
+  const Quirks &Q;
+  uint16_t Origin;
+
+  bool inRom(size_t addr, size_t size) const {
+    return addr >= Origin && addr - Origin + size <= Len;
+  }
+  uint16_t word(size_t addr) const {
+    return (Rom[addr - Origin] << 8) | Rom[addr - Origin + 1];
+  }
+  Kind kind(size_t addr) const {
+    return decodeKind(Rom[addr - Origin], Rom[addr - Origin + 1], Q);
+  }
+  // size of the instruction at addr, F000 nnnn takes two words
+  size_t size(size_t addr) const { return kind(addr) == K_LDIL ? 4 : 2; }
+  // skipTarget is where a skip at addr lands when it skips
+  size_t skipTarget(size_t addr) const {
+    const size_t next = addr + 2;
+    return next + (inRom(next, 2) ? size(next) : 2);
+  }
+};
+
+Analysis analyseRom(const uint8_t *rom, size_t len, const Quirks &q,
+                    uint16_t origin) {
+  const Walker w{rom, len, q, origin};
+  Analysis a;
+  a.Origin = origin;
+  a.Bytes.assign(len, RomByte::Data);
+
+  std::set<uint16_t> leaders = {origin};
+  std::vector<uint16_t> todo = {origin};
+  auto branch = [&](size_t addr) {
+    leaders.insert(addr);
+    todo.push_back(addr);
+  };
+  while (!todo.empty()) {
+    size_t addr = todo.back();
+    todo.pop_back();
+    bool ends = false;
+    while (!ends && w.inRom(addr, 2) &&
+           a.Bytes[addr - origin] == RomByte::Data) {
+      const Kind kind = w.kind(addr);
+      const size_t size = w.size(addr);
+      bool overlaps = !w.inRom(addr, size);
+      for (size_t i = 1; !overlaps && i < size; i++) {
+        overlaps = a.Bytes[addr - origin + i] != RomByte::Data;
+      }
+      if (overlaps) {
+        // straddles an instruction already found, this path is not code
+        break;
+      }
+      a.Bytes[addr - origin] = RomByte::Code;
+      for (size_t i = 1; i < size; i++) {
+        a.Bytes[addr - origin + i] = RomByte::Operand;
+      }
+      const size_t next = addr + size;
+      const uint16_t nnn = w.word(addr) & 0xFFF;
+      if (isSkip(kind)) {
+        leaders.insert(next);
+        branch(w.skipTarget(addr));
+      }
+      switch (kind) {
+      case K_JMP:
+        branch(nnn);
+        ends = true;
+        break;
+      case K_CALL:
+        a.Calls[nnn].push_back(addr);
+        branch(nnn);
+        leaders.insert(next);
+        break;
+      case K_RET:
+      case K_EXIT:
+        ends = true;
+        break;
+      case K_JPOff: {
+        JumpTable table{uint16_t(addr), nnn, {}};
+        for (size_t e = nnn; w.inRom(e, 2) && w.kind(e) == K_JMP &&
+                             table.Entries.size() < JUMP_TABLE_MAX;
+             e += 2) {
+          table.Entries.push_back(e);
+        }
+        if (table.Entries.empty() && w.inRom(nnn, 2)) {
+          // not a table of jumps, at least the zero offset is code
+          table.Entries.push_back(nnn);
+        }
+        for (auto e : table.Entries) {
+          branch(e);
+        }
+        a.JumpTables.push_back(table);
+        ends = true;
+        break;
+      }
+      case K_LDII:
+        if (w.inRom(nnn, 1)) {
+          a.DataRefs.insert(nnn);
+        }
+        break;
+      case K_LDIL:
+        if (w.inRom(w.word(addr + 2), 1)) {
+          a.DataRefs.insert(w.word(addr + 2));
+        }
+        break;
+      default:
+        break;
+      }
+      addr = next;
+    }
+    if (!ends && a.isCode(addr)) {
+      // fell into code found earlier, it starts a block of its own
+      leaders.insert(addr);
+    }
+  }
+
+  // split the code into blocks at every leader and after every branch
+  for (size_t off = 0; off < len;) {
+    if (a.Bytes[off] != RomByte::Code) {
+      off++;
+      continue;
+    }
+    Block block{uint16_t(origin + off), 0, {}};
+    size_t addr = block.Start;
+    while (true) {
+      const Kind kind = w.kind(addr);
+      const size_t next = addr + w.size(addr);
+      const uint16_t nnn = w.word(addr) & 0xFFF;
+      bool ends = true;
+      if (isSkip(kind)) {
+        block.Next = {uint16_t(next), uint16_t(w.skipTarget(addr))};
+      } else if (kind == K_JMP) {
+        block.Next = {nnn};
+      } else if (kind == K_CALL) {
+        block.Next = {uint16_t(next)};
+      } else if (kind == K_JPOff) {
+        for (const auto &table : a.JumpTables) {
+          if (table.At == addr) {
+            block.Next = table.Entries;
+          }
+        }
+      } else if (kind != K_RET && kind != K_EXIT) {
+        ends = !a.isCode(next) || leaders.count(next) != 0;
+        if (ends && a.isCode(next)) {
+          block.Next = {uint16_t(next)};
+        }
+      }
+      addr = next;
+      if (ends) {
+        break;
+      }
+    }
+    block.End = addr;
+    a.Blocks.push_back(block);
+    off = addr - origin;
+  }
+  return a;
+}
+
+std::string listingHeader(const uint8_t *rom, size_t len, const Quirks &q) {
+  char buf[96];
+  snprintf(buf, sizeof(buf), "; chip8-listing 1 %016" PRIx64 " %zu %s",
+           romHash(rom, len), len, q.Name);
+  return buf;
+}
+
+void writeListing(std::ostream &out, const Analysis &a, const uint8_t *rom,
+                  const Quirks &q) {
+  const size_t len = a.Bytes.size();
+  std::map<uint16_t, std::string> labels;
+  char buf[96];
+  for (auto ref : a.DataRefs) {
+    snprintf(buf, sizeof(buf), "data_%04x", ref);
+    labels[ref] = buf;
+  }
+  for (const auto &block : a.Blocks) {
+    snprintf(buf, sizeof(buf), "L_%04x", block.Start);
+    labels[block.Start] = buf;
+  }
+  for (const auto &table : a.JumpTables) {
+    snprintf(buf, sizeof(buf), "table_%04x", table.Base);
+    labels[table.Base] = buf;
+  }
+  for (const auto &call : a.Calls) {
+    snprintf(buf, sizeof(buf), "sub_%04x", call.first);
+    labels[call.first] = buf;
+  }
+
+  size_t code = 0;
+  for (auto b : a.Bytes) {
+    code += b != RomByte::Data;
+  }
+  out << listingHeader(rom, len, q) << "\n";
+  out << "; " << code << " code bytes, " << (len - code) << " data bytes, "
+      << a.Blocks.size() << " blocks, " << a.Calls.size() << " subroutines, "
+      << a.JumpTables.size() << " jump tables\n";
+
+  for (size_t off = 0; off < len;) {
+    const uint16_t addr = a.Origin + off;
+    auto label = labels.find(addr);
+    if (label != labels.end()) {
+      out << label->second << ":\n";
+    }
+    if (a.Bytes[off] == RomByte::Code) {
+      const size_t size = (off + 3 < len && decodeKind(rom[off], rom[off + 1],
+                                                      q) == K_LDIL)
+                              ? 4
+                              : 2;
+      const int next = size == 4 ? (rom[off + 2] << 8) | rom[off + 3] : -1;
+      if (size == 4) {
+        snprintf(buf, sizeof(buf), "    %04x  %02X%02X %02X%02X  ", addr,
+                 rom[off], rom[off + 1], rom[off + 2], rom[off + 3]);
+      } else {
+        snprintf(buf, sizeof(buf), "    %04x  %02X%02X       ", addr,
+                 rom[off], rom[off + 1]);
+      }
+      out << buf << disassemble(rom[off], rom[off + 1], q, next) << "\n";
+      off += size;
+      continue;
+    }
+    // data runs in rows of up to 8 bytes, broken at labels and code
+    snprintf(buf, sizeof(buf), "    %04x  DB ", addr);
+    out << buf;
+    size_t n = 0;
+    do {
+      snprintf(buf, sizeof(buf), "%s0x%02X", n == 0 ? "" : ", ", rom[off]);
+      out << buf;
+      off++;
+      n++;
+    } while (off < len && n < 8 && a.Bytes[off] == RomByte::Data &&
+             labels.count(a.Origin + off) == 0);
+    out << "\n";
+  }
+}
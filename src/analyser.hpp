@@ -0,0 +1,65 @@
+#ifndef ANALYSER_HPP
+#define ANALYSER_HPP
+
+#include "isa.hpp"
+#include "rom.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <ostream>
+#include <set>
+#include <vector>
+
+// RomByte classifies one byte of a ROM
+enum class RomByte : uint8_t {
+  Data,    // never reached by the walk: sprites, tables, unused space
+  Code,    // first byte of a reachable instruction
+  Operand, // the other bytes of an instruction
+};
+
+// Block is a basic block, its instructions always run from Start to End
+struct Block {
+  uint16_t Start;
+  uint16_t End;               // one past the last instruction
+  std::vector<uint16_t> Next; // where control continues, empty for RET/EXIT
+};
+
+// JumpTable is a Bnnn and the JP instructions found at its base, the entries
+// are what the register offset can select
+struct JumpTable {
+  uint16_t At;
+  uint16_t Base;
+  std::vector<uint16_t> Entries;
+};
+
+// Analysis is what a static walk of a ROM found, addresses are absolute
+struct Analysis {
+  uint16_t Origin = ROM_START;
+  std::vector<RomByte> Bytes; // one per ROM byte
+  std::vector<Block> Blocks;  // sorted by Start
+  // Calls maps every subroutine to the CALLs that reach it
+  std::map<uint16_t, std::vector<uint16_t>> Calls;
+  std::vector<JumpTable> JumpTables;
+  std::set<uint16_t> DataRefs; // LD I targets inside the ROM
+
+  bool isCode(size_t addr) const {
+    return addr >= Origin && addr - Origin < Bytes.size() &&
+           Bytes[addr - Origin] == RomByte::Code;
+  }
+};
+
+// analyseRom walks every path from origin recursively: both sides of skips,
+// calls, and the entries of jump tables. Where RET goes is the CALL's next
+// instruction, anything never reached is data.
+Analysis analyseRom(const uint8_t *rom, size_t len, const Quirks &q,
+                    uint16_t origin = ROM_START);
+
+// writeListing prints the ROM as labelled code and data, the first line
+// identifies the ROM and profile so a saved listing can be checked for being
+// current without redoing the analysis
+void writeListing(std::ostream &out, const Analysis &a, const uint8_t *rom,
+                  const Quirks &q);
+// listingHeader is that first line
+std::string listingHeader(const uint8_t *rom, size_t len, const Quirks &q);
+
+#endif // ANALYSER_HPP
@@ -0,0 +1,123 @@
+#include "audio.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+// SQUARE is the beep as a pattern, high for the first half
+static const uint8_t SQUARE[0x10] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+                                     0xFF, 0xFF, 0,    0,    0,    0,
+                                     0,    0,    0,    0};
+static const double PATTERN_BITS = 128;
+
+// stepFor is how far the 32 bit phase over the whole pattern moves per
+// sample when the pattern plays hz times a second
+static uint32_t stepFor(double hz, uint32_t rate) {
+  return uint32_t(std::llround(hz / rate * 4294967296.0));
+}
+
+static void put16(std::ofstream &out, uint16_t v) {
+  const char bytes[2] = {char(v & 0xFF), char(v >> 8)};
+  out.write(bytes, 2);
+}
+
+static void put32(std::ofstream &out, uint32_t v) {
+  put16(out, v & 0xFFFF);
+  put16(out, v >> 16);
+}
+
+WavSink::WavSink(const std::string &filename, uint32_t sampleRate)
+    : out(filename, std::ios::binary), rate(sampleRate) {
+  // RIFF header of a 16 bit mono PCM file, sizes patched by close
+  out.write("RIFF", 4);
+  put32(out, 0);
+  out.write("WAVEfmt ", 8);
+  put32(out, 16);
+  put16(out, 1);
+  put16(out, 1);
+  put32(out, rate);
+  put32(out, rate * 2);
+  put16(out, 2);
+  put16(out, 16);
+  out.write("data", 4);
+  put32(out, 0);
+  ok = bool(out);
+}
+
+void WavSink::write(const int16_t *s, size_t n) {
+  char bytes[2 * AUDIO_CHUNK];
+  while (n > 0) {
+    const size_t len = std::min(n, AUDIO_CHUNK);
+    for (size_t i = 0; i < len; i++) {
+      bytes[2 * i] = char(uint16_t(s[i]) & 0xFF);
+      bytes[2 * i + 1] = char(uint16_t(s[i]) >> 8);
+    }
+    out.write(bytes, 2 * len);
+    samples += len;
+    s += len;
+    n -= len;
+  }
+}
+
+bool WavSink::close() {
+  if (!out.is_open()) {
+    return ok;
+  }
+  const uint32_t data = uint32_t(std::min<uint64_t>(samples * 2, 0xFFFFFFDB));
+  out.seekp(4);
+  put32(out, 36 + data);
+  out.seekp(40);
+  put32(out, data);
+  ok = ok && bool(out);
+  out.close();
+  return ok;
+}
+
+Audio::Audio(AudioSink *s, uint32_t sampleRate) : sink(s), rate(sampleRate) {
+  std::copy(SQUARE, SQUARE + 0x10, pattern);
+  phaseStep = stepFor(AUDIO_BEEP_HZ, rate);
+}
+
+void Audio::follow(const Chip8 &cpu, uint64_t cycle, uint64_t ips) {
+  if (!synced || ips != clockIps || cycle < lastCycle) {
+    synced = true;
+    clockIps = ips;
+    baseCycle = cycle;
+    baseSample = Samples;
+  } else {
+    render(baseSample + (cycle - baseCycle) * rate / ips - Samples);
+  }
+  lastCycle = cycle;
+
+  const bool sounding = cpu.ST > 0;
+  if (sounding && !on) {
+    phase = 0;
+  }
+  on = sounding;
+  if (cpu.quirks().XOChip) {
+    std::copy(cpu.Pattern, cpu.Pattern + 0x10, pattern);
+    if (cpu.Pitch != pitch) {
+      pitch = cpu.Pitch;
+      const double hz =
+          AUDIO_PATTERN_HZ * std::exp2((pitch - 64) / 48.0) / PATTERN_BITS;
+      phaseStep = stepFor(hz, rate);
+    }
+  }
+}
+
+void Audio::render(uint64_t n) {
+  while (n > 0) {
+    const size_t len = size_t(std::min<uint64_t>(n, AUDIO_CHUNK));
+    if (on) {
+      for (size_t i = 0; i < len; i++, phase += phaseStep) {
+        const uint32_t bit = phase >> 25; // 128 bits in 32
+        const bool high = (pattern[bit >> 3] >> (7 - (bit & 7))) & 1;
+        chunk[i] = high ? AUDIO_VOLUME : -AUDIO_VOLUME;
+      }
+    } else {
+      std::fill(chunk, chunk + len, 0);
+    }
+    sink->write(chunk, len);
+    Samples += len;
+    n -= len;
+  }
+}
@@ -0,0 +1,119 @@
+#ifndef AUDIO_HPP
+#define AUDIO_HPP
+
+#include "chip8.hpp"
+#include "spsc_queue.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+
+const uint32_t AUDIO_SAMPLE_RATE = 48000;
+const int16_t AUDIO_VOLUME = 0x1000;
+// profiles without XO-CHIP audio beep with a square wave
+const double AUDIO_BEEP_HZ = 440;
+// XO-CHIP plays its pattern at 4000 * 2^((pitch - 64) / 48) bits a second
+const double AUDIO_PATTERN_HZ = 4000;
+// samples between the CPU thread and the audio device, 85ms at 48 kHz
+const size_t AUDIO_RING_SIZE = 4096;
+// Audio renders this many samples at a time
+const size_t AUDIO_CHUNK = 256;
+
+// AudioSink takes the mono signed 16 bit samples Audio renders, write is
+// called on the emulation thread
+class AudioSink {
+public:
+  virtual ~AudioSink() = default;
+  virtual void write(const int16_t *samples, size_t n) = 0;
+};
+
+// NullSink throws the samples away, counting them
+class NullSink : public AudioSink {
+public:
+  void write(const int16_t *, size_t n) override { Samples += n; }
+
+  uint64_t Samples = 0;
+};
+
+// RingSink hands samples to the audio device's thread through a lock-free
+// ring. When the device falls behind samples are dropped, the emulation
+// never waits for it.
+class RingSink : public AudioSink {
+public:
+  void write(const int16_t *samples, size_t n) override {
+    Dropped += n - ring.write(samples, n);
+  }
+  // read is for the device side, it returns how many of the n samples were
+  // there, the rest of the device's buffer should be silence
+  size_t read(int16_t *out, size_t n) { return ring.read(out, n); }
+
+  uint64_t Dropped = 0; // owned by the emulation thread
+
+private:
+  SpscQueue<int16_t, AUDIO_RING_SIZE> ring;
+};
+
+// WavSink writes a WAV file for headless runs, where the emulation thread
+// may as well wait on the disk. The header's sizes are filled in by close.
+class WavSink : public AudioSink {
+public:
+  explicit WavSink(const std::string &filename,
+                   uint32_t sampleRate = AUDIO_SAMPLE_RATE);
+  ~WavSink() override { close(); }
+  WavSink(const WavSink &) = delete;
+  WavSink &operator=(const WavSink &) = delete;
+
+  void write(const int16_t *samples, size_t n) override;
+  // close finishes the file, false if any write failed
+  bool close();
+
+private:
+  std::ofstream out;
+  uint32_t rate;
+  uint64_t samples = 0;
+  bool ok;
+};
+
+// Audio renders what a Chip8 sounds like while ST is above zero: a square
+// wave beep, or on the xochip profile the pattern buffer at the rate the
+// pitch register sets. It follows the CPU in emulated time. Every change to
+// the sound ends a step, so with follow called after every step and tick,
+// as Scheduler::onSync does, each change is heard on the sample its cycle
+// maps to. Audio itself never allocates or blocks.
+class Audio {
+public:
+  explicit Audio(AudioSink *sink, uint32_t sampleRate = AUDIO_SAMPLE_RATE);
+
+  // follow renders the samples up to cycle with the sound the CPU had at the
+  // previous call, then takes its sound from now on. ips is how many cycles
+  // make a second, a change of rate or a clock going backwards starts over
+  // from cycle without rendering anything.
+  void follow(const Chip8 &cpu, uint64_t cycle, uint64_t ips);
+
+  uint64_t Samples = 0; // rendered since construction
+
+private:
+  void render(uint64_t n);
+
+  AudioSink *sink;
+  uint32_t rate;
+
+  // cycle and sample the clock was last started from
+  bool synced = false;
+  uint64_t clockIps = 0;
+  uint64_t baseCycle = 0;
+  uint64_t baseSample = 0;
+  uint64_t lastCycle = 0;
+
+  // the sound since the last follow, the pattern's 128 bits loop over a
+  // 32 bit phase
+  bool on = false;
+  uint8_t pattern[0x10];
+  int pitch = -1; // XO-CHIP pitch phaseStep is for
+  uint32_t phase = 0;
+  uint32_t phaseStep = 0;
+
+  int16_t chunk[AUDIO_CHUNK];
+};
+
+#endif // AUDIO_HPP
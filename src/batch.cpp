@@ -0,0 +1,506 @@
+#include "batch.hpp"
+#include "chip8.hpp"
+#include "rom.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CHIP8_BATCH_X86
+#include <immintrin.h>
+#endif
+
+// BatchKernels are the lockstep operations of one instruction set, see
+// batch_kernels.hpp for what each of them does
+struct BatchKernels {
+  void (*alu)(uint8_t kind, uint8_t *vx, const uint8_t *vy, uint8_t *vf,
+              const uint8_t *mask, size_t n);
+  void (*immediate)(uint8_t kind, uint8_t *vx, uint8_t kk, const uint8_t *mask,
+                    size_t n);
+  void (*compare)(uint8_t kind, const uint8_t *vx, const uint8_t *vy,
+                  uint8_t kk, const uint8_t *mask, uint8_t *skip, size_t n);
+  void (*xorshift)(const uint16_t *seed, uint16_t *out, size_t n);
+  void (*select)(const uint16_t *pcs, uint16_t pc, uint8_t *pending,
+                 uint8_t *mask, size_t n);
+  void (*advance)(uint16_t *pcs, const uint8_t *mask, size_t n);
+  void (*jump)(uint16_t *pcs, uint16_t target, const uint8_t *mask, size_t n);
+};
+
+// lanes are padded to the widest vector so no kernel needs a tail loop
+static const size_t LANE_ALIGN = 32;
+
+// Scalar works on one lane at a time, for hosts without SSE2 and as the
+// reference the vector versions have to agree with
+namespace scalar {
+struct Vec {
+  using T = uint8_t;
+  using T16 = uint16_t;
+  static const size_t W = 1;
+  static const size_t W16 = 1;
+  static T load(const uint8_t *p) { return *p; }
+  static void store(uint8_t *p, T a) { *p = a; }
+  static T set1(uint8_t a) { return a; }
+  static T and_(T a, T b) { return a & b; }
+  static T or_(T a, T b) { return a | b; }
+  static T xor_(T a, T b) { return a ^ b; }
+  static T andnot(T a, T b) { return ~a & b; }
+  static T add(T a, T b) { return a + b; }
+  static T sub(T a, T b) { return a - b; }
+  static T addsu(T a, T b) { return std::min(a + b, 0xFF); }
+  static T subsu(T a, T b) { return a > b ? a - b : 0; }
+  static T cmpeq(T a, T b) { return a == b ? 0xFF : 0; }
+  static T srl1(T a) { return a >> 1; }
+  static T srl7(T a) { return a >> 7; }
+  static T16 load16(const uint16_t *p) { return *p; }
+  static void store16(uint16_t *p, T16 a) { *p = a; }
+  static T16 xor16(T16 a, T16 b) { return a ^ b; }
+  static T16 or16(T16 a, T16 b) { return a | b; }
+  template <int N> static T16 sll16(T16 a) { return a << N; }
+  template <int N> static T16 srl16(T16 a) { return a >> N; }
+  static T16 set16(uint16_t a) { return a; }
+  static T16 add16(T16 a, T16 b) { return a + b; }
+  static T16 and16(T16 a, T16 b) { return a & b; }
+  static T16 blend16(T16 a, T16 b, T16 m) { return (b & m) | (a & ~m); }
+  static T16 cmpeq16(T16 a, T16 b) { return a == b ? 0xFFFF : 0; }
+  // one lane per vector, the second half of a pair is the next lane
+  static T pack16(T16 lo, T16 hi) { return lo & 0xFF; }
+  static void widen(T a, T16 *lo, T16 *hi) { *lo = *hi = a ? 0xFFFF : 0; }
+};
+#include "batch_kernels.hpp"
+} // namespace scalar
+
+#ifdef CHIP8_BATCH_X86
+#pragma GCC push_options
+#pragma GCC target("sse2")
+namespace sse2 {
+struct Vec {
+  using T = __m128i;
+  using T16 = __m128i;
+  static const size_t W = 16;
+  static const size_t W16 = 8;
+  static T load(const uint8_t *p) {
+    return _mm_loadu_si128(reinterpret_cast<const T *>(p));
+  }
+  static void store(uint8_t *p, T a) {
+    _mm_storeu_si128(reinterpret_cast<T *>(p), a);
+  }
+  static T set1(uint8_t a) { return _mm_set1_epi8(a); }
+  static T and_(T a, T b) { return _mm_and_si128(a, b); }
+  static T or_(T a, T b) { return _mm_or_si128(a, b); }
+  static T xor_(T a, T b) { return _mm_xor_si128(a, b); }
+  static T andnot(T a, T b) { return _mm_andnot_si128(a, b); }
+  static T add(T a, T b) { return _mm_add_epi8(a, b); }
+  static T sub(T a, T b) { return _mm_sub_epi8(a, b); }
+  static T addsu(T a, T b) { return _mm_adds_epu8(a, b); }
+  static T subsu(T a, T b) { return _mm_subs_epu8(a, b); }
+  static T cmpeq(T a, T b) { return _mm_cmpeq_epi8(a, b); }
+  // there are no byte shifts, shift words and let the kernel mask
+  static T srl1(T a) { return _mm_srli_epi16(a, 1); }
+  static T srl7(T a) { return _mm_srli_epi16(a, 7); }
+  static T16 load16(const uint16_t *p) {
+    return _mm_loadu_si128(reinterpret_cast<const T *>(p));
+  }
+  static void store16(uint16_t *p, T16 a) {
+    _mm_storeu_si128(reinterpret_cast<T *>(p), a);
+  }
+  static T16 xor16(T16 a, T16 b) { return _mm_xor_si128(a, b); }
+  static T16 or16(T16 a, T16 b) { return _mm_or_si128(a, b); }
+  template <int N> static T16 sll16(T16 a) { return _mm_slli_epi16(a, N); }
+  template <int N> static T16 srl16(T16 a) { return _mm_srli_epi16(a, N); }
+  static T16 set16(uint16_t a) { return _mm_set1_epi16(a); }
+  static T16 add16(T16 a, T16 b) { return _mm_add_epi16(a, b); }
+  static T16 and16(T16 a, T16 b) { return _mm_and_si128(a, b); }
+  static T16 blend16(T16 a, T16 b, T16 m) {
+    return _mm_or_si128(_mm_and_si128(b, m), _mm_andnot_si128(m, a));
+  }
+  static T16 cmpeq16(T16 a, T16 b) { return _mm_cmpeq_epi16(a, b); }
+  static T pack16(T16 lo, T16 hi) { return _mm_packs_epi16(lo, hi); }
+  static void widen(T a, T16 *lo, T16 *hi) {
+    *lo = _mm_unpacklo_epi8(a, a);
+    *hi = _mm_unpackhi_epi8(a, a);
+  }
+};
+#include "batch_kernels.hpp"
+} // namespace sse2
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx2")
+namespace avx2 {
+struct Vec {
+  using T = __m256i;
+  using T16 = __m256i;
+  static const size_t W = 32;
+  static const size_t W16 = 16;
+  static T load(const uint8_t *p) {
+    return _mm256_loadu_si256(reinterpret_cast<const T *>(p));
+  }
+  static void store(uint8_t *p, T a) {
+    _mm256_storeu_si256(reinterpret_cast<T *>(p), a);
+  }
+  static T set1(uint8_t a) { return _mm256_set1_epi8(a); }
+  static T and_(T a, T b) { return _mm256_and_si256(a, b); }
+  static T or_(T a, T b) { return _mm256_or_si256(a, b); }
+  static T xor_(T a, T b) { return _mm256_xor_si256(a, b); }
+  static T andnot(T a, T b) { return _mm256_andnot_si256(a, b); }
+  static T add(T a, T b) { return _mm256_add_epi8(a, b); }
+  static T sub(T a, T b) { return _mm256_sub_epi8(a, b); }
+  static T addsu(T a, T b) { return _mm256_adds_epu8(a, b); }
+  static T subsu(T a, T b) { return _mm256_subs_epu8(a, b); }
+  static T cmpeq(T a, T b) { return _mm256_cmpeq_epi8(a, b); }
+  static T srl1(T a) { return _mm256_srli_epi16(a, 1); }
+  static T srl7(T a) { return _mm256_srli_epi16(a, 7); }
+  static T16 load16(const uint16_t *p) {
+    return _mm256_loadu_si256(reinterpret_cast<const T *>(p));
+  }
+  static void store16(uint16_t *p, T16 a) {
+    _mm256_storeu_si256(reinterpret_cast<T *>(p), a);
+  }
+  static T16 xor16(T16 a, T16 b) { return _mm256_xor_si256(a, b); }
+  static T16 or16(T16 a, T16 b) { return _mm256_or_si256(a, b); }
+  template <int N> static T16 sll16(T16 a) { return _mm256_slli_epi16(a, N); }
+  template <int N> static T16 srl16(T16 a) { return _mm256_srli_epi16(a, N); }
+  static T16 set16(uint16_t a) { return _mm256_set1_epi16(a); }
+  static T16 add16(T16 a, T16 b) { return _mm256_add_epi16(a, b); }
+  static T16 and16(T16 a, T16 b) { return _mm256_and_si256(a, b); }
+  static T16 blend16(T16 a, T16 b, T16 m) {
+    return _mm256_blendv_epi8(a, b, m);
+  }
+  static T16 cmpeq16(T16 a, T16 b) { return _mm256_cmpeq_epi16(a, b); }
+  // packs works within 128 bit halves, put the quarters back in lane order
+  static T pack16(T16 lo, T16 hi) {
+    return _mm256_permute4x64_epi64(_mm256_packs_epi16(lo, hi), 0xD8);
+  }
+  static void widen(T a, T16 *lo, T16 *hi) {
+    *lo = _mm256_cvtepi8_epi16(_mm256_castsi256_si128(a));
+    *hi = _mm256_cvtepi8_epi16(_mm256_extracti128_si256(a, 1));
+  }
+};
+#include "batch_kernels.hpp"
+} // namespace avx2
+#pragma GCC pop_options
+#endif
+
+bool Batch::supports(BatchIsa isa) {
+  switch (isa) {
+  case BatchIsa::Best:
+  case BatchIsa::Scalar:
+    return true;
+#ifdef CHIP8_BATCH_X86
+  case BatchIsa::SSE2:
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse2");
+  case BatchIsa::AVX2:
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#endif
+  default:
+    return false;
+  }
+}
+
+// bestIsa resolves Best and anything the host cannot run
+static BatchIsa bestIsa(BatchIsa isa) {
+  if (isa != BatchIsa::Best && Batch::supports(isa)) {
+    return isa;
+  }
+  if (Batch::supports(BatchIsa::AVX2)) {
+    return BatchIsa::AVX2;
+  }
+  if (Batch::supports(BatchIsa::SSE2)) {
+    return BatchIsa::SSE2;
+  }
+  return BatchIsa::Scalar;
+}
+
+static const BatchKernels *kernelsOf(BatchIsa isa) {
+  switch (isa) {
+#ifdef CHIP8_BATCH_X86
+  case BatchIsa::AVX2:
+    return &avx2::kernels;
+  case BatchIsa::SSE2:
+    return &sse2::kernels;
+#endif
+  default:
+    return &scalar::kernels;
+  }
+}
+
+static void decode(uint8_t hi, uint8_t lo, Instruction *instr) {
+  instr->raw[0] = hi;
+  instr->raw[1] = lo;
+  instr->x = hi & 0xF;
+  instr->y = lo >> 4;
+  instr->n = lo & 0xF;
+  instr->kk = lo;
+  instr->nnn = ((hi & 0xF) << 8) | lo;
+  instr->kind = decodeKind(hi, lo);
+}
+
+Batch::Batch(size_t lanes, const Memory &image, BatchIsa isa)
+    : laneCount(lanes),
+      laneStride((lanes + LANE_ALIGN - 1) / LANE_ALIGN * LANE_ALIGN),
+      memSize(image.size()), pageShift(0), kernelIsa(bestIsa(isa)),
+      kernels(kernelsOf(kernelIsa)) {
+  while ((memSize - 1) >> pageShift >= 64) {
+    pageShift++;
+  }
+
+  V.assign(0x10 * laneStride, 0);
+  I.assign(laneStride, 0);
+  PC.assign(laneStride, ROM_START);
+  SEED.assign(laneStride, DEFAULT_SEED);
+  SP.assign(laneStride, 0);
+  DT.assign(laneStride, 0);
+  ST.assign(laneStride, 0);
+  Stack.assign(laneStride * STACK_SIZE, 0);
+  KeyPad.assign(laneStride * 0x10, 0);
+  InputReg.assign(laneStride, 0);
+  Paused.assign(laneStride, 0);
+  Errors.assign(laneStride, 0);
+  InstrCount.assign(laneStride, 0);
+  FrameBuffers.resize(laneCount);
+
+  // boot one Chip8 so every lane starts from the memory it would see, font
+  // included
+  Memory boot(image);
+  Chip8 cpu(&boot);
+  mem.resize(laneCount * memSize);
+  for (size_t addr = 0; addr < memSize; addr++) {
+    mem[addr] = boot.get(addr);
+  }
+  for (size_t lane = 1; lane < laneCount; lane++) {
+    std::copy(mem.begin(), mem.begin() + memSize,
+              mem.begin() + lane * memSize);
+  }
+
+  mask.assign(laneStride, 0);
+  skip.assign(laneStride, 0);
+  random.assign(laneStride, 0);
+  pending.assign(laneStride, 0);
+}
+
+// step runs in rounds, every lane that is not paused executes one instruction
+// per round. A round starts a group at the first lane still pending and pulls
+// in every pending lane on the same PC, lanes that diverged run as separate
+// groups and merge back once they are on the same PC again.
+void Batch::step(int count) {
+  // InstrCount is charged for the whole step up front, pause hands back the
+  // rounds a lane no longer runs
+  live = 0;
+  for (size_t lane = 0; lane < laneCount; lane++) {
+    if (!Paused[lane]) {
+      InstrCount[lane] += count;
+      live++;
+    }
+  }
+  for (roundsLeft = count - 1; roundsLeft >= 0 && live > 0; roundsLeft--) {
+    for (size_t lane = 0; lane < laneCount; lane++) {
+      pending[lane] = Paused[lane] ? 0 : 0xFF;
+    }
+    const uint8_t *next = pending.data();
+    const uint8_t *end = pending.data() + laneCount;
+    while ((next = static_cast<const uint8_t *>(
+                memchr(next, 0xFF, end - next))) != nullptr) {
+      group(next - pending.data());
+    }
+  }
+}
+
+// group runs the instruction at the PC of lane first on every pending lane
+// that shares it
+void Batch::group(size_t first) {
+  const uint16_t pc = PC[first];
+  const uint8_t hi = read(first, pc);
+  const uint8_t lo = read(first, pc + 1);
+  // no lane before first is pending, kernels start at its vector
+  const size_t from = first / LANE_ALIGN * LANE_ALIGN;
+  const size_t n = laneStride - from;
+  uint8_t *m = &mask[from];
+  kernels->select(&PC[from], pc, &pending[from], m, n);
+
+  // lanes hold the same bytes as long as nobody wrote to the page, only
+  // compare them once some lane did
+  const uint64_t pages =
+      (uint64_t(1) << pageOf(pc)) | (uint64_t(1) << pageOf(pc + 1));
+  if ((written & pages) != 0) {
+    for (size_t lane = first; lane < laneCount; lane++) {
+      if (mask[lane] && (read(lane, pc) != hi || read(lane, pc + 1) != lo)) {
+        mask[lane] = 0;
+        pending[lane] = 0xFF;
+      }
+    }
+  }
+  kernels->advance(&PC[from], m, n);
+
+  Instruction instr;
+  decode(hi, lo, &instr);
+  uint8_t *vx = &V[instr.x * laneStride + from];
+  uint8_t *vy = &V[instr.y * laneStride + from];
+  switch (instr.kind) {
+  case K_JMP:
+    kernels->jump(&PC[from], instr.nnn, m, n);
+    break;
+  case K_LDI:
+  case K_ADDI:
+    kernels->immediate(instr.kind, vx, instr.kk, m, n);
+    break;
+  case K_LDR:
+  case K_OR:
+  case K_AND:
+  case K_XOR:
+  case K_ADDR:
+  case K_SUB:
+  case K_SHR:
+  case K_SUBN:
+  case K_SHL:
+    kernels->alu(instr.kind, vx, vy, &V[0xF * laneStride + from], m, n);
+    break;
+  case K_SE:
+  case K_SNE:
+  case K_SEREG:
+  case K_SNEREG:
+    kernels->compare(instr.kind, vx, vy, instr.kk, m, &skip[from], n);
+    kernels->advance(&PC[from], &skip[from], n);
+    break;
+  case K_RND:
+    kernels->xorshift(&SEED[from], &random[from], n);
+    for (size_t lane = first; lane < laneCount; lane++) {
+      if (mask[lane]) {
+        SEED[lane] = random[lane];
+        if (SEED[lane] == 0) {
+          SEED[lane] = DEFAULT_SEED;
+        }
+        reg(lane, instr.x) = instr.kk & SEED[lane];
+      }
+    }
+    break;
+  default:
+    for (size_t lane = first; lane < laneCount; lane++) {
+      if (mask[lane]) {
+        execute(lane, instr);
+      }
+    }
+    break;
+  }
+}
+
+// execute runs the instructions without a kernel on one lane, matching the
+// handlers in chip8.cpp
+void Batch::execute(size_t lane, const Instruction &instr) {
+  uint8_t &x = reg(lane, instr.x);
+  uint16_t *stack = &Stack[lane * STACK_SIZE];
+  switch (instr.kind) {
+  case K_CLS:
+    FrameBuffers[lane].clear();
+    break;
+  case K_RET:
+    if (SP[lane] == 0) {
+      Errors[lane] = true;
+      pause(lane);
+      break;
+    }
+    PC[lane] = stack[--SP[lane]];
+    break;
+  case K_JMP:
+    PC[lane] = instr.nnn;
+    break;
+  case K_CALL:
+    if (SP[lane] >= STACK_SIZE) {
+      Errors[lane] = true;
+      pause(lane);
+      break;
+    }
+    stack[SP[lane]++] = PC[lane];
+    PC[lane] = instr.nnn;
+    break;
+  case K_LDII:
+    I[lane] = instr.nnn;
+    break;
+  case K_JPOff:
+    PC[lane] = reg(lane, 0) + instr.nnn;
+    break;
+  case K_DRW: {
+    uint8_t sprite[0x10];
+    for (uint8_t i = 0; i < instr.n; i++) {
+      sprite[i] = read(lane, I[lane] + i);
+    }
+    reg(lane, 0xF) = FrameBuffers[lane].draw(x, reg(lane, instr.y), sprite,
+                                             instr.n);
+    break;
+  }
+  case K_SKP:
+    if (KeyPad[lane * 0x10 + (x & 0xF)]) {
+      PC[lane] += 2;
+    }
+    break;
+  case K_SKNP:
+    if (!KeyPad[lane * 0x10 + (x & 0xF)]) {
+      PC[lane] += 2;
+    }
+    break;
+  case K_LDVDT:
+    x = DT[lane];
+    break;
+  case K_LDK:
+    InputReg[lane] = instr.x;
+    pause(lane);
+    break;
+  case K_LDDT:
+    DT[lane] = x;
+    break;
+  case K_LDST:
+    ST[lane] = x;
+    break;
+  case K_ADDIV:
+    I[lane] = I[lane] + x;
+    break;
+  case K_LDF:
+    I[lane] = x * CHAR_SPRITE_SIZE;
+    break;
+  case K_LDB:
+    write(lane, I[lane], x / 100 % 10);
+    write(lane, I[lane] + 1, x / 10 % 10);
+    write(lane, I[lane] + 2, x % 10);
+    break;
+  case K_STORE:
+    for (size_t i = 0; i <= instr.x; i++) {
+      write(lane, I[lane] + i, reg(lane, i));
+    }
+    break;
+  case K_LOAD:
+    for (size_t i = 0; i <= instr.x; i++) {
+      reg(lane, i) = read(lane, I[lane] + i);
+    }
+    break;
+  }
+}
+
+void Batch::pause(size_t lane) {
+  Paused[lane] = true;
+  InstrCount[lane] -= roundsLeft;
+  live--;
+}
+
+void Batch::write(size_t lane, size_t addr, uint8_t val) {
+  mem[lane * memSize + addr % memSize] = val;
+  written |= uint64_t(1) << pageOf(addr);
+}
+
+void Batch::fixedUpdate() {
+  for (size_t lane = 0; lane < laneStride; lane++) {
+    DT[lane] -= DT[lane] != 0;
+    ST[lane] -= ST[lane] != 0;
+  }
+}
+
+void Batch::sendInput(size_t lane, uint8_t key, bool value) {
+  KeyPad[lane * 0x10 + (key & 0xF)] = value;
+  if (value) {
+    if (Paused[lane]) {
+      reg(lane, InputReg[lane]) = key & 0xF;
+      InputReg[lane] = 0;
+    }
+    Paused[lane] = false;
+  }
+}
@@ -0,0 +1,94 @@
+#ifndef BATCH_HPP
+#define BATCH_HPP
+
+#include "isa.hpp"
+#include "memory.hpp"
+#include "screen.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+struct BatchKernels;
+
+// BatchIsa selects the kernels Batch runs its lockstep operations with
+enum class BatchIsa {
+  Best,   // the widest the host supports
+  Scalar, // one lane at a time, the reference the others have to agree with
+  SSE2,
+  AVX2,
+};
+
+// Batch runs many machines on the same ROM in lockstep. Registers are stored
+// as structure of arrays, register r of lane l is V[r * stride() + l], so
+// lanes that sit on the same instruction run it as one vector operation.
+// Op8 ALU ops, LD and ADD immediates, the SE/SNE family, JP and the RND
+// xorshift use AVX2 or SSE2 when the host has them, everything else runs lane
+// by lane. Lanes that diverge run as separate groups and merge back once they
+// reach the same PC.
+//
+// Every lane has its own memory, screen, keypad and seed. Unlike Chip8::step
+// DRW and CLS do not end a step, lanes run until they spent the whole budget
+// or wait for a key.
+class Batch {
+public:
+  // image is the memory every lane starts from, with the ROM already loaded.
+  // An isa the host does not support falls back to the best one it does.
+  Batch(size_t lanes, const Memory &image, BatchIsa isa = BatchIsa::Best);
+
+  // supports reports whether the host can run isa's kernels
+  static bool supports(BatchIsa isa);
+
+  // step runs count instructions on every lane that is not paused
+  void step(int count);
+  void fixedUpdate();
+  void sendInput(size_t lane, uint8_t key, bool value);
+
+  BatchIsa isa() const { return kernelIsa; }
+  size_t lanes() const { return laneCount; }
+  size_t stride() const { return laneStride; }
+  uint8_t &reg(size_t lane, size_t x) { return V[x * laneStride + lane]; }
+  uint8_t read(size_t lane, size_t addr) const {
+    return mem[lane * memSize + addr % memSize];
+  }
+
+  // SoA registers, one entry per lane padded to stride
+  std::vector<uint8_t> V; // 16 rows of stride lanes
+  std::vector<uint16_t> I;
+  std::vector<uint16_t> PC;
+  std::vector<uint16_t> SEED;
+  std::vector<uint8_t> SP;
+  std::vector<uint8_t> DT;
+  std::vector<uint8_t> ST;
+  std::vector<uint16_t> Stack; // STACK_SIZE entries per lane
+  std::vector<uint8_t> KeyPad; // 16 keys per lane
+  std::vector<uint8_t> InputReg;
+  std::vector<uint8_t> Paused;
+  std::vector<uint8_t> Errors; // set when a lane under or overflowed its stack
+  std::vector<uint64_t> InstrCount;
+  std::vector<Screen> FrameBuffers;
+
+private:
+  void group(size_t first);
+  void execute(size_t lane, const Instruction &instr);
+  void pause(size_t lane);
+  void write(size_t lane, size_t addr, uint8_t val);
+  size_t pageOf(size_t addr) const { return (addr % memSize) >> pageShift; }
+
+  size_t laneCount;
+  size_t laneStride;
+  size_t memSize;
+  size_t pageShift;
+  BatchIsa kernelIsa;
+  const BatchKernels *kernels;
+  uint64_t written = 0; // pages any lane wrote to, one bit per page
+  size_t live = 0;      // lanes not paused in the current step
+  int roundsLeft = 0;   // rounds of the current step after this one
+
+  std::vector<uint8_t> mem;     // memSize bytes per lane
+  std::vector<uint8_t> mask;    // 0xFF for lanes in the running group
+  std::vector<uint8_t> skip;    // compare results
+  std::vector<uint16_t> random; // xorshift results for every lane
+  std::vector<uint8_t> pending; // 0xFF for lanes yet to run this round
+};
+
+#endif // BATCH_HPP
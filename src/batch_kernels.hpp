@@ -0,0 +1,170 @@
+// Lockstep kernels for Batch, written once against a Vec policy and included
+// by batch.cpp inside one namespace per instruction set. No include guard and
+// no includes on purpose.
+//
+// Every kernel walks n lanes, n a multiple of Vec::W, and only changes lanes
+// whose mask byte is 0xFF. Register arrays may alias each other (x == y,
+// x == F), operands are reread after VF is stored exactly where the scalar
+// handlers in chip8.cpp reread them.
+
+static inline Vec::T blend(Vec::T old, Vec::T val, Vec::T mask) {
+  return Vec::or_(Vec::and_(val, mask), Vec::andnot(mask, old));
+}
+
+static inline Vec::T flag(Vec::T cond) {
+  return Vec::and_(cond, Vec::set1(1));
+}
+
+static inline Vec::T notv(Vec::T a) { return Vec::xor_(a, Vec::set1(0xFF)); }
+
+// Op8 register to register ops
+static void alu(uint8_t kind, uint8_t *vx, const uint8_t *vy, uint8_t *vf,
+                const uint8_t *mask, size_t n) {
+  for (size_t i = 0; i < n; i += Vec::W) {
+    const Vec::T m = Vec::load(mask + i);
+    Vec::T a = Vec::load(vx + i);
+    Vec::T b = Vec::load(vy + i);
+    Vec::T res;
+    switch (kind) {
+    case K_LDR:
+      res = b;
+      break;
+    case K_OR:
+      res = Vec::or_(a, b);
+      break;
+    case K_AND:
+      res = Vec::and_(a, b);
+      break;
+    case K_XOR:
+      res = Vec::xor_(a, b);
+      break;
+    case K_ADDR: {
+      res = Vec::add(a, b);
+      const Vec::T carry = notv(Vec::cmpeq(Vec::addsu(a, b), res));
+      Vec::store(vf + i, blend(Vec::load(vf + i), flag(carry), m));
+      break;
+    }
+    case K_SUB: {
+      const Vec::T gt = notv(Vec::cmpeq(Vec::subsu(a, b), Vec::set1(0)));
+      Vec::store(vf + i, blend(Vec::load(vf + i), flag(gt), m));
+      res = Vec::sub(Vec::load(vx + i), Vec::load(vy + i));
+      break;
+    }
+    case K_SUBN: {
+      const Vec::T gt = notv(Vec::cmpeq(Vec::subsu(b, a), Vec::set1(0)));
+      Vec::store(vf + i, blend(Vec::load(vf + i), flag(gt), m));
+      res = Vec::sub(Vec::load(vy + i), Vec::load(vx + i));
+      break;
+    }
+    case K_SHR: {
+      Vec::store(vf + i, blend(Vec::load(vf + i), flag(a), m));
+      a = Vec::load(vx + i);
+      res = Vec::and_(Vec::srl1(a), Vec::set1(0x7F));
+      break;
+    }
+    case K_SHL: {
+      const Vec::T top = Vec::and_(Vec::srl7(a), Vec::set1(1));
+      Vec::store(vf + i, blend(Vec::load(vf + i), top, m));
+      a = Vec::load(vx + i);
+      res = Vec::add(a, a);
+      break;
+    }
+    default:
+      res = a;
+      break;
+    }
+    Vec::store(vx + i, blend(Vec::load(vx + i), res, m));
+  }
+}
+
+// 6xkk and 7xkk
+static void immediate(uint8_t kind, uint8_t *vx, uint8_t kk,
+                      const uint8_t *mask, size_t n) {
+  const Vec::T k = Vec::set1(kk);
+  for (size_t i = 0; i < n; i += Vec::W) {
+    const Vec::T a = Vec::load(vx + i);
+    const Vec::T res = (kind == K_LDI) ? k : Vec::add(a, k);
+    Vec::store(vx + i, blend(a, res, Vec::load(mask + i)));
+  }
+}
+
+// SE, SNE, SE Vx Vy and SNE Vx Vy, writes 0xFF into skip for masked lanes
+// that skip the next instruction
+static void compare(uint8_t kind, const uint8_t *vx, const uint8_t *vy,
+                    uint8_t kk, const uint8_t *mask, uint8_t *skip, size_t n) {
+  const Vec::T k = Vec::set1(kk);
+  for (size_t i = 0; i < n; i += Vec::W) {
+    const Vec::T a = Vec::load(vx + i);
+    const bool reg = (kind == K_SEREG || kind == K_SNEREG);
+    Vec::T eq = Vec::cmpeq(a, reg ? Vec::load(vy + i) : k);
+    if (kind == K_SNE || kind == K_SNEREG) {
+      eq = notv(eq);
+    }
+    Vec::store(skip + i, Vec::and_(eq, Vec::load(mask + i)));
+  }
+}
+
+// the RND xorshift for every lane, the caller merges masked lanes
+static void xorshift(const uint16_t *seed, uint16_t *out, size_t n) {
+  for (size_t i = 0; i < n; i += Vec::W16) {
+    Vec::T16 s = Vec::load16(seed + i);
+    s = Vec::xor16(s, Vec::or16(Vec::sll16<13>(s), Vec::srl16<3>(s)));
+    s = Vec::xor16(s, Vec::or16(Vec::srl16<1>(s), Vec::sll16<15>(s)));
+    s = Vec::xor16(s, Vec::or16(Vec::sll16<5>(s), Vec::srl16<11>(s)));
+    Vec::store16(out + i, s);
+  }
+}
+
+// select moves the pending lanes sitting at pc into the group, mask gets 0xFF
+// and pending 0 for each of them. A byte vector covers two vectors of PCs,
+// except in the scalar version where both are one lane.
+static void select(const uint16_t *pcs, uint16_t pc, uint8_t *pending,
+                   uint8_t *mask, size_t n) {
+  const Vec::T16 at = Vec::set16(pc);
+  const bool pairs = Vec::W16 < Vec::W;
+  for (size_t i = 0; i < n; i += Vec::W) {
+    const Vec::T16 lo = Vec::cmpeq16(Vec::load16(pcs + i), at);
+    const Vec::T16 hi =
+        pairs ? Vec::cmpeq16(Vec::load16(pcs + i + Vec::W16), at) : lo;
+    const Vec::T eq = Vec::pack16(lo, hi);
+    const Vec::T p = Vec::load(pending + i);
+    Vec::store(mask + i, Vec::and_(p, eq));
+    Vec::store(pending + i, Vec::andnot(eq, p));
+  }
+}
+
+// advance adds 2 to the PC of every lane in mask
+static void advance(uint16_t *pcs, const uint8_t *mask, size_t n) {
+  const Vec::T16 two = Vec::set16(2);
+  const bool pairs = Vec::W16 < Vec::W;
+  for (size_t i = 0; i < n; i += Vec::W) {
+    Vec::T16 lo, hi;
+    Vec::widen(Vec::load(mask + i), &lo, &hi);
+    Vec::store16(pcs + i,
+                 Vec::add16(Vec::load16(pcs + i), Vec::and16(lo, two)));
+    if (pairs) {
+      Vec::store16(pcs + i + Vec::W16,
+                   Vec::add16(Vec::load16(pcs + i + Vec::W16),
+                              Vec::and16(hi, two)));
+    }
+  }
+}
+
+// jump sets the PC of every lane in mask to target
+static void jump(uint16_t *pcs, uint16_t target, const uint8_t *mask,
+                 size_t n) {
+  const Vec::T16 to = Vec::set16(target);
+  const bool pairs = Vec::W16 < Vec::W;
+  for (size_t i = 0; i < n; i += Vec::W) {
+    Vec::T16 lo, hi;
+    Vec::widen(Vec::load(mask + i), &lo, &hi);
+    Vec::store16(pcs + i, Vec::blend16(Vec::load16(pcs + i), to, lo));
+    if (pairs) {
+      Vec::store16(pcs + i + Vec::W16,
+                   Vec::blend16(Vec::load16(pcs + i + Vec::W16), to, hi));
+    }
+  }
+}
+
+static const BatchKernels kernels = {&alu,    &immediate, &compare, &xorshift,
+                                     &select, &advance,   &jump};
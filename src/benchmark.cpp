@@ -1,3 +1,464 @@
+#include "batch.hpp"
+#include "chip8.hpp"
+#include "machine.hpp"
+#include "memory.hpp"
+#include "rewind.hpp"
+#include "rom.hpp"
+
+#include <algorithm>
 #include <benchmark/benchmark.h>
+#include <cstdint>
+#include <cstdlib>
+#include <dirent.h>
+#include <string>
+#include <vector>
+
+// Every benchmark runs a small hand written program from ROM_START, most of
+// them a block of the instruction under test followed by a JP back to the
+// start so the interpreter never leaves the loop.
+const int MEM_SIZE = 4096;
+const int BLOCK_SIZE = 16;
+const int STEPS_PER_ITER = 1000;
+const int STEPS_PER_FRAME = 1000;
+
+static void loadProgram(Memory *mem, const std::vector<uint16_t> &program) {
+  uint16_t addr = ROM_START;
+  for (auto instr : program) {
+    mem->set(addr++, instr >> 8);
+    mem->set(addr++, instr & 0xFF);
+  }
+}
+
+// loop repeats body until it fills a block and closes it with JP ROM_START
+static std::vector<uint16_t> loop(const std::vector<uint16_t> &setup,
+                                  const std::vector<uint16_t> &body) {
+  std::vector<uint16_t> program(setup);
+  const uint16_t start = ROM_START + setup.size() * 2;
+  while (program.size() < setup.size() + BLOCK_SIZE) {
+    program.insert(program.end(), body.begin(), body.end());
+  }
+  program.push_back(0x1000 | start);
+  return program;
+}
+
+// runProgram steps the interpreter until STEPS_PER_ITER instructions ran each
+// iteration, DRW and CLS return early from step so it cannot just call
+// step(STEPS_PER_ITER) once
+template <Engine E>
+static void runProgram(benchmark::State &state,
+                       const std::vector<uint16_t> &program,
+                       Profile profile = Profile::Chip8) {
+  Memory mem(std::max<size_t>(MEM_SIZE, quirksOf(profile).MemorySize));
+  Chip8 cpu(&mem, E, profile);
+  loadProgram(&mem, program);
+  for (auto _ : state) {
+    const uint64_t target = cpu.InstrCount + STEPS_PER_ITER;
+    while (cpu.InstrCount < target) {
+      cpu.step(target - cpu.InstrCount);
+    }
+  }
+  state.SetItemsProcessed(cpu.InstrCount);
+  state.counters["ips"] =
+      benchmark::Counter(cpu.InstrCount, benchmark::Counter::kIsRate);
+}
+
+// ENGINE_BENCHMARK registers an interpreter benchmark once per engine so the
+// dispatch strategies can be compared side by side
+#define ENGINE_BENCHMARK(fn)                                                   \
+  BENCHMARK_TEMPLATE(fn, Engine::Table);                                       \
+  BENCHMARK_TEMPLATE(fn, Engine::Threaded);                                    \
+  BENCHMARK_TEMPLATE(fn, Engine::Jit)
+#define ENGINE_BENCHMARK_ARGS(fn, args)                                        \
+  BENCHMARK_TEMPLATE(fn, Engine::Table) args;                                  \
+  BENCHMARK_TEMPLATE(fn, Engine::Threaded) args;                               \
+  BENCHMARK_TEMPLATE(fn, Engine::Jit) args
+
+// Op8 ALU ops, state.range(0) is the low nibble selecting the operation
+template <Engine E>
+static void BM_Op8(benchmark::State &state) {
+  const uint16_t sub = state.range(0);
+  runProgram<E>(state, loop({0x6012, 0x6134}, {uint16_t(0x8010 | sub)}));
+}
+ENGINE_BENCHMARK_ARGS(BM_Op8, ->DenseRange(0x0, 0x7)->Arg(0xE));
+
+template <Engine E>
+static void BM_LoadAddImmediate(benchmark::State &state) {
+  runProgram<E>(state, loop({}, {0x6012, 0x7001}));
+}
+ENGINE_BENCHMARK(BM_LoadAddImmediate);
+
+// SE taken, SE not taken, SNE, SE Vx Vy and SNE Vx Vy, the skipped slot is a
+// harmless ADD so taken and not taken branches run the same instructions
+template <Engine E>
+static void BM_SkipTaken(benchmark::State &state) {
+  runProgram<E>(state, loop({0x6000, 0x6100}, {0x3000, 0x7201}));
+}
+ENGINE_BENCHMARK(BM_SkipTaken);
+
+template <Engine E>
+static void BM_SkipNotTaken(benchmark::State &state) {
+  runProgram<E>(state, loop({0x6000, 0x6100}, {0x3001, 0x7201}));
+}
+ENGINE_BENCHMARK(BM_SkipNotTaken);
+
+template <Engine E>
+static void BM_SkipNotEqual(benchmark::State &state) {
+  runProgram<E>(state, loop({0x6000, 0x6100}, {0x4001, 0x7201}));
+}
+ENGINE_BENCHMARK(BM_SkipNotEqual);
+
+template <Engine E>
+static void BM_SkipRegisters(benchmark::State &state) {
+  runProgram<E>(state,
+                loop({0x6000, 0x6100}, {0x5010, 0x7201, 0x9010, 0x7201}));
+}
+ENGINE_BENCHMARK(BM_SkipRegisters);
+
+template <Engine E>
+static void BM_Jump(benchmark::State &state) {
+  runProgram<E>(state, {0x1202, 0x1204, 0x1206, 0x1200});
+}
+ENGINE_BENCHMARK(BM_Jump);
+
+template <Engine E>
+static void BM_JumpOffset(benchmark::State &state) {
+  runProgram<E>(state, {0x6002, 0xB200, 0xB200});
+}
+ENGINE_BENCHMARK(BM_JumpOffset);
+
+// CALL into a subroutine that returns straight away
+template <Engine E>
+static void BM_CallReturn(benchmark::State &state) {
+  runProgram<E>(state, {0x2206, 0x2206, 0x1200, 0x00EE});
+}
+ENGINE_BENCHMARK(BM_CallReturn);
+
+template <Engine E>
+static void BM_Random(benchmark::State &state) {
+  runProgram<E>(state, loop({}, {0xC0FF}));
+}
+ENGINE_BENCHMARK(BM_Random);
+
+// DRW of the built in font, state.range(0) is the sprite height
+template <Engine E>
+static void BM_Draw(benchmark::State &state) {
+  const uint16_t height = state.range(0);
+  runProgram<E>(state, loop({0x6008, 0x6104, 0xA000},
+                            {uint16_t(0xD010 | height), 0x7003}));
+}
+ENGINE_BENCHMARK_ARGS(BM_Draw, ->Arg(1)->Arg(5)->Arg(15));
+
+template <Engine E>
+static void BM_Clear(benchmark::State &state) {
+  runProgram<E>(state, loop({}, {0x00E0}));
+}
+ENGINE_BENCHMARK(BM_Clear);
+
+template <Engine E>
+static void BM_LoadStoreRegisters(benchmark::State &state) {
+  runProgram<E>(state, loop({0xA300}, {0xFF55, 0xFF65}));
+}
+ENGINE_BENCHMARK(BM_LoadStoreRegisters);
+
+template <Engine E>
+static void BM_StoreBCD(benchmark::State &state) {
+  runProgram<E>(state, loop({0xA300, 0x60FE}, {0xF033}));
+}
+ENGINE_BENCHMARK(BM_StoreBCD);
+
+template <Engine E>
+static void BM_TimersAndI(benchmark::State &state) {
+  runProgram<E>(state,
+                loop({0x6010}, {0xF015, 0xF007, 0xF018, 0xF01E, 0xF029}));
+}
+ENGINE_BENCHMARK(BM_TimersAndI);
+
+// A synthetic game loop: clear, draw a row of font glyphs through nested
+// counters, poll the delay timer and do some ALU work between frames
+static const std::vector<uint16_t> SYNTHETIC_GAME = {
+    0x00E0,         // 200: CLS
+    0x6000,         // 202: LD V0, 0        glyph / x counter
+    0x6100,         // 204: LD V1, 0        y
+    0xF029,         // 206: LD F, V0
+    0xD015,         // 208: DRW V0, V1, 5
+    0x7008,         // 20A: ADD V0, 8
+    0x3080,         // 20C: SE V0, 0x80
+    0x1206,         // 20E: JP 0x206
+    0x6203,         // 210: LD V2, 3
+    0xF215,         // 212: LD DT, V2
+    0x8324,         // 214: ADD V3, V2
+    0x8436,         // 216: SHR V4, V3
+    0xC50F,         // 218: RND V5, 0x0F
+    0xF207,         // 21A: LD V2, DT
+    0x4200,         // 21C: SNE V2, 0
+    0x1200,         // 21E: JP 0x200
+    0x1214,         // 220: JP 0x214
+};
+
+template <Engine E>
+static void BM_SyntheticGame(benchmark::State &state) {
+  runProgram<E>(state, SYNTHETIC_GAME);
+}
+ENGINE_BENCHMARK(BM_SyntheticGame);
+
+// The instructions whose behaviour depends on the profile: shifts, skips and
+// register load/store. state.range(0) is the Profile, each one runs its own
+// handler table so all of them should match chip8.
+static const std::vector<uint16_t> PROFILE_MIX =
+    loop({0x6000, 0x6305},
+         {0x8136, 0x814E, 0x4001, 0x7101, 0xA300, 0xF355, 0xF365, 0x3001});
+
+template <Engine E>
+static void BM_ProfileQuirks(benchmark::State &state) {
+  runProgram<E>(state, PROFILE_MIX, Profile(state.range(0)));
+}
+ENGINE_BENCHMARK_ARGS(BM_ProfileQuirks, ->DenseRange(0, PROFILE_COUNT - 1));
+
+// Snapshots while a ROM keeps storing to one page, only that page is copied
+// each time
+static void BM_Snapshot(benchmark::State &state) {
+  Memory mem(MEM_SIZE);
+  Chip8 cpu(&mem);
+  loadProgram(&mem, loop({0xA300}, {0xFF55}));
+  Snapshot last;
+  for (auto _ : state) {
+    cpu.step(BLOCK_SIZE);
+    last = cpu.snapshot();
+    benchmark::DoNotOptimize(last);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_Snapshot);
+
+static void BM_Restore(benchmark::State &state) {
+  Memory mem(MEM_SIZE);
+  Chip8 cpu(&mem);
+  loadProgram(&mem, loop({0xA300}, {0xFF55}));
+  const Snapshot start = cpu.snapshot();
+  for (auto _ : state) {
+    cpu.step(BLOCK_SIZE);
+    cpu.restore(start);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_Restore);
+
+// starting a new ROM, a new Memory and Chip8 against resetting pooled ones
+static const uint8_t SMALL_ROM[] = {0x60, 0x01, 0x70, 0x01, 0x12, 0x02};
+
+static void BM_NewMachine(benchmark::State &state) {
+  const Profile profile = Profile(state.range(0));
+  for (auto _ : state) {
+    Memory mem(quirksOf(profile).MemorySize);
+    Chip8 cpu(&mem, Engine::Table, profile);
+    mem.write(ROM_START, SMALL_ROM, sizeof(SMALL_ROM));
+    cpu.step(1);
+    benchmark::DoNotOptimize(cpu.V[0]);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_NewMachine)->Arg(int(Profile::Chip8))->Arg(int(Profile::XOChip));
+
+static void BM_ResetMachine(benchmark::State &state) {
+  const Profile profile = Profile(state.range(0));
+  MachinePool pool;
+  for (auto _ : state) {
+    Machine *m = pool.get(Engine::Table, profile, SMALL_ROM, sizeof(SMALL_ROM));
+    m->Cpu.step(1);
+    benchmark::DoNotOptimize(m->Cpu.V[0]);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_ResetMachine)->Arg(int(Profile::Chip8))->Arg(int(Profile::XOChip));
+
+// Rewind history of the synthetic game, one record per frame
+static void BM_RewindRecord(benchmark::State &state) {
+  Memory mem(MEM_SIZE);
+  Chip8 cpu(&mem);
+  loadProgram(&mem, SYNTHETIC_GAME);
+  Rewind rewind;
+  for (auto _ : state) {
+    const uint64_t target = cpu.InstrCount + STEPS_PER_FRAME;
+    while (cpu.InstrCount < target) {
+      cpu.step(target - cpu.InstrCount);
+    }
+    cpu.fixedUpdate();
+    rewind.record(cpu);
+  }
+  state.SetItemsProcessed(state.iterations());
+  state.counters["bytes_per_frame"] = double(rewind.bytes()) / rewind.frames();
+}
+BENCHMARK(BM_RewindRecord);
+
+static void BM_RewindBack(benchmark::State &state) {
+  Memory mem(MEM_SIZE);
+  Chip8 cpu(&mem);
+  loadProgram(&mem, SYNTHETIC_GAME);
+  Rewind rewind;
+  for (auto _ : state) {
+    state.PauseTiming();
+    if (rewind.frames() < 2) {
+      for (size_t i = 0; i < REWIND_KEYFRAME_INTERVAL * 4; i++) {
+        cpu.step(STEPS_PER_FRAME);
+        cpu.fixedUpdate();
+        rewind.record(cpu);
+      }
+    }
+    state.ResumeTiming();
+    rewind.back(cpu);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_RewindBack);
+
+// ALU_MIX keeps every lane on the vector kernels, seeds decide the branches
+static const std::vector<uint16_t> ALU_MIX =
+    loop({0x6101}, {0xC0FF, 0x8014, 0x8105, 0x8203, 0x3000, 0x8306, 0x820E});
+
+// Batch against the same number of separate Chip8 objects, state.range(0)
+// is the number of machines
+static void runBatch(benchmark::State &state,
+                     const std::vector<uint16_t> &program) {
+  const size_t lanes = state.range(0);
+  Memory image(MEM_SIZE);
+  loadProgram(&image, program);
+  Batch batch(lanes, image);
+  for (size_t lane = 0; lane < lanes; lane++) {
+    batch.SEED[lane] = lane + 1;
+  }
+  for (auto _ : state) {
+    batch.step(STEPS_PER_ITER);
+  }
+  uint64_t total = 0;
+  for (size_t lane = 0; lane < lanes; lane++) {
+    total += batch.InstrCount[lane];
+  }
+  state.SetItemsProcessed(total);
+  state.counters["ips"] =
+      benchmark::Counter(total, benchmark::Counter::kIsRate);
+}
+
+static void runSeparate(benchmark::State &state,
+                        const std::vector<uint16_t> &program) {
+  const size_t lanes = state.range(0);
+  std::vector<Memory> mems(lanes, Memory(MEM_SIZE));
+  std::vector<Chip8> cpus;
+  for (size_t lane = 0; lane < lanes; lane++) {
+    loadProgram(&mems[lane], program);
+    cpus.emplace_back(&mems[lane]);
+    cpus.back().SEED = lane + 1;
+  }
+  for (auto _ : state) {
+    for (auto &cpu : cpus) {
+      const uint64_t target = cpu.InstrCount + STEPS_PER_ITER;
+      while (cpu.InstrCount < target) {
+        cpu.step(target - cpu.InstrCount);
+      }
+    }
+  }
+  uint64_t total = 0;
+  for (auto &cpu : cpus) {
+    total += cpu.InstrCount;
+  }
+  state.SetItemsProcessed(total);
+  state.counters["ips"] =
+      benchmark::Counter(total, benchmark::Counter::kIsRate);
+}
+
+static void BM_BatchAlu(benchmark::State &state) { runBatch(state, ALU_MIX); }
+BENCHMARK(BM_BatchAlu)->Arg(32)->Arg(256)->Arg(2048);
+
+static void BM_SeparateAlu(benchmark::State &state) {
+  runSeparate(state, ALU_MIX);
+}
+BENCHMARK(BM_SeparateAlu)->Arg(32)->Arg(256)->Arg(2048);
+
+static void BM_BatchSyntheticGame(benchmark::State &state) {
+  runBatch(state, SYNTHETIC_GAME);
+}
+BENCHMARK(BM_BatchSyntheticGame)->Arg(32)->Arg(256)->Arg(2048);
+
+static void BM_SeparateSyntheticGame(benchmark::State &state) {
+  runSeparate(state, SYNTHETIC_GAME);
+}
+BENCHMARK(BM_SeparateSyntheticGame)->Arg(32)->Arg(256)->Arg(2048);
+
+// BM_Rom runs a ROM from disk the way the frontend does, STEPS_PER_FRAME
+// instructions then a timer tick per frame
+static void BM_Rom(benchmark::State &state, Engine engine,
+                   std::string filename) {
+  Memory mem(MEM_SIZE);
+  Chip8 cpu(&mem, engine);
+  loadRom(&mem, ROM_START, filename);
+  for (auto _ : state) {
+    cpu.step(STEPS_PER_FRAME);
+    cpu.fixedUpdate();
+    if (cpu.Paused) {
+      // key wait, press and release a key so the ROM keeps going
+      cpu.sendInput(0x5, true);
+      cpu.sendInput(0x5, false);
+    }
+  }
+  state.SetItemsProcessed(cpu.InstrCount);
+  state.counters["ips"] =
+      benchmark::Counter(cpu.InstrCount, benchmark::Counter::kIsRate);
+}
+
+static void registerMemoryBenchmarks() {
+  benchmark::RegisterBenchmark("BM_MemoryGet", [](benchmark::State &state) {
+    Memory mem(MEM_SIZE);
+    size_t idx = 0;
+    for (auto _ : state) {
+      benchmark::DoNotOptimize(mem.get(idx++));
+    }
+    state.SetItemsProcessed(state.iterations());
+  });
+  benchmark::RegisterBenchmark("BM_MemorySet", [](benchmark::State &state) {
+    Memory mem(MEM_SIZE);
+    size_t idx = 0;
+    for (auto _ : state) {
+      mem.set(idx, idx);
+      idx++;
+      benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations());
+  });
+}
+
+// Whole ROM benchmarks are registered for every file in the directory named
+// by CHIP8_BENCH_ROMS, no ROMs are shipped with the emulator
+static void registerRomBenchmarks() {
+  const char *dirname = getenv("CHIP8_BENCH_ROMS");
+  if (dirname == nullptr) {
+    return;
+  }
+  DIR *dir = opendir(dirname);
+  if (dir == nullptr) {
+    return;
+  }
+  while (auto entry = readdir(dir)) {
+    std::string name(entry->d_name);
+    if (name == "." || name == "..") {
+      continue;
+    }
+    const std::string filename = std::string(dirname) + "/" + name;
+    benchmark::RegisterBenchmark(("BM_Rom<Engine::Table>/" + name).c_str(),
+                                 BM_Rom, Engine::Table, filename);
+    benchmark::RegisterBenchmark(("BM_Rom<Engine::Threaded>/" + name).c_str(),
+                                 BM_Rom, Engine::Threaded, filename);
+    benchmark::RegisterBenchmark(("BM_Rom<Engine::Jit>/" + name).c_str(),
+                                 BM_Rom, Engine::Jit, filename);
+  }
+  closedir(dir);
+}
 
-BENCHMARK_MAIN();
+int main(int argc, char **argv) {
+  registerMemoryBenchmarks();
+  registerRomBenchmarks();
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+    return 1;
+  }
+  benchmark::RunSpecifiedBenchmarks();
+  return 0;
+}
@@ -1,11 +1,12 @@
 #include "chip8.hpp"
+#include "jit.hpp"
 
+#include <algorithm>
+#include <chrono>
 #include <cstdint>
 #include <cstdio>
-#include <ctime>
-#include <iostream>
+#include <cstring>
 #include <limits.h>
-#include <raylib.h>
 
 static inline uint16_t barrelShiftLeft(uint16_t val, uint16_t amount) {
   const uint16_t mask = (CHAR_BIT * sizeof(val) - 1);
@@ -19,338 +20,665 @@ static inline uint16_t barrelShiftRight(uint16_t val, uint16_t amount) {
   return (val >> amount) | (val << ((-amount) & mask));
 }
 
-static bool Op0(Chip8 *c, uint8_t *instr) {
-  switch (instr[1]) {
-  case 0xE0:
-    for (size_t i = 0; i < WIN_SIZE; i++) {
-      c->FrameBuffer[i] = false;
-    }
-    return false;
-  case 0xEE:
-    if (c->SP < 0) {
-      std::cout << "Stack underflow" << std::endl;
-      c->Paused = true;
-      c->errStackUnderflow = true;
+// Every instruction has its own function, the opcode table handlers below and
+// the threaded engine in stepThreaded both call these so the engines cannot
+// drift apart. Returning false ends the current step call.
+//
+// Handlers are templated on the Profile, quirks are compile time constants so
+// every profile gets its own handlers with the other behaviours compiled out.
+
+// QUIRKS is the profile's row of the table as a constant expression
+template <Profile P> static constexpr const Quirks &QUIRKS = PROFILES[size_t(P)];
+
+template <Profile P>
+static inline bool SYS(Chip8 *c, const Instruction &instr) { return true; }
+
+// skip steps over the next instruction, on XO-CHIP that can be the two word
+// F000 nnnn
+template <Profile P>
+static inline void skip(Chip8 *c) {
+  if constexpr (QUIRKS<P>.XOChip) {
+    if (c->mem->fetch16(c->PC) == 0xF000) {
+      c->PC += 2;
     }
-    c->PC = c->Stack[c->SP - 1];
-    c->SP--;
+  }
+  c->PC += 2;
+}
+
+template <Profile P>
+static inline bool CLS(Chip8 *c, const Instruction &instr) {
+  c->FrameBuffer.clear();
+  return false;
+}
+
+template <Profile P>
+static inline bool RET(Chip8 *c, const Instruction &instr) {
+  if (c->SP == 0) {
+    c->Paused = true;
+    c->errStackUnderflow = true;
     return true;
   }
+  c->PC = c->Stack[--c->SP];
   return true;
 }
 
-static bool JMP(Chip8 *c, uint8_t *instr) {
-  uint16_t addr = instr[1];
-  addr |= (instr[0] & 0xF) << 8;
-  c->PC = addr;
-  return true;
+// SCD scrolls down n pixels
+template <Profile P>
+static inline bool SCD(Chip8 *c, const Instruction &instr) {
+  c->FrameBuffer.scrollDown(instr.n);
+  return false;
+}
+
+// SCU scrolls up n pixels
+template <Profile P>
+static inline bool SCU(Chip8 *c, const Instruction &instr) {
+  c->FrameBuffer.scrollUp(instr.n);
+  return false;
+}
+
+// SCR scrolls right 4 pixels
+template <Profile P>
+static inline bool SCR(Chip8 *c, const Instruction &instr) {
+  c->FrameBuffer.scrollRight(4);
+  return false;
 }
 
-static bool CALL(Chip8 *c, uint8_t *instr) {
-  uint16_t addr = instr[1];
-  addr |= (instr[0] & 0xF) << 8;
+// SCL scrolls left 4 pixels
+template <Profile P>
+static inline bool SCL(Chip8 *c, const Instruction &instr) {
+  c->FrameBuffer.scrollLeft(4);
+  return false;
+}
+
+// EXIT stops the interpreter, it stays on this instruction for good
+template <Profile P>
+static inline bool EXIT(Chip8 *c, const Instruction &instr) {
+  c->PC -= 2;
+  return false;
+}
+
+template <Profile P>
+static inline bool LOW(Chip8 *c, const Instruction &instr) {
+  c->FrameBuffer.setHires(false);
+  return false;
+}
+
+template <Profile P>
+static inline bool HIGH(Chip8 *c, const Instruction &instr) {
+  c->FrameBuffer.setHires(true);
+  return false;
+}
+
+// Op0 and OpF switch on the decoded kind, which instructions exist there
+// depends on the profile
+template <Profile P>
+static bool Op0(Chip8 *c, const Instruction &instr) {
+  switch (instr.kind) {
+  case K_CLS:
+    return CLS<P>(c, instr);
+  case K_RET:
+    return RET<P>(c, instr);
+  case K_SCD:
+    return SCD<P>(c, instr);
+  case K_SCU:
+    return SCU<P>(c, instr);
+  case K_SCR:
+    return SCR<P>(c, instr);
+  case K_SCL:
+    return SCL<P>(c, instr);
+  case K_EXIT:
+    return EXIT<P>(c, instr);
+  case K_LOW:
+    return LOW<P>(c, instr);
+  case K_HIGH:
+    return HIGH<P>(c, instr);
+  }
+  return SYS<P>(c, instr);
+}
+
+template <Profile P>
+static inline bool JMP(Chip8 *c, const Instruction &instr) {
+  const bool back = instr.nnn < c->PC;
+  c->PC = instr.nnn;
+  return !back || !c->idleLap();
+}
+
+template <Profile P>
+static inline bool CALL(Chip8 *c, const Instruction &instr) {
   if (c->SP >= STACK_SIZE) {
-    std::cout << "Stack overflow" << std::endl;
     c->Paused = true;
     c->errStackOverflow = true;
+    return true;
   }
-  c->SP++;
-  c->Stack[c->SP - 1] = c->PC;
-  c->PC = addr;
+  c->Stack[c->SP++] = c->PC;
+  c->PC = instr.nnn;
   return true;
 }
 
-static bool SE(Chip8 *c, uint8_t *instr) {
-  uint8_t reg = instr[0] & 0xF;
-  if (c->V[reg] == instr[1]) {
-    c->PC += 2;
+template <Profile P>
+static inline bool SE(Chip8 *c, const Instruction &instr) {
+  if (c->V[instr.x] == instr.kk) {
+    skip<P>(c);
   }
   return true;
 }
 
-static bool SNE(Chip8 *c, uint8_t *instr) {
-  uint8_t reg = instr[0] & 0xF;
-  if (c->V[reg] != instr[1]) {
-    c->PC += 2;
+template <Profile P>
+static inline bool SNE(Chip8 *c, const Instruction &instr) {
+  if (c->V[instr.x] != instr.kk) {
+    skip<P>(c);
   }
   return true;
 }
 
-static bool SEREG(Chip8 *c, uint8_t *instr) {
-  uint8_t a = instr[0] & 0xF;
-  uint8_t b = instr[1] >> 4;
-  if (c->V[a] == c->V[b]) {
-    c->PC += 2;
+template <Profile P>
+static inline bool SEREG(Chip8 *c, const Instruction &instr) {
+  if (c->V[instr.x] == c->V[instr.y]) {
+    skip<P>(c);
   }
   return true;
 }
 
-static bool LDI(Chip8 *c, uint8_t *instr) {
-  uint8_t reg = instr[0] & 0xF;
-  c->V[reg] = instr[1];
+// SAVE vx - vy stores the registers from x to y at I, counting down when y
+// is below x, I stays put
+template <Profile P>
+static inline bool SAVER(Chip8 *c, const Instruction &instr) {
+  const int step = (instr.y >= instr.x) ? 1 : -1;
+  const size_t len = (step > 0 ? instr.y - instr.x : instr.x - instr.y) + 1;
+  uint8_t regs[0x10];
+  for (size_t i = 0; i < len; i++) {
+    regs[i] = c->V[instr.x + int(i) * step];
+  }
+  c->mem->write(c->I, regs, len);
+  c->invalidate(c->I, len);
   return true;
 }
 
-static bool ADDI(Chip8 *c, uint8_t *instr) {
-  uint8_t reg = instr[0] & 0xF;
-  c->V[reg] += instr[1];
+// LOAD vx - vy is the reverse of SAVE
+template <Profile P>
+static inline bool LOADR(Chip8 *c, const Instruction &instr) {
+  const int step = (instr.y >= instr.x) ? 1 : -1;
+  const size_t len = (step > 0 ? instr.y - instr.x : instr.x - instr.y) + 1;
+  uint8_t regs[0x10];
+  c->mem->read(c->I, regs, len);
+  for (size_t i = 0; i < len; i++) {
+    c->V[instr.x + int(i) * step] = regs[i];
+  }
   return true;
 }
 
-static bool Op8(Chip8 *c, uint8_t *instr) {
-  uint8_t lowNibble = instr[1] & 0xF;
-  uint8_t x = instr[0] & 0xF;
-  uint8_t y = instr[1] >> 4;
-  switch (lowNibble) {
-  case 0x0: // LDR
-  {
-    c->V[x] = c->V[y];
-    return true;
-  }
-  case 0x1: // OR
-  {
-    c->V[x] |= c->V[y];
-    return true;
-  }
-  case 0x2: // AND
-  {
-    c->V[x] &= c->V[y];
-    return true;
-  }
-  case 0x3: // XOR
-  {
-    c->V[x] ^= c->V[y];
-    return true;
-  }
-  case 0x4: // ADD SET CARRY
-  {
-    uint16_t res = c->V[x] + c->V[y];
-    if (res > 0xFF) {
-      c->V[0xF] = 1;
-    } else {
-      c->V[0xF] = 0;
-    }
-    c->V[x] = res & 0xFF;
-    return true;
-  }
-  case 0x5: // SUB SET NOT BORROW
-  {
-    if (c->V[x] > c->V[y]) {
-      c->V[0xF] = 1;
-    } else {
-      c->V[0xF] = 0;
-    }
-    c->V[x] -= c->V[y];
-    return true;
-  }
-  case 0x6: // SHR
-  {
-    c->V[0xF] = c->V[x] & 1;
-    c->V[x] = c->V[x] >> 1;
-    return true;
-  }
-  case 0x7: // SUBN SET NOT BORROW
-  {
-    if (c->V[y] > c->V[x]) {
-      c->V[0xF] = 1;
-    } else {
-      c->V[0xF] = 0;
-    }
-    c->V[x] = c->V[y] - c->V[x];
-    return true;
-  }
-  case 0xE: // SHL
-  {
-    if ((c->V[x] & 0b1000'0000) != 0) {
-      c->V[0xF] = 1;
-    } else {
-      c->V[0xF] = 0;
-    }
-    c->V[x] = c->V[x] << 1;
-    return true;
-  }
-  }
+template <Profile P>
+static bool Op5(Chip8 *c, const Instruction &instr) {
+  switch (instr.kind) {
+  case K_SAVER:
+    return SAVER<P>(c, instr);
+  case K_LOADR:
+    return LOADR<P>(c, instr);
+  }
+  return SEREG<P>(c, instr);
+}
+
+template <Profile P>
+static inline bool LDI(Chip8 *c, const Instruction &instr) {
+  c->V[instr.x] = instr.kk;
+  return true;
+}
+
+template <Profile P>
+static inline bool ADDI(Chip8 *c, const Instruction &instr) {
+  c->V[instr.x] += instr.kk;
+  return true;
+}
+
+template <Profile P>
+static inline bool LDR(Chip8 *c, const Instruction &instr) {
+  c->V[instr.x] = c->V[instr.y];
+  return true;
+}
+
+template <Profile P>
+static inline bool OR(Chip8 *c, const Instruction &instr) {
+  c->V[instr.x] |= c->V[instr.y];
   return true;
 }
 
-static bool SNEREG(Chip8 *c, uint8_t *instr) {
-  uint8_t a = instr[0] & 0xF;
-  uint8_t b = instr[1] >> 4;
-  if (c->V[a] != c->V[b]) {
-    c->PC += 2;
+template <Profile P>
+static inline bool AND(Chip8 *c, const Instruction &instr) {
+  c->V[instr.x] &= c->V[instr.y];
+  return true;
+}
+
+template <Profile P>
+static inline bool XOR(Chip8 *c, const Instruction &instr) {
+  c->V[instr.x] ^= c->V[instr.y];
+  return true;
+}
+
+// ADD SET CARRY
+template <Profile P>
+static inline bool ADDR(Chip8 *c, const Instruction &instr) {
+  uint16_t res = c->V[instr.x] + c->V[instr.y];
+  if (res > 0xFF) {
+    c->V[0xF] = 1;
+  } else {
+    c->V[0xF] = 0;
+  }
+  c->V[instr.x] = res & 0xFF;
+  return true;
+}
+
+// SUB SET NOT BORROW
+template <Profile P>
+static inline bool SUB(Chip8 *c, const Instruction &instr) {
+  if (c->V[instr.x] > c->V[instr.y]) {
+    c->V[0xF] = 1;
+  } else {
+    c->V[0xF] = 0;
+  }
+  c->V[instr.x] -= c->V[instr.y];
+  return true;
+}
+
+// SHR and SHL shift Vy into Vx on profiles with ShiftVy, Vx in place
+// otherwise
+template <Profile P>
+static inline bool SHR(Chip8 *c, const Instruction &instr) {
+  const uint8_t src = QUIRKS<P>.ShiftVy ? instr.y : instr.x;
+  c->V[0xF] = c->V[src] & 1;
+  c->V[instr.x] = c->V[src] >> 1;
+  return true;
+}
+
+// SUBN SET NOT BORROW
+template <Profile P>
+static inline bool SUBN(Chip8 *c, const Instruction &instr) {
+  if (c->V[instr.y] > c->V[instr.x]) {
+    c->V[0xF] = 1;
+  } else {
+    c->V[0xF] = 0;
+  }
+  c->V[instr.x] = c->V[instr.y] - c->V[instr.x];
+  return true;
+}
+
+template <Profile P>
+static inline bool SHL(Chip8 *c, const Instruction &instr) {
+  const uint8_t src = QUIRKS<P>.ShiftVy ? instr.y : instr.x;
+  if ((c->V[src] & 0b1000'0000) != 0) {
+    c->V[0xF] = 1;
+  } else {
+    c->V[0xF] = 0;
+  }
+  c->V[instr.x] = c->V[src] << 1;
+  return true;
+}
+
+template <Profile P>
+static bool Op8(Chip8 *c, const Instruction &instr) {
+  switch (instr.n) {
+  case 0x0:
+    return LDR<P>(c, instr);
+  case 0x1:
+    return OR<P>(c, instr);
+  case 0x2:
+    return AND<P>(c, instr);
+  case 0x3:
+    return XOR<P>(c, instr);
+  case 0x4:
+    return ADDR<P>(c, instr);
+  case 0x5:
+    return SUB<P>(c, instr);
+  case 0x6:
+    return SHR<P>(c, instr);
+  case 0x7:
+    return SUBN<P>(c, instr);
+  case 0xE:
+    return SHL<P>(c, instr);
+  }
+  return SYS<P>(c, instr);
+}
+
+template <Profile P>
+static inline bool SNEREG(Chip8 *c, const Instruction &instr) {
+  if (c->V[instr.x] != c->V[instr.y]) {
+    skip<P>(c);
   }
   return true;
 }
 
 // LD into reg I, Immediate
-static bool LDII(Chip8 *c, uint8_t *instr) {
-  uint16_t val = instr[1];
-  val |= (instr[0] & 0xF) << 8;
-  c->I = val;
+template <Profile P>
+static inline bool LDII(Chip8 *c, const Instruction &instr) {
+  c->I = instr.nnn;
   return true;
 }
 
 // JP V0, addr
-// jump to V0 + addr
-static bool JPOff(Chip8 *c, uint8_t *instr) {
-  uint16_t val = instr[1];
-  val |= (instr[0] & 0xF) << 8;
-  c->PC = c->V[0] + val;
+// jump to V0 + addr, or Vx + xnn on profiles with JumpVx
+template <Profile P>
+static inline bool JPOff(Chip8 *c, const Instruction &instr) {
+  c->PC = c->V[QUIRKS<P>.JumpVx ? instr.x : 0] + instr.nnn;
   return true;
 }
 
 // RND creates an 8 bit random number generated by XOR shift
 // and with instr Cxkk, sets Vx = kk
-static bool RND(Chip8 *c, uint8_t *instr) {
+template <Profile P>
+static inline bool RND(Chip8 *c, const Instruction &instr) {
   c->SEED ^= barrelShiftLeft(c->SEED, 13);
   c->SEED ^= barrelShiftRight(c->SEED, 17);
   c->SEED ^= barrelShiftLeft(c->SEED, 5);
   if (c->SEED == 0) {
-    c->SEED = static_cast<uint16_t>(time(NULL));
-  }
-
-  uint8_t reg = instr[0] & 0xF;
-  c->V[reg] = instr[1] & c->SEED;
-  return true;
-}
-
-static bool DRW(Chip8 *c, uint8_t *instr) {
-  uint8_t x = c->V[instr[0] & 0xF];
-  uint8_t y = c->V[instr[1] >> 4];
-  const uint8_t count = instr[1] & 0xF;
-  const uint8_t sprite_start_x = x;
-  for (uint8_t i = 0; i < count; i++) {
-    uint8_t value = c->mem->get(c->I + i);
-    x = sprite_start_x;
-    for (ssize_t j = sizeof(uint8_t) * 8; j >= 0; j--) {
-      size_t idx = x + (y * WIN_SIZE_X);
-      x = (x + 1) % WIN_SIZE_X;
-      bool bit = (value & (1 << j)) != 0;
-      bool oldVal = c->FrameBuffer[idx];
-      bool newVal = oldVal ^ bit;
-      c->FrameBuffer[idx] = newVal;
-      if ((oldVal == 1) && (newVal == 0)) {
-        c->V[0xF] = 1;
-      } else {
-        c->V[0xF] = 0;
-      }
-    }
-    y = (y + 1) % WIN_SIZE_Y;
+    c->SEED = DEFAULT_SEED;
   }
-  return false;
+
+  c->V[instr.x] = instr.kk & c->SEED;
+  return true;
 }
 
-// Skip instruction if key pressed/not pressed
-static bool SKPP(Chip8 *c, uint8_t *instr) {
-  uint8_t reg = instr[0] >> 4;
-  bool keyPressed = c->KeyPad[c->V[reg]];
-  switch (instr[1]) {
-  case 0x9E: // Skip next instruction if key with value of Vx is pressed
-  {
-    if (keyPressed) {
-      c->PC += 2;
-    }
-    return true;
-  }
-  case 0xA1: // Skip next instruction if key with value of Vx is not pressed
-  {
-    if (!keyPressed) {
-      c->PC += 2;
-    }
-    return true;
+// DRW draws n rows, Dxy0 draws a 16x16 sprite on SCHIP. With both XO-CHIP
+// planes selected the sprite data for the second plane follows the first.
+template <Profile P>
+static inline bool DRW(Chip8 *c, const Instruction &instr) {
+  const bool wide = instr.n == 0 && QUIRKS<P>.SChip;
+  const size_t height = wide ? 16 : instr.n;
+  const uint8_t planes = c->FrameBuffer.Planes;
+  const size_t len =
+      height * (wide ? 2 : 1) * (((planes & 1) != 0) + ((planes & 2) != 0));
+  uint8_t sprite[2 * 2 * 16];
+  c->mem->read(c->I, sprite, len);
+  c->V[0xF] = c->FrameBuffer.draw(c->V[instr.x], c->V[instr.y], sprite,
+                                  height, wide);
+  if constexpr (QUIRKS<P>.DisplayWait) {
+    c->WaitTick = true;
   }
+  return false;
+}
+
+// Skip next instruction if key with value of Vx is pressed
+template <Profile P>
+static inline bool SKP(Chip8 *c, const Instruction &instr) {
+  if (c->KeyPad[c->V[instr.x] & 0xF]) {
+    skip<P>(c);
   }
   return true;
 }
 
-static bool OpF(Chip8 *c, uint8_t *instr) {
-  uint8_t reg = instr[0] & 0xF;
-  switch (instr[1]) {
-  case 0x07: // LD Vx, DT
-  {
-    c->V[reg] = c->DT;
-    return true;
-  }
-  case 0x0A: // LD Vx, K
-  {
-    // wait for a key press, store the value of key into Vx
-    // pause CPU till key is pressed
-    c->inputReg = reg;
-    c->Paused = true;
-    return true;
-  }
-  case 0x15: // LD DT, xVx
-  {
-    c->DT = c->V[reg];
-    return true;
-  }
-  case 0x18: // LD ST, Vx
-  {
-    c->ST = c->V[reg];
-    return true;
-  }
-  case 0x1E: // ADD I, Vx
-  {
-    c->I = c->I + c->V[reg];
-    return true;
-  }
-  case 0x29: // LD F, Vx
-  {
-    // set the value of I to the location for the hex sprite corresponding to
-    // the value of Vx
-    c->I = c->V[reg] * CHAR_SPRITE_SIZE;
-    return true;
-  }
-  case 0x33: // LD B, Vx
-  {
-    uint8_t val = c->V[reg];
-    uint8_t ones = val % 10;
-    val /= 10;
-    uint8_t tens = val % 10;
-    val /= 10;
-    uint8_t hundreds = val % 10;
-    c->mem->set(c->I, hundreds);
-    c->mem->set(c->I + 1, tens);
-    c->mem->set(c->I + 2, ones);
-    return true;
-  }
-  case 0x55: // LD [I], Vx
-  {
-    for (size_t i = 0; i < 0x10; i++) {
-      c->mem->set(c->I + i, c->V[i]);
-    }
-    return true;
-  }
-  case 0x65: // LD Vx, [I]
-  {
-    for (size_t i = 0; i < 0x10; i++) {
-      c->V[i] = c->mem->get(c->I + i);
-    }
-    return true;
+// Skip next instruction if key with value of Vx is not pressed
+template <Profile P>
+static inline bool SKNP(Chip8 *c, const Instruction &instr) {
+  if (!c->KeyPad[c->V[instr.x] & 0xF]) {
+    skip<P>(c);
   }
+  return true;
+}
+
+// Skip instruction if key pressed/not pressed
+template <Profile P>
+static bool SKPP(Chip8 *c, const Instruction &instr) {
+  switch (instr.kk) {
+  case 0x9E:
+    return SKP<P>(c, instr);
+  case 0xA1:
+    return SKNP<P>(c, instr);
+  }
+  return SYS<P>(c, instr);
+}
+
+// LD Vx, DT
+template <Profile P>
+static inline bool LDVDT(Chip8 *c, const Instruction &instr) {
+  c->V[instr.x] = c->DT;
+  return true;
+}
+
+// LD Vx, K
+template <Profile P>
+static inline bool LDK(Chip8 *c, const Instruction &instr) {
+  // wait for a key press, store the value of key into Vx
+  // pause CPU till key is pressed
+  c->inputReg = instr.x;
+  c->Paused = true;
+  return true;
+}
+
+// LD DT, Vx
+template <Profile P>
+static inline bool LDDT(Chip8 *c, const Instruction &instr) {
+  c->DT = c->V[instr.x];
+  return true;
+}
+
+// LD ST, Vx ends the step like every change to the sound, so audio sees it
+// on the cycle it happened
+template <Profile P>
+static inline bool LDST(Chip8 *c, const Instruction &instr) {
+  c->ST = c->V[instr.x];
+  return false;
+}
+
+// ADD I, Vx
+template <Profile P>
+static inline bool ADDIV(Chip8 *c, const Instruction &instr) {
+  c->I = c->I + c->V[instr.x];
+  return true;
+}
+
+// LD F, Vx
+template <Profile P>
+static inline bool LDF(Chip8 *c, const Instruction &instr) {
+  // set the value of I to the location for the hex sprite corresponding to
+  // the value of Vx
+  c->I = c->V[instr.x] * CHAR_SPRITE_SIZE;
+  return true;
+}
+
+// LD B, Vx
+template <Profile P>
+static inline bool LDB(Chip8 *c, const Instruction &instr) {
+  uint8_t val = c->V[instr.x];
+  uint8_t ones = val % 10;
+  val /= 10;
+  uint8_t tens = val % 10;
+  val /= 10;
+  uint8_t hundreds = val % 10;
+  const uint8_t digits[3] = {hundreds, tens, ones};
+  c->mem->write(c->I, digits, 3);
+  c->invalidate(c->I, 3);
+  return true;
+}
+
+// LD [I], Vx stores V0 to Vx, profiles with LoadStoreIncI move I past them
+template <Profile P>
+static inline bool STORE(Chip8 *c, const Instruction &instr) {
+  const uint16_t addr = c->I;
+  c->mem->write(addr, c->V, instr.x + 1);
+  if constexpr (QUIRKS<P>.LoadStoreIncI) {
+    c->I += instr.x + 1;
+  }
+  c->invalidate(addr, instr.x + 1);
+  return true;
+}
+
+// LD Vx, [I] loads V0 to Vx
+template <Profile P>
+static inline bool LOAD(Chip8 *c, const Instruction &instr) {
+  c->mem->read(c->I, c->V, instr.x + 1);
+  if constexpr (QUIRKS<P>.LoadStoreIncI) {
+    c->I += instr.x + 1;
   }
   return true;
 }
 
-static bool NOOP(Chip8 *c, uint8_t *instr) { return false; }
+// LD HF, Vx points I at the big font digit in Vx
+template <Profile P>
+static inline bool LDHF(Chip8 *c, const Instruction &instr) {
+  c->I = BIG_FONT_START + (c->V[instr.x] & 0xF) * BIG_CHAR_SPRITE_SIZE;
+  return true;
+}
 
-Chip8::Chip8(Memory *m) : PC(0x200), mem(m) {
-  opcodes[0x0] = &Op0;
-  opcodes[0x1] = &JMP;
-  opcodes[0x2] = &CALL;
-  opcodes[0x3] = &SE;
-  opcodes[0x4] = &SNE;
-  opcodes[0x5] = &SEREG;
-  opcodes[0x6] = &LDI;
-  opcodes[0x7] = &ADDI;
-  opcodes[0x8] = &Op8;
-  opcodes[0x9] = &SNEREG;
-  opcodes[0xA] = &LDII;
-  opcodes[0xB] = &JPOff;
-  opcodes[0xC] = &RND;
-  opcodes[0xD] = &DRW;
-  opcodes[0xE] = &SKPP;
-  opcodes[0xF] = &OpF;
+// LD R, Vx saves V0 to Vx in the RPL flags
+template <Profile P>
+static inline bool SRPL(Chip8 *c, const Instruction &instr) {
+  std::copy(c->V, c->V + instr.x + 1, c->RPL);
+  return true;
+}
+
+// LD Vx, R restores V0 to Vx from the RPL flags
+template <Profile P>
+static inline bool LRPL(Chip8 *c, const Instruction &instr) {
+  std::copy(c->RPL, c->RPL + instr.x + 1, c->V);
+  return true;
+}
+
+// LD I, nnnn takes its address from the word after it
+template <Profile P>
+static inline bool LDIL(Chip8 *c, const Instruction &instr) {
+  c->I = instr.nnn;
+  c->PC += 2;
+  return true;
+}
+
+// PLANE n selects the planes drawn to, n is in the x nibble
+template <Profile P>
+static inline bool PLANE(Chip8 *c, const Instruction &instr) {
+  c->FrameBuffer.Planes = instr.x & 3;
+  return true;
+}
+
+// AUDIO loads the 16 byte audio pattern at I
+template <Profile P>
+static inline bool AUDIO(Chip8 *c, const Instruction &instr) {
+  c->mem->read(c->I, c->Pattern, 0x10);
+  return false;
+}
+
+// PITCH sets the audio pattern playback rate from Vx
+template <Profile P>
+static inline bool PITCH(Chip8 *c, const Instruction &instr) {
+  c->Pitch = c->V[instr.x];
+  return false;
+}
+
+template <Profile P>
+static bool OpF(Chip8 *c, const Instruction &instr) {
+  switch (instr.kind) {
+  case K_LDVDT:
+    return LDVDT<P>(c, instr);
+  case K_LDK:
+    return LDK<P>(c, instr);
+  case K_LDDT:
+    return LDDT<P>(c, instr);
+  case K_LDST:
+    return LDST<P>(c, instr);
+  case K_ADDIV:
+    return ADDIV<P>(c, instr);
+  case K_LDF:
+    return LDF<P>(c, instr);
+  case K_LDB:
+    return LDB<P>(c, instr);
+  case K_STORE:
+    return STORE<P>(c, instr);
+  case K_LOAD:
+    return LOAD<P>(c, instr);
+  case K_LDHF:
+    return LDHF<P>(c, instr);
+  case K_SRPL:
+    return SRPL<P>(c, instr);
+  case K_LRPL:
+    return LRPL<P>(c, instr);
+  case K_LDIL:
+    return LDIL<P>(c, instr);
+  case K_PLANE:
+    return PLANE<P>(c, instr);
+  case K_AUDIO:
+    return AUDIO<P>(c, instr);
+  case K_PITCH:
+    return PITCH<P>(c, instr);
+  }
+  return SYS<P>(c, instr);
+}
+
+// OPCODES is the per nibble handler table of one profile, built at compile time
+template <Profile P>
+static constexpr Instruction::op OPCODES[0x10] = {
+    &Op0<P>, &JMP<P>,  &CALL<P>,   &SE<P>,    // 0-3
+    &SNE<P>, &Op5<P>,  &LDI<P>,    &ADDI<P>,  // 4-7
+    &Op8<P>, &SNEREG<P>, &LDII<P>, &JPOff<P>, // 8-B
+    &RND<P>, &DRW<P>,  &SKPP<P>,   &OpF<P>,   // C-F
+};
+
+// backward jumps between idle samples, see idleLap
+static const uint32_t IDLE_SAMPLE_LAPS = 8;
+
+// ProfileEngine is one profile's instantiation of the interpreter
+struct ProfileEngine {
+  const Instruction::op *Opcodes;
+  void (Chip8::*StepThreaded)(int);
+};
+
+// BOOT_IMAGE is what a CPU writes to the start of memory when it boots, the
+// 4x5 hex digits then from BIG_FONT_START the 8x10 digits of SCHIP and
+// XO-CHIP, only on the profiles that have them
+static const uint8_t BOOT_IMAGE[] = {
+    0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
+    0x20, 0x60, 0x20, 0x20, 0x70, // 1
+    0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
+    0xF0, 0x10, 0xF0, 0x10, 0xF0, // 3
+    0x90, 0x90, 0xF0, 0x10, 0x10, // 4
+    0xF0, 0x80, 0xF0, 0x10, 0xF0, // 5
+    0xF0, 0x80, 0xF0, 0x90, 0xF0, // 6
+    0xF0, 0x10, 0x20, 0x40, 0x40, // 7
+    0xF0, 0x90, 0xF0, 0x90, 0xF0, // 8
+    0xF0, 0x90, 0xF0, 0x10, 0xF0, // 9
+    0xF0, 0x90, 0xF0, 0x90, 0x90, // A
+    0xF0, 0x90, 0xE0, 0x90, 0xF0, // B
+    0xF0, 0x80, 0x80, 0x80, 0xF0, // C
+    0xE0, 0x90, 0x90, 0x90, 0xE0, // D
+    0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
+    0xF0, 0x80, 0xF0, 0x80, 0x80, // F
+    // BIG_FONT_START
+    0xFF, 0xFF, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, // 0
+    0x18, 0x78, 0x78, 0x18, 0x18, 0x18, 0x18, 0x18, 0xFF, 0xFF, // 1
+    0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // 2
+    0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 3
+    0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0x03, 0x03, // 4
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 5
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 6
+    0xFF, 0xFF, 0x03, 0x03, 0x06, 0x0C, 0x18, 0x18, 0x18, 0x18, // 7
+    0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 8
+    0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 9
+    0x7E, 0xFF, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xC3, // A
+    0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, // B
+    0x3C, 0xFF, 0xC3, 0xC0, 0xC0, 0xC0, 0xC0, 0xC3, 0xFF, 0x3C, // C
+    0xFC, 0xFE, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFE, 0xFC, // D
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // E
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xC0, 0xC0, // F
+};
+static_assert(sizeof(BOOT_IMAGE) ==
+                  BIG_FONT_START + 0x10 * BIG_CHAR_SPRITE_SIZE,
+              "both fonts are in the boot image");
+
+static size_t bootSize(Profile p) {
+  return quirksOf(p).SChip ? sizeof(BOOT_IMAGE) : BIG_FONT_START;
+}
+
+Chip8::Chip8(Memory *m, Engine e, Profile p)
+    : PC(0x200), mem(m), engine(e), prof(p), decoded(m->size()),
+      decodedPages(m->pageCount()) {
+  if (engine == Engine::Jit) {
+    jit.reset(new Jit(this, m->size()));
+  }
+
+  // in the order of Profile
+  static const ProfileEngine engines[PROFILE_COUNT] = {
+      {OPCODES<Profile::Chip8>, &Chip8::stepThreaded<Profile::Chip8>},
+      {OPCODES<Profile::Cosmac>, &Chip8::stepThreaded<Profile::Cosmac>},
+      {OPCODES<Profile::SChip>, &Chip8::stepThreaded<Profile::SChip>},
+      {OPCODES<Profile::XOChip>, &Chip8::stepThreaded<Profile::XOChip>},
+  };
+  opcodes = engines[size_t(prof)].Opcodes;
+  threaded = engines[size_t(prof)].StepThreaded;
 
   for (size_t i = 0; i < 0x10; i++) {
     V[i] = 0;
@@ -364,244 +692,401 @@ Chip8::Chip8(Memory *m) : PC(0x200), mem(m) {
     Stack[i] = 0;
   }
 
-  for (size_t i = 0; i < WIN_SIZE; i++) {
-    FrameBuffer[i] = false;
-  }
+  std::fill(RPL, RPL + 0x10, 0);
+  std::fill(Pattern, Pattern + 0x10, 0);
 
   // Write interpreter into memory
-  // Char 0
-  mem->set16(0x00, 0b11110000);
-  mem->set16(0x02, 0b10010000);
-  mem->set16(0x04, 0b10010000);
-  mem->set16(0x06, 0b10010000);
-  mem->set16(0x08, 0b11110000);
-  // Char 1
-  mem->set16(0x0A, 0b00100000);
-  mem->set16(0x0C, 0b01100000);
-  mem->set16(0x0E, 0b00100000);
-  mem->set16(0x10, 0b00100000);
-  mem->set16(0x12, 0b01110000);
-  // Char 2
-  mem->set16(0x14, 0b11110000);
-  mem->set16(0x16, 0b00010000);
-  mem->set16(0x18, 0b11110000);
-  mem->set16(0x1A, 0b10000000);
-  mem->set16(0x1C, 0b11110000);
-  // Char 3
-  mem->set16(0x1E, 0b11110000);
-  mem->set16(0x20, 0b00010000);
-  mem->set16(0x22, 0b11110000);
-  mem->set16(0x24, 0b00010000);
-  mem->set16(0x26, 0b11110000);
-  // Char 4
-  mem->set16(0x28, 0b10010000);
-  mem->set16(0x2A, 0b10010000);
-  mem->set16(0x2C, 0b11110000);
-  mem->set16(0x2E, 0b00010000);
-  mem->set16(0x30, 0b00010000);
-  // Char 5
-  mem->set16(0x32, 0b11110000);
-  mem->set16(0x34, 0b10000000);
-  mem->set16(0x36, 0b11110000);
-  mem->set16(0x38, 0b00010000);
-  mem->set16(0x3A, 0b11110000);
-  // Char 6
-  mem->set16(0x3C, 0b11110000);
-  mem->set16(0x3E, 0b10000000);
-  mem->set16(0x40, 0b11110000);
-  mem->set16(0x42, 0b10010000);
-  mem->set16(0x44, 0b11110000);
-  // Char 7
-  mem->set16(0x46, 0b11110000);
-  mem->set16(0x48, 0b00010000);
-  mem->set16(0x4A, 0b00100000);
-  mem->set16(0x4C, 0b01000000);
-  mem->set16(0x4E, 0b01000000);
-  // Char 8
-  mem->set16(0x50, 0b11110000);
-  mem->set16(0x52, 0b10010000);
-  mem->set16(0x54, 0b11110000);
-  mem->set16(0x56, 0b10010000);
-  mem->set16(0x58, 0b11110000);
-  // Char 9
-  mem->set16(0x5A, 0b11110000);
-  mem->set16(0x5C, 0b10010000);
-  mem->set16(0x5E, 0b11110000);
-  mem->set16(0x60, 0b00010000);
-  mem->set16(0x62, 0b11110000);
-  // Char A
-  mem->set16(0x64, 0b11110000);
-  mem->set16(0x66, 0b10010000);
-  mem->set16(0x68, 0b11110000);
-  mem->set16(0x6A, 0b10010000);
-  mem->set16(0x6C, 0b10010000);
-  // Char B
-  mem->set16(0x6E, 0b11110000);
-  mem->set16(0x70, 0b10010000);
-  mem->set16(0x72, 0b11100000);
-  mem->set16(0x74, 0b10010000);
-  mem->set16(0x76, 0b11110000);
-  // Char C
-  mem->set16(0x78, 0b11110000);
-  mem->set16(0x7A, 0b10000000);
-  mem->set16(0x7C, 0b10000000);
-  mem->set16(0x7E, 0b10000000);
-  mem->set16(0x80, 0b11110000);
-  // Char D
-  mem->set16(0x82, 0b11100000);
-  mem->set16(0x84, 0b10010000);
-  mem->set16(0x86, 0b10010000);
-  mem->set16(0x88, 0b10010000);
-  mem->set16(0x8A, 0b11100000);
-  // Char E
-  mem->set16(0x8C, 0b11110000);
-  mem->set16(0x8E, 0b10000000);
-  mem->set16(0x90, 0b11110000);
-  mem->set16(0x92, 0b10000000);
-  mem->set16(0x94, 0b11110000);
-  // Char F
-  mem->set16(0x96, 0b11110000);
-  mem->set16(0x98, 0b10000000);
-  mem->set16(0x9A, 0b11110000);
-  mem->set16(0x9C, 0b10000000);
-  mem->set16(0x9E, 0b10000000);
+  mem->write(0, BOOT_IMAGE, bootSize(prof));
+  decodedGeneration = mem->generation();
+}
+
+void Chip8::reset() { reset(nullptr, 0); }
+
+bool Chip8::reset(const uint8_t *rom, size_t len) {
+  std::fill(V, V + 0x10, 0);
+  I = 0;
+  DT = 0;
+  ST = 0;
+  SEED = DEFAULT_SEED;
+  PC = 0x200;
+  SP = 0;
+  std::fill(IR, IR + 2, 0);
+  std::fill(Stack, Stack + STACK_SIZE, 0);
+  std::fill(KeyPad, KeyPad + 0x10, false);
+  InstrCount = 0;
+  IdleSkipped = 0;
+  inputReg = 0;
+  Paused = false;
+  errStackUnderflow = false;
+  errStackOverflow = false;
+  WaitTick = false;
+  std::fill(RPL, RPL + 0x10, 0);
+  std::fill(Pattern, Pattern + 0x10, 0);
+  Pitch = DEFAULT_PITCH;
+  FrameBuffer = Screen();
+
+  mem->load(BOOT_IMAGE, bootSize(prof));
+  const bool fits = PC + len <= mem->size();
+  if (fits) {
+    mem->write(PC, rom, len);
+  }
+  forgetAll();
+  forgetIdle();
+  idleLength = 0;
+  return fits;
+}
+
+Chip8::~Chip8() = default;
+Chip8::Chip8(Chip8 &&) = default;
+Chip8 &Chip8::operator=(Chip8 &&) = default;
+
+// stepEnd works out why a step call returned
+static StepEnd stepEnd(const Chip8 &cpu, bool ranAll) {
+  if (ranAll) {
+    return StepEnd::Budget;
+  } else if (cpu.Paused) {
+    return StepEnd::Paused;
+  } else if (cpu.WaitTick) {
+    return StepEnd::WaitTick;
+  }
+  switch (decodeKind(cpu.IR[0], cpu.IR[1], cpu.quirks())) {
+  case K_DRW:
+    return StepEnd::Draw;
+  case K_CLS:
+    return StepEnd::Clear;
+  default:
+    return StepEnd::Other;
+  }
 }
 
 void Chip8::step(int count) {
-  if (Paused) {
+  if constexpr (PROFILER_ENABLED) {
+    if (profiler != nullptr) {
+      const uint64_t before = InstrCount;
+      const auto start = std::chrono::steady_clock::now();
+      dispatch(count);
+      const uint64_t nanos =
+          std::chrono::duration_cast<std::chrono::nanoseconds>(
+              std::chrono::steady_clock::now() - start)
+              .count();
+      const uint64_t ran = InstrCount - before;
+      profiler->step(stepEnd(*this, ran >= uint64_t(count)), nanos, ran);
+      return;
+    }
+  }
+  dispatch(count);
+}
+
+void Chip8::dispatch(int count) {
+  if (Paused || WaitTick) {
     return;
   }
-  while (count-- > 0) {
-    IR[0] = mem->get(PC);
-    IR[1] = mem->get(PC + 1);
-    PC += 2;
-    uint8_t op = IR[0] >> 4;
-    if (!opcodes[op](this, IR) || Paused) {
+  if (decodedGeneration != mem->generation()) {
+    // memory was written from outside the CPU, nothing cached can be trusted
+    forgetAll();
+  }
+  // inputs and timer ticks come between steps, so loops are only idle
+  // within one
+  forgetIdle();
+  const uint64_t end = InstrCount + count;
+  while (count > 0) {
+    switch (engine) {
+    case Engine::Table:
+      stepTable(count);
+      break;
+    case Engine::Threaded:
+      (this->*threaded)(count);
+      break;
+    case Engine::Jit:
+      stepJit(count);
+      break;
+    }
+    if (idleLength == 0) {
       return;
     }
+    // the laps left would end where they started, only the remainder runs
+    const uint64_t skipped = (end - InstrCount) / idleLength * idleLength;
+    InstrCount += skipped;
+    IdleSkipped += skipped;
+    idleLength = 0;
+    count = end - InstrCount;
   }
 }
 
-void Chip8::fixedUpdate() {
-  if (ST != 0) {
-    ST--;
+bool Chip8::idleLap() {
+  if (PC != idle.Head) {
+    idle.Head = PC;
+    idle.Laps = 0;
+    idle.Sampled = false;
+    return false;
   }
-  if (DT != 0) {
-    DT--;
+  // comparing every lap would cost more than most loops, any multiple of
+  // the real period finds it just as well
+  if (++idle.Laps % IDLE_SAMPLE_LAPS != 0) {
+    return false;
+  }
+  IdleState now;
+  memset(&now, 0, sizeof(now));
+  std::copy(V, V + 0x10, now.V);
+  now.I = I;
+  now.SEED = SEED;
+  std::copy(Stack, Stack + STACK_SIZE, now.Stack);
+  now.DT = DT;
+  now.ST = ST;
+  now.SP = SP;
+  now.Pitch = Pitch;
+  now.Planes = FrameBuffer.Planes;
+  std::copy(RPL, RPL + 0x10, now.RPL);
+  std::copy(Pattern, Pattern + 0x10, now.Pattern);
+  now.Memory = mem->generation();
+  if (idle.Sampled && memcmp(&now, &idle.Sample, sizeof(now)) == 0) {
+    idleLength = InstrCount - idle.At;
+    forgetIdle();
+    return true;
   }
+  idle.Sample = now;
+  idle.At = InstrCount;
+  idle.Sampled = true;
+  return false;
 }
 
-void Chip8::sendInput(uint8_t key, bool value) {
-  KeyPad[key & 0xF] = value;
-  if (value) {
-    if (Paused) {
-      V[inputReg] = key & 0xF;
-      inputReg = 0;
+inline const Instruction &Chip8::fetch() {
+  Instruction &instr = decoded[PC % decoded.size()];
+  if (instr.handler == nullptr) {
+    decode(PC, &instr);
+    decodedPages[(PC % decoded.size()) >> MEM_PAGE_SHIFT] = true;
+  }
+  if constexpr (PROFILER_ENABLED) {
+    if (profiler != nullptr) {
+      profiler->instruction(*this, instr, PC);
     }
-    Paused = false;
   }
+  IR[0] = instr.raw[0];
+  IR[1] = instr.raw[1];
+  PC += 2;
+  InstrCount++;
+  return instr;
 }
 
-void Chip8::drawScr(int sizeX, int sizeY) {
-  Rectangle r;
-  r.height = sizeY / WIN_SIZE_Y;
-  r.width = sizeX / WIN_SIZE_X;
-  for (int j = 0; j < WIN_SIZE_Y; j++) {
-    for (int i = 0; i < WIN_SIZE_X; i++) {
-      int idx = i + (j * WIN_SIZE_X);
-      if (FrameBuffer[idx]) {
-        r.x = i * r.width;
-        r.y = j * r.height;
-        DrawRectangleRec(r, DARKGREEN);
-      }
+void Chip8::stepTable(int count) {
+  while (count-- > 0) {
+    const Instruction &instr = fetch();
+    if (!instr.handler(this, instr) || Paused) {
+      return;
     }
   }
 }
 
-void Chip8::drawReg(int winSizeX, int winSizeY) {
-  const auto color = LIGHTGRAY;
-  const int size = 20;
-  int startY = winSizeY;
-  char buf[512];
-  sprintf(buf, "PC: %04x\tSP: %04x\tIR: %02x%02x", PC, SP, IR[0], IR[1]);
-  DrawText(buf, 0, startY, size, color);
-  startY += size;
-  sprintf(buf, "I: %04x\tDT: %04x\t ST: %04x\tRND Seed: %04x", I, DT, ST, SEED);
-  DrawText(buf, 0, startY, size, color);
-  startY += size;
-  int startX = 0;
-  int hSize = 140;
-  for (int i = 0; i < 0x10; i++) {
-    sprintf(buf, "V[%02x]=%02x", i, V[i]);
-    DrawText(buf, startX, startY, size, color);
-    startX += hSize;
-    if ((i + 1) % 4 == 0) {
-      startY += size;
-      startX = 0;
+// stepJit runs compiled blocks and interprets one instruction whenever the
+// recompiler gives up, which is also where DRW and CLS end the step
+void Chip8::stepJit(int count) {
+  while (count > 0) {
+    const int ran = jit->run(this, count);
+    if constexpr (PROFILER_ENABLED) {
+      if (profiler != nullptr) {
+        profiler->jitRan(ran);
+      }
+    }
+    count -= ran;
+    if (idleLength != 0 || count-- <= 0) {
+      return;
+    }
+    const Instruction &instr = fetch();
+    if (!instr.handler(this, instr) || Paused) {
+      return;
     }
   }
+}
 
-  const auto pressed = DARKGREEN;
-  startX = 0;
-  for (int i = 0; i < 0x10; i++) {
-    sprintf(buf, "K%02x", i);
-    auto c = (KeyPad[i]) ? pressed : color;
-    DrawText(buf, startX, startY, size, c);
-    startX += hSize;
-    if ((i + 1) % 4 == 0) {
-      startY += size;
-      startX = 0;
+// stepThreaded dispatches straight on the flattened Kind, with computed goto
+// every instruction ends in its own indirect jump to the next one
+#if defined(__GNUC__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#endif
+template <Profile P> void Chip8::stepThreaded(int count) {
+  const Instruction *instr;
+#if defined(__GNUC__)
+#define CHIP8_LABEL(name) &&L_##name,
+  static const void *labels[] = {CHIP8_INSTRUCTIONS(CHIP8_LABEL)};
+#undef CHIP8_LABEL
+#define CHIP8_DISPATCH()                                                       \
+  if (count-- <= 0) {                                                          \
+    return;                                                                    \
+  }                                                                            \
+  instr = &fetch();                                                            \
+  goto *labels[instr->kind];
+#define CHIP8_CASE(name)                                                       \
+  L_##name : if (!name<P>(this, *instr) || Paused) { return; }                    \
+  CHIP8_DISPATCH()
+
+  CHIP8_DISPATCH()
+  CHIP8_INSTRUCTIONS(CHIP8_CASE)
+#undef CHIP8_CASE
+#undef CHIP8_DISPATCH
+#else
+#define CHIP8_CASE(name)                                                       \
+  case K_##name:                                                               \
+    if (!name<P>(this, *instr) || Paused) {                                    \
+      return;                                                                  \
+    }                                                                          \
+    break;
+
+  while (count-- > 0) {
+    instr = &fetch();
+    switch (instr->kind) { CHIP8_INSTRUCTIONS(CHIP8_CASE) }
+  }
+#undef CHIP8_CASE
+#endif
+}
+#if defined(__GNUC__)
+#pragma GCC diagnostic pop
+#endif
+
+void Chip8::decode(uint16_t addr, Instruction *instr) const {
+  mem->read(addr, instr->raw, 2);
+  instr->x = instr->raw[0] & 0xF;
+  instr->y = instr->raw[1] >> 4;
+  instr->n = instr->raw[1] & 0xF;
+  instr->kk = instr->raw[1];
+  instr->nnn = ((instr->raw[0] & 0xF) << 8) | instr->raw[1];
+  instr->kind = decodeKind(instr->raw[0], instr->raw[1], quirks());
+  if (instr->kind == K_LDIL) {
+    instr->nnn = mem->fetch16(addr + 2);
+  }
+  instr->handler = opcodes[instr->raw[0] >> 4];
+}
+
+void Chip8::invalidate(uint16_t addr, size_t len) {
+  forget(addr, len);
+  if (jit) {
+    jit->invalidate(addr, len);
+  }
+}
+
+void Chip8::forget(uint16_t addr, size_t len) {
+  // instructions starting up to 3 bytes before addr also read it, XO-CHIP's
+  // F000 nnnn is 4 bytes long
+  for (size_t i = 0; i < len + 3; i++) {
+    decoded[(addr + decoded.size() - 3 + i) % decoded.size()] = Instruction{};
+  }
+  decodedGeneration = mem->generation();
+}
+
+void Chip8::forgetAll() {
+  for (size_t p = 0; p < decodedPages.size(); p++) {
+    if (decodedPages[p]) {
+      const size_t start = p << MEM_PAGE_SHIFT;
+      const size_t end = std::min(start + MEM_PAGE_SIZE, decoded.size());
+      std::fill(decoded.begin() + start, decoded.begin() + end, Instruction{});
+      decodedPages[p] = false;
     }
   }
+  decodedGeneration = mem->generation();
+  if (jit) {
+    jit->flush();
+  }
+}
 
-  startY = winSizeY;
-  DrawText("Stack: ", winSizeX / 2, startY, size, color);
-  startY += size;
-  startX = winSizeX / 2;
-  for (int i = 0; i < 0x10; i++) {
-    sprintf(buf, "%04x\t", Stack[i]);
-    DrawText(buf, startX, startY, size, color);
-    startX += hSize;
-    if ((i + 1) % 4 == 0) {
-      startY += size;
-      startX = winSizeX / 2;
+bool Chip8::pixel(size_t x, size_t y) const {
+  return FrameBuffer.pixel(x, y);
+}
+
+uint8_t Chip8::color(size_t x, size_t y) const {
+  return FrameBuffer.color(x, y);
+}
+
+static_assert(sizeof(Snapshot::Stack) == sizeof(Chip8::Stack),
+              "snapshot stack does not match the CPU");
+
+Snapshot Chip8::snapshot() {
+  Snapshot s;
+  std::copy(V, V + 0x10, s.V);
+  s.I = I;
+  s.DT = DT;
+  s.ST = ST;
+  s.SEED = SEED;
+  s.PC = PC;
+  s.SP = SP;
+  std::copy(IR, IR + 2, s.IR);
+  std::copy(Stack, Stack + STACK_SIZE, s.Stack);
+  std::copy(KeyPad, KeyPad + 0x10, s.KeyPad);
+  s.InstrCount = InstrCount;
+  s.InputReg = inputReg;
+  s.Paused = Paused;
+  s.ErrStackUnderflow = errStackUnderflow;
+  s.ErrStackOverflow = errStackOverflow;
+  s.Prof = prof;
+  s.WaitTick = WaitTick;
+  std::copy(RPL, RPL + 0x10, s.RPL);
+  std::copy(Pattern, Pattern + 0x10, s.Pattern);
+  s.Pitch = Pitch;
+  s.FrameBuffer = FrameBuffer;
+  s.MemorySize = mem->size();
+  s.Pages.resize(mem->pageCount());
+  for (size_t i = 0; i < s.Pages.size(); i++) {
+    s.Pages[i] = mem->page(i);
+  }
+  return s;
+}
+
+bool Chip8::restore(const Snapshot &s) {
+  if (s.Prof != prof || s.MemorySize != mem->size() ||
+      s.Pages.size() != mem->pageCount()) {
+    return false;
+  }
+  std::copy(s.V, s.V + 0x10, V);
+  I = s.I;
+  DT = s.DT;
+  ST = s.ST;
+  SEED = s.SEED;
+  PC = s.PC;
+  SP = s.SP;
+  std::copy(s.IR, s.IR + 2, IR);
+  std::copy(s.Stack, s.Stack + STACK_SIZE, Stack);
+  std::copy(s.KeyPad, s.KeyPad + 0x10, KeyPad);
+  InstrCount = s.InstrCount;
+  inputReg = s.InputReg;
+  Paused = s.Paused;
+  errStackUnderflow = s.ErrStackUnderflow;
+  errStackOverflow = s.ErrStackOverflow;
+  WaitTick = s.WaitTick;
+  std::copy(s.RPL, s.RPL + 0x10, RPL);
+  std::copy(s.Pattern, s.Pattern + 0x10, Pattern);
+  Pitch = s.Pitch;
+  // only rows that differ need redrawing
+  FrameBuffer.copyFrom(s.FrameBuffer);
+  for (size_t i = 0; i < s.Pages.size(); i++) {
+    if (mem->loadPage(i, s.Pages[i])) {
+      forget(i * MEM_PAGE_SIZE, MEM_PAGE_SIZE);
+      if (jit) {
+        jit->reload(i * MEM_PAGE_SIZE, MEM_PAGE_SIZE);
+      }
     }
   }
+  return true;
+}
+
+void Chip8::fixedUpdate() {
+  WaitTick = false;
+  if (ST != 0) {
+    ST--;
+  }
+  if (DT != 0) {
+    DT--;
+  }
+}
 
-  startX = winSizeX / 2;
-  if (errStackUnderflow) {
-    DrawText("Stack Underflow", startX, startY, size, RED);
-  }
-  startY += size;
-  if (errStackOverflow) {
-    DrawText("Stack Overflow", startX, startY, size, RED);
-  }
-
-  const int mem_render_size = 0x3D;
-  startY = 0;
-  startX = winSizeX;
-  auto center = mem_start_render + (mem_render_size / 2);
-  auto diff = PC - center;
-  if (diff < 0) {
-    diff = -diff;
-  }
-  if (diff > mem_render_size / 2) {
-    mem_start_render = PC - (mem_render_size / 2);
-  }
-  hSize = 240;
-  for (size_t i = 0; i < mem_render_size; i += 2) {
-    uint8_t ir[2] = {mem->get(i + mem_start_render),
-                     mem->get(i + 1 + mem_start_render)};
-    uint16_t irL = (ir[0] << 8) | ir[1];
-    sprintf(buf, "mem[%#04x:%#04x]=%04x\n", (uint8_t)i + mem_start_render,
-            (uint8_t)i + 1 + mem_start_render, irL);
-    auto c = color;
-    if (i + mem_start_render == PC) {
-      c = DARKGREEN;
+void Chip8::seed(uint16_t s) { SEED = (s == 0) ? DEFAULT_SEED : s; }
+
+void Chip8::sendInput(uint8_t key, bool value) {
+  KeyPad[key & 0xF] = value;
+  if (value) {
+    if (Paused) {
+      V[inputReg] = key & 0xF;
+      inputReg = 0;
     }
-    DrawText(buf, startX, startY, size, c);
-    DrawText(dissasemble(ir).c_str(), startX + hSize, startY, size, c);
-    startY += size;
+    Paused = false;
   }
 }
 
@@ -624,165 +1109,6 @@ void Chip8::printreg() {
   printf("\n\n");
 }
 
-std::string Chip8::dissasemble(uint8_t *instr) {
-  char buf[128];
-  uint8_t op = instr[0] >> 4;
-  uint16_t addr3b = instr[1];
-  addr3b |= (instr[0] & 0xF) << 8;
-  uint8_t instr0_low = instr[0] & 0xF;
-  uint8_t instr1_high = instr[1] >> 4;
-  uint8_t instr1_low = instr[1] & 0xF;
-
-  switch (op) {
-  case 0x0: {
-    if (instr[1] == 0xE0) {
-      return "CLS";
-    } else if (instr[1] == 0xEE) {
-      return "RET";
-    }
-    break;
-  }
-  case 0x1: {
-    sprintf(buf, "JP %08x", addr3b);
-    return buf;
-  }
-  case 0x2: {
-    sprintf(buf, "CALL %08x", addr3b);
-    return buf;
-  }
-  case 0x3: {
-    sprintf(buf, "SE V%02X, %04x", instr0_low, instr[1]);
-    return buf;
-  }
-  case 0x4: {
-    sprintf(buf, "SNE V%02x, %04x", instr0_low, instr[1]);
-    return buf;
-  }
-  case 0x5: {
-    sprintf(buf, "SE V%02x, V%02x", instr0_low, instr1_high);
-    return buf;
-  }
-  case 0x6: {
-    sprintf(buf, "LD V%02x, %04x", instr0_low, instr[1]);
-    return buf;
-  }
-  case 0x7: {
-    sprintf(buf, "ADD V%02x, %04x", instr0_low, instr[1]);
-    return buf;
-  }
-  case 0x8: {
-    switch (instr1_low) {
-    case 0x0: {
-      sprintf(buf, "LD V%02x, V%02x", instr0_low, instr1_high);
-      return buf;
-    }
-    case 0x1: {
-      sprintf(buf, "OR V%02x, V%02x", instr0_low, instr1_high);
-      return buf;
-    }
-    case 0x2: {
-      sprintf(buf, "AND V%02x, V%02x", instr0_low, instr1_high);
-      return buf;
-    }
-    case 0x3: {
-      sprintf(buf, "XOR V%02x, V%02x", instr0_low, instr1_high);
-      return buf;
-    }
-    case 0x4: {
-      sprintf(buf, "ADD V%02x, V%02x", instr0_low, instr1_high);
-      return buf;
-    }
-    case 0x5: {
-      sprintf(buf, "SUB V%02x, V%02x", instr0_low, instr1_high);
-      return buf;
-    }
-    case 0x6: {
-      sprintf(buf, "SHR V%02x", instr0_low);
-      return buf;
-    }
-    case 0x7: {
-      sprintf(buf, "SUBN V%02x, V%02x", instr0_low, instr1_high);
-      return buf;
-    }
-    case 0xE: {
-      sprintf(buf, "SHL V%02x", instr0_low);
-      return buf;
-    }
-    }
-  }
-  case 0x9: {
-    sprintf(buf, "SNE V%02x, V%02x", instr0_low, instr1_high);
-    return buf;
-  }
-  case 0xA: {
-    sprintf(buf, "LD I, %08x", addr3b);
-    return buf;
-  }
-  case 0xB: {
-    sprintf(buf, "JP V%02x, %04x", instr0_low, instr[1]);
-    return buf;
-  }
-  case 0xC: {
-    sprintf(buf, "RND V%02x, %04x", instr0_low, instr[1]);
-    return buf;
-  }
-  case 0xD: {
-    sprintf(buf, "DRW (V%02x V%02x), %02x", instr0_low, instr1_high,
-            instr1_low);
-    return buf;
-  }
-  case 0xE: {
-    switch (instr[1]) {
-    case 0x9E: {
-      sprintf(buf, "SKPKP V%02x", instr0_low);
-      return buf;
-    }
-    case 0xA1: {
-      sprintf(buf, "SKPNKP V%02x", instr0_low);
-      return buf;
-    }
-    }
-  case 0xF: {
-    switch (instr[1]) {
-    case 0x07: {
-      sprintf(buf, "LD V%02x, DT", instr0_low);
-      return buf;
-    }
-    case 0x0A: {
-      sprintf(buf, "LD V%02x, K", instr0_low);
-      return buf;
-    }
-    case 0x15: {
-      sprintf(buf, "LD DT, V%02x", instr0_low);
-      return buf;
-    }
-    case 0x18: {
-      sprintf(buf, "LD ST, V%02x", instr0_low);
-      return buf;
-    }
-    case 0x1E: {
-      sprintf(buf, "LD I, V%02x", instr0_low);
-      return buf;
-    }
-    case 0x29: {
-      sprintf(buf, "LD F, V%02x", instr0_low);
-      return buf;
-    }
-    case 0x33: {
-      sprintf(buf, "LD B, V%02x", instr0_low);
-      return buf;
-    }
-    case 0x55: {
-      sprintf(buf, "LD [I], V%02x", instr0_low);
-      return buf;
-    }
-    case 0x65: {
-      sprintf(buf, "LD V%02x, [I]", instr0_low);
-      return buf;
-    }
-    }
-  }
-  }
-  }
-  return "";
-}
\ No newline at end of file
+std::string Chip8::dissasemble(const uint8_t *instr) const {
+  return disassemble(instr[0], instr[1], quirks());
+}
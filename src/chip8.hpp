@@ -1,51 +1,157 @@
 #ifndef CHIP8_HPP
 #define CHIP8_HPP
 
+#include "isa.hpp"
 #include "memory.hpp"
+#include "profiler.hpp"
+#include "screen.hpp"
+#include "snapshot.hpp"
 #include <cstdint>
-#include <raylib.h>
+#include <memory>
+#include <string>
+#include <vector>
 
 const size_t STACK_SIZE = 0x10;
-const size_t WIN_SIZE_X = 128;
-const size_t WIN_SIZE_Y = 64;
-const size_t WIN_SIZE = (WIN_SIZE_X * WIN_SIZE_Y);
-const uint8_t CHAR_SPRITE_SIZE = 10; // bytes
+const uint8_t CHAR_SPRITE_SIZE = 5; // bytes
+// SCHIP's 8x10 digits follow the small font
+const uint16_t BIG_FONT_START = 0x10 * CHAR_SPRITE_SIZE;
+const uint8_t BIG_CHAR_SPRITE_SIZE = 10; // bytes
+// DEFAULT_SEED starts RND, and restarts it if the xorshift ever reaches 0
+const uint16_t DEFAULT_SEED = 0xACE1;
+const uint8_t DEFAULT_PITCH = 64; // XO-CHIP's 4000 Hz
+
+// Engine selects how step dispatches instructions
+enum class Engine {
+  Table,    // per nibble function pointer table
+  Threaded, // flattened computed goto, switch where unsupported
+  Jit,      // x86-64 basic block recompiler, interprets the rest
+};
+const size_t ENGINE_COUNT = 3;
+
+class Jit;
 
 class Chip8 {
 public:
-  Chip8(Memory *m);
+  // the profile is fixed for the life of the CPU, memory should be at least
+  // as large as the profile's MemorySize
+  Chip8(Memory *m, Engine e = Engine::Table, Profile p = Profile::Chip8);
+  ~Chip8();
+  Chip8(Chip8 &&);
+  Chip8 &operator=(Chip8 &&);
+
+  // reset puts the CPU and all of its memory back the way a new Chip8 of the
+  // same engine and profile boots, reusing every allocation
+  void reset();
+  // reset with a ROM loads it at 0x200, false if it does not fit
+  bool reset(const uint8_t *rom, size_t len);
 
   void step(int count);
   void fixedUpdate();
   void sendInput(uint8_t key, bool value);
-  void drawScr(int sizeX, int sizeY);
-  void drawReg(int winSizeX, int winSizeY);
+  // seed restarts RND, the same seed and inputs always replay the same run
+  void seed(uint16_t s);
   void printreg();
-  std::string dissasemble(uint8_t *instr);
+  std::string dissasemble(const uint8_t *instr) const;
+
+  // pixel reads the framebuffer, frontends should not index it directly
+  bool pixel(size_t x, size_t y) const;
+  // color reads every plane of the framebuffer, bit 0 for the first
+  uint8_t color(size_t x, size_t y) const;
+
+  Profile profile() const { return prof; }
+  const Quirks &quirks() const { return quirksOf(prof); }
+
+  // snapshot captures the CPU, screen and memory, memory pages not written
+  // since the previous snapshot are shared with it
+  Snapshot snapshot();
+  // restore puts a snapshot back, only pages that differ are copied, returns
+  // false if it was taken with a different memory size
+  bool restore(const Snapshot &s);
 
   uint8_t V[0x10]; // V general purpose registers addressed V0-VF
   uint16_t I = 0;  // I register
   uint8_t DT = 0;  // Delay Timer register
   uint8_t ST = 0;  // Sound Timer register
 
-  uint16_t SEED = 0;
+  uint16_t SEED = DEFAULT_SEED; // RND state, set through seed
   uint16_t PC = 0; // Program Counter
   uint8_t SP = 0;  // Stack Pointer
   uint8_t IR[2];
   uint16_t Stack[STACK_SIZE]; // Stack allows for 16 levels of nested functions
 
   Memory *mem;
-  bool FrameBuffer[WIN_SIZE];
+  Screen FrameBuffer;
   bool KeyPad[0x10];
 
+  uint64_t InstrCount = 0; // instructions executed since construction
+  // instructions of InstrCount skipped over as laps of an idle loop
+  uint64_t IdleSkipped = 0;
+
   uint8_t inputReg = 0;
   bool Paused = false;
   bool errStackUnderflow = false;
   bool errStackOverflow = false;
+  bool WaitTick = false; // DRW waits for the next timer tick, DisplayWait
+
+  // profiler collects counters while it is set, only in CHIP8_PROFILER builds
+  Profiler *profiler = nullptr;
+
+  uint8_t RPL[0x10];             // SCHIP RPL user flags
+  uint8_t Pattern[0x10];         // XO-CHIP audio pattern buffer
+  uint8_t Pitch = DEFAULT_PITCH; // XO-CHIP audio pitch register
+
+  // invalidate drops cached decodes overlapping [addr, addr + len), handlers
+  // that write memory call it after the write
+  void invalidate(uint16_t addr, size_t len);
+  // idleLap is called after every backward jump, PC is the head of the loop.
+  // It returns true once the CPU came round to the head in exactly the state
+  // it had last time, nothing can change before the next input or timer tick
+  // then and step skips the remaining whole laps.
+  bool idleLap();
+
+  using op = Instruction::op;
+  const op *opcodes; // the profile's handler table, chosen at construction
+
+private:
+  const Instruction &fetch();
+  void decode(uint16_t addr, Instruction *instr) const;
+  // forget drops cached decodes overlapping [addr, addr + len)
+  void forget(uint16_t addr, size_t len);
+  // forgetAll drops every cached decode, touching only pages that have some
+  void forgetAll();
+  void dispatch(int count);
+  void forgetIdle() { idle.Head = NO_LOOP; }
+  void stepTable(int count);
+  template <Profile P> void stepThreaded(int count);
+  void stepJit(int count);
+
+  Engine engine;
+  Profile prof;
+  void (Chip8::*threaded)(int); // stepThreaded for the profile
+  std::unique_ptr<Jit> jit;
+
+  std::vector<Instruction> decoded;  // one entry per memory address
+  std::vector<uint8_t> decodedPages; // page has entries in decoded
 
-  uint16_t mem_start_render = 0;
-  using op = bool (*)(Chip8 *, uint8_t *);
-  op opcodes[0x10];
+  // IdleState is everything instructions can change without ending the
+  // step, two laps of a loop starting from the same IdleState run alike
+  struct IdleState {
+    uint8_t V[0x10];
+    uint16_t I, SEED, Stack[STACK_SIZE];
+    uint8_t DT, ST, SP, Pitch, Planes;
+    uint8_t RPL[0x10], Pattern[0x10];
+    uint32_t Memory; // generation
+  };
+  static constexpr uint32_t NO_LOOP = 0x10000;
+  struct {
+    uint32_t Head = NO_LOOP; // loop the samples are from
+    uint32_t Laps = 0;
+    bool Sampled = false;
+    uint64_t At = 0; // InstrCount of the sample
+    IdleState Sample;
+  } idle;
+  uint64_t idleLength = 0; // instructions in a lap once one was found
+  uint32_t decodedGeneration = 0;
 };
 
 #endif // CHIP8_HPP
\ No newline at end of file
@@ -0,0 +1,174 @@
+#include "cpu_thread.hpp"
+
+#include <algorithm>
+
+void CpuFrame::capture(const Chip8 &cpu) {
+  std::copy(cpu.V, cpu.V + 0x10, V);
+  I = cpu.I;
+  DT = cpu.DT;
+  ST = cpu.ST;
+  SEED = cpu.SEED;
+  PC = cpu.PC;
+  SP = cpu.SP;
+  std::copy(cpu.IR, cpu.IR + 2, IR);
+  std::copy(cpu.Stack, cpu.Stack + STACK_SIZE, Stack);
+  std::copy(cpu.KeyPad, cpu.KeyPad + 0x10, KeyPad);
+  InstrCount = cpu.InstrCount;
+  Paused = cpu.Paused;
+  ErrStackUnderflow = cpu.errStackUnderflow;
+  ErrStackOverflow = cpu.errStackOverflow;
+  FrameBuffer = cpu.FrameBuffer;
+  CodeStart = cpu.PC - CPU_FRAME_CODE / 2;
+  cpu.mem->read(CodeStart, Code, CPU_FRAME_CODE);
+}
+
+void CpuFrame::show(Chip8 &view) const {
+  std::copy(V, V + 0x10, view.V);
+  view.I = I;
+  view.DT = DT;
+  view.ST = ST;
+  view.SEED = SEED;
+  view.PC = PC;
+  view.SP = SP;
+  std::copy(IR, IR + 2, view.IR);
+  std::copy(Stack, Stack + STACK_SIZE, view.Stack);
+  std::copy(KeyPad, KeyPad + 0x10, view.KeyPad);
+  view.InstrCount = InstrCount;
+  view.Paused = Paused;
+  view.errStackUnderflow = ErrStackUnderflow;
+  view.errStackOverflow = ErrStackOverflow;
+  view.FrameBuffer.copyFrom(FrameBuffer);
+  view.mem->write(CodeStart, Code, CPU_FRAME_CODE);
+}
+
+CpuThread::CpuThread(Chip8 &c, Scheduler &s, Recorder *rec, Rewind *rw)
+    : cpu(c), scheduler(s), recorder(rec), rewind(rw) {}
+
+CpuThread::~CpuThread() { stop(); }
+
+void CpuThread::start() {
+  stop();
+  // the thread is not running, so popping here is safe
+  CpuInput stale;
+  while (inputs.pop(&stale)) {
+  }
+  publish();
+  scheduler.onFrame([this](const Chip8 &) {
+    if (!published) {
+      publish();
+      published = true;
+    }
+  });
+  stopping.store(false, std::memory_order_relaxed);
+  worker = std::thread([this] { loop(); });
+}
+
+void CpuThread::stop() {
+  if (!worker.joinable()) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(wakeMutex);
+    stopping.store(true, std::memory_order_release);
+  }
+  wake.notify_one();
+  worker.join();
+  scheduler.onFrame(nullptr);
+  rewinding = false;
+}
+
+bool CpuThread::send(CpuOp op, uint8_t value) {
+  if (!inputs.push({op, value})) {
+    return false;
+  }
+  // taking the lock orders the push before a waiting thread's predicate
+  { std::lock_guard<std::mutex> lock(wakeMutex); }
+  wake.notify_one();
+  return true;
+}
+
+bool CpuThread::idle() const {
+  if (rewinding) {
+    return false;
+  }
+  // a key wait with the timers at zero only ends on input
+  return !running || (cpu.Paused && cpu.DT == 0 && cpu.ST == 0);
+}
+
+void CpuThread::publish() {
+  frames.back().capture(cpu);
+  frames.publish();
+}
+
+void CpuThread::apply(const CpuInput &in) {
+  switch (in.Op) {
+  case CpuOp::KeyDown:
+  case CpuOp::KeyUp:
+    if (recorder) {
+      recorder->sendInput(cpu, in.Value, in.Op == CpuOp::KeyDown);
+    } else {
+      cpu.sendInput(in.Value, in.Op == CpuOp::KeyDown);
+    }
+    break;
+  case CpuOp::Step:
+    if (!running) {
+      scheduler.advance(cpu, 1);
+    }
+    break;
+  case CpuOp::Run:
+    running = in.Value != 0;
+    break;
+  case CpuOp::Turbo:
+    scheduler.setTurbo(in.Value != 0);
+    break;
+  case CpuOp::Rewind:
+    rewinding = in.Value != 0 && rewind != nullptr;
+    rewindOwed = 0;
+    break;
+  }
+}
+
+void CpuThread::loop() {
+  using Clock = std::chrono::steady_clock;
+  const double slice = std::chrono::duration<double>(CPU_THREAD_SLICE).count();
+  auto last = Clock::now();
+  while (!stopping.load(std::memory_order_acquire)) {
+    bool changed = false;
+    CpuInput in;
+    while (inputs.pop(&in)) {
+      apply(in);
+      changed = true;
+    }
+
+    const auto now = Clock::now();
+    const double elapsed = std::chrono::duration<double>(now - last).count();
+    last = now;
+    published = false;
+    if (rewinding) {
+      // one frame back per timer tick of host time
+      rewindOwed += elapsed * TIMER_HZ;
+      for (; rewindOwed >= 1; rewindOwed--) {
+        rewind->back(cpu);
+        changed = true;
+      }
+    } else if (running) {
+      // turbo uses up the whole slice, whatever time has passed
+      scheduler.run(cpu, scheduler.turboOn() ? slice : elapsed);
+    }
+    // a running program shows its frames from onFrame, anything else shows
+    // what the inputs did
+    if (changed && !published && (!running || rewinding || idle())) {
+      publish();
+    }
+    if (idle()) {
+      std::unique_lock<std::mutex> lock(wakeMutex);
+      wake.wait_for(lock, CPU_THREAD_IDLE_WAIT, [this] {
+        return !inputs.empty() || stopping.load(std::memory_order_relaxed);
+      });
+      // time spent idle is not owed to the program
+      last = Clock::now();
+      continue;
+    }
+    std::this_thread::sleep_until(now + CPU_THREAD_SLICE);
+  }
+}
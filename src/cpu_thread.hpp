@@ -0,0 +1,131 @@
+#ifndef CPU_THREAD_HPP
+#define CPU_THREAD_HPP
+
+#include "chip8.hpp"
+#include "replay.hpp"
+#include "rewind.hpp"
+#include "scheduler.hpp"
+#include "spsc_queue.hpp"
+#include "triple_buffer.hpp"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+
+// how long the CPU thread sleeps between looking at its input queue, bounds
+// the input latency the thread adds
+const std::chrono::microseconds CPU_THREAD_SLICE(1000);
+// how long an idle CPU thread, stopped or waiting for a key with the timers
+// run down, sleeps before looking again when no input wakes it
+const std::chrono::milliseconds CPU_THREAD_IDLE_WAIT(100);
+const size_t CPU_INPUT_QUEUE = 256;
+
+enum class CpuOp : uint8_t {
+  KeyDown, // Value is the key
+  KeyUp,
+  Step,   // run a single instruction
+  Run,    // Value 1 runs freely, 0 stops
+  Turbo,  // Value 1 turns turbo on
+  Rewind, // Value 1 while rewind is held
+};
+
+struct CpuInput {
+  CpuOp Op;
+  uint8_t Value;
+};
+
+// bytes of code around PC a CpuFrame carries, enough for the frontend's
+// listing wherever it scrolled to
+const size_t CPU_FRAME_CODE = 0x80;
+
+// CpuFrame is what the renderer sees of the machine: the registers, the
+// screen and the code around PC. It has a fixed size, so publishing one is a
+// copy into a slot allocated up front.
+struct CpuFrame {
+  uint8_t V[0x10];
+  uint16_t I = 0;
+  uint8_t DT = 0;
+  uint8_t ST = 0;
+  uint16_t SEED = 0;
+  uint16_t PC = 0;
+  uint8_t SP = 0;
+  uint8_t IR[2];
+  uint16_t Stack[STACK_SIZE];
+  bool KeyPad[0x10];
+  uint64_t InstrCount = 0;
+  bool Paused = false;
+  bool ErrStackUnderflow = false;
+  bool ErrStackOverflow = false;
+  Screen FrameBuffer;
+  uint16_t CodeStart = 0; // address of Code[0], CPU_FRAME_CODE / 2 before PC
+  uint8_t Code[CPU_FRAME_CODE];
+
+  void capture(const Chip8 &cpu);
+  // show puts the frame into view, a Chip8 that is only drawn: rows that
+  // differ are marked damaged and the code is written to its memory
+  void show(Chip8 &view) const;
+};
+
+// CpuThread runs a Chip8 through its Scheduler on a thread of its own, so a
+// slow frame on the UI side never holds back emulation. Inputs go in through
+// a lock-free queue and the machine state comes back out as CpuFrames in a
+// triple buffer. While the program runs a frame is published on the first
+// timer tick of a slice, so the renderer never sees a screen the program is
+// halfway through drawing. Stopped, rewinding or waiting on input, what the
+// inputs changed is published right away.
+//
+// While the thread runs it owns the cpu, scheduler, recorder and rewind, the
+// caller may only touch them again after stop.
+class CpuThread {
+public:
+  // keys go through recorder and rewinding through rewind when they are set
+  CpuThread(Chip8 &cpu, Scheduler &scheduler, Recorder *recorder = nullptr,
+            Rewind *rewind = nullptr);
+  ~CpuThread();
+  CpuThread(const CpuThread &) = delete;
+  CpuThread &operator=(const CpuThread &) = delete;
+
+  // start publishes the current state and starts the thread
+  void start();
+  // stop waits for the thread to exit, inputs not yet taken are dropped
+  void stop();
+
+  // send queues an input and wakes the thread if it is idle, returns false
+  // when the queue is full
+  bool send(CpuOp op, uint8_t value = 0);
+
+  // update picks up the newest published state for frame, returns false
+  // when nothing changed since the last call. Only the renderer calls these
+  bool update() { return frames.update(); }
+  const CpuFrame &frame() const { return frames.front(); }
+
+private:
+  void loop();
+  void apply(const CpuInput &in);
+  void publish();
+  // idle is true when nothing can happen before the next input
+  bool idle() const;
+
+  Chip8 &cpu;
+  Scheduler &scheduler;
+  Recorder *recorder;
+  Rewind *rewind;
+
+  SpscQueue<CpuInput, CPU_INPUT_QUEUE> inputs;
+  TripleBuffer<CpuFrame> frames;
+  std::thread worker;
+  std::atomic<bool> stopping{false};
+  // an idle thread waits on wake, send and stop notify it
+  std::mutex wakeMutex;
+  std::condition_variable wake;
+
+  // owned by the thread while it runs
+  bool running = false;
+  bool rewinding = false;
+  double rewindOwed = 0; // rewind steps owed, one per timer tick
+  bool published = false; // in the current slice
+};
+
+#endif // CPU_THREAD_HPP
@@ -0,0 +1,84 @@
+#include "analyser.hpp"
+#include "rom.hpp"
+#include "rom_index.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+static void usage(const char *name) {
+  fprintf(stderr,
+          "usage: %s [-p profile] rom [listing]\n"
+          "\n"
+          "writes a listing of rom, rom.lst by default, the listing is left\n"
+          "alone if it is already for this rom and profile. Without -p the\n"
+          "profile is detected from the rom, - prints to stdout.\n"
+          "profiles are: chip8 cosmac schip xochip\n",
+          name);
+}
+
+int main(int argc, char **argv) {
+  bool detect = true;
+  Profile profile = Profile::Chip8;
+  const char *romPath = nullptr;
+  std::string listing;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+      if (!parseProfile(argv[++i], &profile)) {
+        usage(argv[0]);
+        return 2;
+      }
+      detect = false;
+    } else if (romPath == nullptr) {
+      romPath = argv[i];
+    } else if (listing.empty()) {
+      listing = argv[i];
+    } else {
+      usage(argv[0]);
+      return 2;
+    }
+  }
+  if (romPath == nullptr) {
+    usage(argv[0]);
+    return 2;
+  }
+  if (listing.empty()) {
+    listing = std::string(romPath) + ".lst";
+  }
+
+  RomFile rom(romPath);
+  if (!rom.ok()) {
+    fprintf(stderr, "cannot read rom %s: %s\n", romPath, rom.error().c_str());
+    return 1;
+  }
+  if (detect) {
+    profile = detectProfile(rom.data(), rom.size());
+  }
+  const Quirks &q = quirksOf(profile);
+
+  if (listing != "-") {
+    std::ifstream cached(listing);
+    std::string header;
+    if (std::getline(cached, header) &&
+        header == listingHeader(rom.data(), rom.size(), q)) {
+      fprintf(stderr, "%s is up to date\n", listing.c_str());
+      return 0;
+    }
+  }
+
+  const Analysis a = analyseRom(rom.data(), rom.size(), q);
+  if (listing == "-") {
+    writeListing(std::cout, a, rom.data(), q);
+    return 0;
+  }
+  std::ofstream out(listing);
+  writeListing(out, a, rom.data(), q);
+  if (!out) {
+    fprintf(stderr, "cannot write listing %s\n", listing.c_str());
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,178 @@
+#include "farm.hpp"
+#include "audio.hpp"
+#include "machine.hpp"
+#include "memory.hpp"
+#include "rom.hpp"
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <sstream>
+
+std::vector<FarmJob> readManifest(std::istream &in) {
+  std::vector<FarmJob> jobs;
+  std::string line;
+  while (std::getline(in, line)) {
+    std::istringstream fields(line);
+    FarmJob job;
+    if (!(fields >> job.Rom) || job.Rom[0] == '#') {
+      continue;
+    }
+    std::string inputs;
+    if (fields >> inputs && inputs != "-") {
+      job.Inputs = inputs;
+    }
+    fields >> job.Instructions;
+    jobs.push_back(job);
+  }
+  return jobs;
+}
+
+bool readInputs(const std::string &filename, std::vector<InputEvent> *events) {
+  std::ifstream in(filename);
+  if (!in) {
+    return false;
+  }
+  std::string line;
+  while (std::getline(in, line)) {
+    std::istringstream fields(line);
+    uint64_t at;
+    unsigned key;
+    std::string state;
+    if (!(fields >> at)) {
+      continue;
+    }
+    if (!(fields >> std::hex >> key >> state)) {
+      return false;
+    }
+    events->push_back(InputEvent{at, uint8_t(key & 0xF), state == "down"});
+  }
+  return true;
+}
+
+// outputBase is where files about job go in dir, named after its ROM
+static std::string outputBase(const FarmJob &job, const std::string &dir) {
+  return dir + "/" + job.Rom.substr(job.Rom.find_last_of('/') + 1);
+}
+
+// writeProfile saves what profiler counted for job into dir
+static bool writeProfile(const Profiler &profiler, const FarmJob &job,
+                         const std::string &dir) {
+  const std::string base = outputBase(job, dir);
+  std::ofstream json(base + ".json");
+  std::ofstream folded(base + ".folded");
+  return json && folded && profiler.writeJson(json) &&
+         profiler.writeFolded(folded);
+}
+
+FarmResult runJob(const FarmJob &job, Engine engine, Profile profile,
+                  const std::string &profilerDir,
+                  const std::string &audioDir) {
+  FarmResult result;
+  result.Job = job;
+  const auto start = std::chrono::steady_clock::now();
+
+  std::vector<InputEvent> events;
+  if (!job.Inputs.empty() && !readInputs(job.Inputs, &events)) {
+    result.Error = "cannot read inputs " + job.Inputs;
+    return result;
+  }
+
+  // every worker reuses its machines from one job to the next
+  static thread_local MachinePool machines;
+  Machine &machine = *machines.get(engine, profile);
+  Memory &mem = machine.Mem;
+  Chip8 &cpu = machine.Cpu;
+  std::unique_ptr<Profiler> profiler;
+  if (PROFILER_ENABLED && !profilerDir.empty()) {
+    profiler.reset(new Profiler(mem.size()));
+  }
+  cpu.profiler = profiler.get();
+  std::string err;
+  if (loadRom(&mem, ROM_START, job.Rom, &err) == 0) {
+    result.Error = "cannot load rom " + job.Rom + ": " + err;
+    return result;
+  }
+  // audio follows InstrCount, time stands still while waiting for a key
+  std::unique_ptr<WavSink> wav;
+  std::unique_ptr<Audio> audio;
+  if (!audioDir.empty()) {
+    wav.reset(new WavSink(outputBase(job, audioDir) + ".wav"));
+    audio.reset(new Audio(wav.get()));
+  }
+  auto follow = [&] {
+    if (audio) {
+      audio->follow(cpu, cpu.InstrCount, FARM_IPS);
+    }
+  };
+  follow();
+
+  size_t next = 0;
+  uint64_t nextTick = FARM_FRAME_INSTRUCTIONS;
+  while (cpu.InstrCount < job.Instructions) {
+    while (next < events.size() && events[next].At <= cpu.InstrCount) {
+      cpu.sendInput(events[next].Key, events[next].Down);
+      next++;
+    }
+    if (cpu.Paused) {
+      if (next == events.size()) {
+        break;
+      }
+      // waiting on a key, skip ahead to the next event
+      cpu.sendInput(events[next].Key, events[next].Down);
+      next++;
+      continue;
+    }
+    uint64_t stop = std::min(nextTick, job.Instructions);
+    if (next < events.size()) {
+      stop = std::min(stop, events[next].At);
+    }
+    cpu.step(stop - cpu.InstrCount);
+    follow();
+    if (cpu.WaitTick) {
+      // DRW waits for the display, the frame ends early
+      cpu.fixedUpdate();
+      follow();
+      nextTick = cpu.InstrCount + FARM_FRAME_INSTRUCTIONS;
+    } else if (cpu.InstrCount >= nextTick) {
+      cpu.fixedUpdate();
+      follow();
+      nextTick += FARM_FRAME_INSTRUCTIONS;
+    }
+  }
+
+  if (profiler && !writeProfile(*profiler, job, profilerDir)) {
+    result.Error = "cannot write profile to " + profilerDir;
+    return result;
+  }
+  if (wav && !wav->close()) {
+    result.Error = "cannot write audio to " + audioDir;
+    return result;
+  }
+  result.Ok = true;
+  result.Instructions = cpu.InstrCount;
+  result.IdleSkipped = cpu.IdleSkipped;
+  result.FrameHash = cpu.FrameBuffer.hash();
+  result.Seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+  return result;
+}
+
+std::vector<FarmResult> runFarm(const std::vector<FarmJob> &jobs,
+                                size_t threads, Engine engine,
+                                Profile profile,
+                                const std::string &profilerDir,
+                                const std::string &audioDir) {
+  std::vector<FarmResult> results(jobs.size());
+  ThreadPool pool(threads);
+  for (size_t i = 0; i < jobs.size(); i++) {
+    pool.submit([&, i] {
+      results[i] = runJob(jobs[i], engine, profile, profilerDir, audioDir);
+    });
+  }
+  pool.wait();
+  return results;
+}
@@ -0,0 +1,63 @@
+#ifndef FARM_HPP
+#define FARM_HPP
+
+#include "chip8.hpp"
+#include "scheduler.hpp"
+#include <cstdint>
+#include <istream>
+#include <string>
+#include <vector>
+
+// instructions between timer ticks, the frontend runs this many per frame
+const uint64_t FARM_FRAME_INSTRUCTIONS = 1000;
+const uint64_t FARM_DEFAULT_INSTRUCTIONS = 10'000'000;
+// the clock farm audio is rendered at, a frame of instructions per tick
+const uint64_t FARM_IPS = FARM_FRAME_INSTRUCTIONS * TIMER_HZ;
+
+// InputEvent presses or releases a key once the CPU executed At instructions
+struct InputEvent {
+  uint64_t At;
+  uint8_t Key;
+  bool Down;
+};
+
+// FarmJob is one line of a farm manifest:
+//   rom [inputs|-] [instructions]
+// where inputs is a trace file of "instructions key down|up" lines
+struct FarmJob {
+  std::string Rom;
+  std::string Inputs;
+  uint64_t Instructions = FARM_DEFAULT_INSTRUCTIONS;
+};
+
+struct FarmResult {
+  FarmJob Job;
+  bool Ok = false;
+  std::string Error;
+  uint64_t Instructions = 0;
+  uint64_t IdleSkipped = 0; // of Instructions, fast-forwarded through idling
+  uint64_t FrameHash = 0;
+  double Seconds = 0;
+};
+
+// readManifest parses jobs, blank lines and lines starting with # are skipped
+std::vector<FarmJob> readManifest(std::istream &in);
+// readInputs parses an input trace, events must be in instruction order
+bool readInputs(const std::string &filename, std::vector<InputEvent> *events);
+
+// runJob runs one ROM headless until its instruction budget is spent or it
+// waits for a key no event will press. With profilerDir set, in builds with
+// the profiler, the ROM's counters are written there as <rom>.json and
+// <rom>.folded. With audioDir set its sound is written there as <rom>.wav.
+FarmResult runJob(const FarmJob &job, Engine engine,
+                  Profile profile = Profile::Chip8,
+                  const std::string &profilerDir = "",
+                  const std::string &audioDir = "");
+// runFarm spreads the jobs over threads workers, results keep job order
+std::vector<FarmResult> runFarm(const std::vector<FarmJob> &jobs,
+                                size_t threads, Engine engine,
+                                Profile profile = Profile::Chip8,
+                                const std::string &profilerDir = "",
+                                const std::string &audioDir = "");
+
+#endif // FARM_HPP
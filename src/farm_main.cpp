@@ -0,0 +1,108 @@
+#include "farm.hpp"
+
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <thread>
+
+static void usage(const char *name) {
+  fprintf(stderr,
+          "usage: %s [-j threads] [-e table|threaded|jit] [-p profile] "
+          "[-P dir] [-a dir] manifest\n"
+          "\n"
+          "-P writes per rom profiler counters into dir, it needs a build\n"
+          "configured with CHIP8_PROFILER\n"
+          "-a writes what every rom played into dir as rom.wav\n"
+          "manifest lines are: rom [inputs|-] [instructions]\n"
+          "inputs lines are:   instructions key down|up\n"
+          "profiles are:       chip8 cosmac schip xochip\n",
+          name);
+}
+
+int main(int argc, char **argv) {
+  size_t threads = std::thread::hardware_concurrency();
+  Engine engine = Engine::Table;
+  Profile profile = Profile::Chip8;
+  const char *manifest = nullptr;
+  std::string profilerDir;
+  std::string audioDir;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+      threads = strtoul(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "-e") == 0 && i + 1 < argc) {
+      std::string name(argv[++i]);
+      if (name == "table") {
+        engine = Engine::Table;
+      } else if (name == "threaded") {
+        engine = Engine::Threaded;
+      } else if (name == "jit") {
+        engine = Engine::Jit;
+      } else {
+        usage(argv[0]);
+        return 2;
+      }
+    } else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+      if (!parseProfile(argv[++i], &profile)) {
+        usage(argv[0]);
+        return 2;
+      }
+    } else if (strcmp(argv[i], "-P") == 0 && i + 1 < argc) {
+      profilerDir = argv[++i];
+      if (!PROFILER_ENABLED) {
+        fprintf(stderr, "-P needs a build configured with CHIP8_PROFILER\n");
+        return 2;
+      }
+    } else if (strcmp(argv[i], "-a") == 0 && i + 1 < argc) {
+      audioDir = argv[++i];
+    } else if (manifest == nullptr) {
+      manifest = argv[i];
+    } else {
+      usage(argv[0]);
+      return 2;
+    }
+  }
+  if (manifest == nullptr) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  std::ifstream in(manifest);
+  if (!in) {
+    fprintf(stderr, "cannot read manifest %s\n", manifest);
+    return 1;
+  }
+  const auto jobs = readManifest(in);
+
+  const auto start = std::chrono::steady_clock::now();
+  const auto results =
+      runFarm(jobs, threads, engine, profile, profilerDir, audioDir);
+  const double seconds =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - start)
+          .count();
+
+  int failed = 0;
+  uint64_t total = 0, skipped = 0;
+  printf("rom\tinputs\tinstructions\tframe_hash\tseconds\n");
+  for (const auto &r : results) {
+    if (!r.Ok) {
+      fprintf(stderr, "%s: %s\n", r.Job.Rom.c_str(), r.Error.c_str());
+      failed++;
+      continue;
+    }
+    total += r.Instructions;
+    skipped += r.IdleSkipped;
+    printf("%s\t%s\t%" PRIu64 "\t%016" PRIx64 "\t%.6f\n", r.Job.Rom.c_str(),
+           r.Job.Inputs.empty() ? "-" : r.Job.Inputs.c_str(), r.Instructions,
+           r.FrameHash, r.Seconds);
+  }
+  fprintf(stderr,
+          "%zu roms, %d failed, %" PRIu64 " instructions (%" PRIu64
+          " skipped idle) in %.3fs\n",
+          results.size(), failed, total, skipped, seconds);
+  return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,144 @@
+#include "frontend.hpp"
+
+#include <cstdint>
+#include <cstdio>
+#include <raylib.h>
+
+// PALETTE colours a pixel by the planes it is lit in
+static const Color PALETTE[4] = {BLANK, DARKGREEN, LIME, GREEN};
+
+void Frontend::drawScr(Chip8 &cpu, int sizeX, int sizeY) {
+  if (!loaded) {
+    Image img = GenImageColor(WIN_SIZE_X, WIN_SIZE_Y, BLANK);
+    screen = LoadTextureFromImage(img);
+    UnloadImage(img);
+    loaded = true;
+    // the texture starts blank, every row needs converting
+    cpu.FrameBuffer.Damage = ALL_ROWS;
+  }
+
+  if (cpu.FrameBuffer.changed()) {
+    const uint64_t damage = cpu.FrameBuffer.takeDamage();
+    for (int j = 0; j < WIN_SIZE_Y; j++) {
+      if ((damage & (uint64_t(1) << j)) == 0) {
+        continue;
+      }
+      for (int i = 0; i < WIN_SIZE_X; i++) {
+        pixels[i + (j * WIN_SIZE_X)] = PALETTE[cpu.color(i, j)];
+      }
+    }
+    UpdateTexture(screen, pixels);
+  }
+
+  // low resolution only uses the top left quarter of the texture
+  Rectangle src = {0, 0, float(cpu.FrameBuffer.width()),
+                   float(cpu.FrameBuffer.height())};
+  Rectangle dst = {0, 0, float(sizeX), float(sizeY)};
+  DrawTexturePro(screen, src, dst, Vector2{0, 0}, 0, WHITE);
+}
+
+void Frontend::close() {
+  if (loaded) {
+    UnloadTexture(screen);
+    loaded = false;
+  }
+}
+
+void Frontend::drawReg(const Chip8 &cpu, int winSizeX, int winSizeY) {
+  const auto color = LIGHTGRAY;
+  const int size = 20;
+  int startY = winSizeY;
+  char buf[512];
+  sprintf(buf, "PC: %04x\tSP: %04x\tIR: %02x%02x", cpu.PC, cpu.SP, cpu.IR[0],
+          cpu.IR[1]);
+  DrawText(buf, 0, startY, size, color);
+  startY += size;
+  sprintf(buf, "I: %04x\tDT: %04x\t ST: %04x\tRND Seed: %04x", cpu.I, cpu.DT,
+          cpu.ST, cpu.SEED);
+  DrawText(buf, 0, startY, size, color);
+  startY += size;
+  int startX = 0;
+  int hSize = 140;
+  for (int i = 0; i < 0x10; i++) {
+    sprintf(buf, "V[%02x]=%02x", i, cpu.V[i]);
+    DrawText(buf, startX, startY, size, color);
+    startX += hSize;
+    if ((i + 1) % 4 == 0) {
+      startY += size;
+      startX = 0;
+    }
+  }
+
+  const auto pressed = DARKGREEN;
+  startX = 0;
+  for (int i = 0; i < 0x10; i++) {
+    sprintf(buf, "K%02x", i);
+    auto c = (cpu.KeyPad[i]) ? pressed : color;
+    DrawText(buf, startX, startY, size, c);
+    startX += hSize;
+    if ((i + 1) % 4 == 0) {
+      startY += size;
+      startX = 0;
+    }
+  }
+
+  startY = winSizeY;
+  DrawText("Stack: ", winSizeX / 2, startY, size, color);
+  startY += size;
+  startX = winSizeX / 2;
+  for (int i = 0; i < 0x10; i++) {
+    sprintf(buf, "%04x\t", cpu.Stack[i]);
+    DrawText(buf, startX, startY, size, color);
+    startX += hSize;
+    if ((i + 1) % 4 == 0) {
+      startY += size;
+      startX = winSizeX / 2;
+    }
+  }
+
+  startX = winSizeX / 2;
+  if (cpu.errStackUnderflow) {
+    DrawText("Stack Underflow", startX, startY, size, RED);
+  }
+  startY += size;
+  if (cpu.errStackOverflow) {
+    DrawText("Stack Overflow", startX, startY, size, RED);
+  }
+
+  const int mem_render_size = 0x3D;
+  startY = 0;
+  startX = winSizeX;
+  auto center = mem_start_render + (mem_render_size / 2);
+  auto diff = cpu.PC - center;
+  if (diff < 0) {
+    diff = -diff;
+  }
+  if (diff > mem_render_size / 2) {
+    mem_start_render = cpu.PC - (mem_render_size / 2);
+  }
+  hSize = 240;
+  if (listing.size() != cpu.mem->size()) {
+    listing.assign(cpu.mem->size(), ListingLine{});
+  }
+  for (size_t i = 0; i < mem_render_size; i += 2) {
+    const size_t addr = (i + mem_start_render) % listing.size();
+    const uint16_t irL = cpu.mem->fetch16(addr);
+    const uint32_t words = (uint32_t(irL) << 16) | cpu.mem->fetch16(addr + 2);
+    ListingLine &line = listing[addr];
+    if (!line.Valid || line.Words != words) {
+      line.Text =
+          disassemble(irL >> 8, irL & 0xFF, cpu.quirks(), words & 0xFFFF);
+      line.Words = words;
+      line.Valid = true;
+    }
+    sprintf(buf, "mem[%#04x:%#04x]=%04x\n", (uint8_t)i + mem_start_render,
+            (uint8_t)i + 1 + mem_start_render, irL);
+    auto c = color;
+    if (i + mem_start_render == cpu.PC) {
+      c = DARKGREEN;
+    }
+    DrawText(buf, startX, startY, size, c);
+    DrawText(line.Text.c_str(), startX + hSize, startY, size, c);
+    startY += size;
+  }
+}
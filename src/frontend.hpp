@@ -0,0 +1,39 @@
+#ifndef FRONTEND_HPP
+#define FRONTEND_HPP
+
+#include "chip8.hpp"
+#include <cstdint>
+#include <raylib.h>
+#include <string>
+#include <vector>
+
+// Frontend renders a Chip8 with raylib, the core itself never touches the
+// window system so it can run headless.
+class Frontend {
+public:
+  // drawScr draws the screen as one texture, only rows the CPU drew to since
+  // the last frame are converted and the texture is only uploaded when
+  // something changed
+  void drawScr(Chip8 &cpu, int sizeX, int sizeY);
+  void drawReg(const Chip8 &cpu, int winSizeX, int winSizeY);
+  // close releases the GPU texture, call before CloseWindow
+  void close();
+
+private:
+  uint16_t mem_start_render = 0;
+
+  // ListingLine caches the disassembly of one address, it is only formatted
+  // again when the words it was made from change
+  struct ListingLine {
+    uint32_t Words = 0;
+    bool Valid = false;
+    std::string Text;
+  };
+  std::vector<ListingLine> listing; // one per memory address
+
+  bool loaded = false;
+  Texture2D screen;
+  Color pixels[WIN_SIZE];
+};
+
+#endif // FRONTEND_HPP
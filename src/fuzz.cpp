@@ -0,0 +1,144 @@
+#include "fuzz.hpp"
+#include "machine.hpp"
+#include "memory.hpp"
+#include "replay.hpp"
+#include "rom.hpp"
+#include "rom_index.hpp"
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+
+FuzzCase decodeFuzzCase(const uint8_t *data, size_t size) {
+  FuzzCase c;
+  if (size < FUZZ_HEADER_SIZE) {
+    return c;
+  }
+  c.Prof = Profile(data[0] & 3);
+  c.Eng = Engine(((data[0] >> 2) & 3) % 3);
+  c.Seed = (data[1] << 8) | data[2];
+  const size_t events =
+      std::min<size_t>(data[3], (size - FUZZ_HEADER_SIZE) / FUZZ_EVENT_SIZE);
+  uint64_t at = 0;
+  const uint8_t *p = data + FUZZ_HEADER_SIZE;
+  for (size_t i = 0; i < events; i++, p += FUZZ_EVENT_SIZE) {
+    at += (p[0] << 8) | p[1];
+    c.Inputs.push_back(
+        InputEvent{at, uint8_t(p[2] & 0xF), (p[2] & 0x10) != 0});
+  }
+  c.Rom = p;
+  c.RomSize = std::min(size_t(data + size - p),
+                       quirksOf(c.Prof).MemorySize - ROM_START);
+  return c;
+}
+
+std::vector<uint8_t> encodeFuzzCase(const FuzzCase &c) {
+  std::vector<uint8_t> out;
+  out.push_back(uint8_t(c.Prof) | uint8_t(c.Eng) << 2);
+  out.push_back(c.Seed >> 8);
+  out.push_back(c.Seed & 0xFF);
+  const size_t events = std::min<size_t>(c.Inputs.size(), 0xFF);
+  out.push_back(events);
+  uint64_t at = 0;
+  for (size_t i = 0; i < events; i++) {
+    const InputEvent &e = c.Inputs[i];
+    const uint16_t delta = std::min<uint64_t>(e.At - at, 0xFFFF);
+    at += delta;
+    out.push_back(delta >> 8);
+    out.push_back(delta & 0xFF);
+    out.push_back((e.Key & 0xF) | (e.Down ? 0x10 : 0));
+  }
+  out.insert(out.end(), c.Rom, c.Rom + c.RomSize);
+  return out;
+}
+
+// memoryHash is romHash over all of memory, for comparing engines
+static uint64_t memoryHash(const Memory &mem) {
+  std::vector<uint8_t> bytes(mem.size());
+  mem.read(0, bytes.data(), bytes.size());
+  return romHash(bytes.data(), bytes.size());
+}
+
+FuzzRun runFuzzCase(const FuzzCase &c, Engine engine, uint64_t budget,
+                    uint8_t *coverage) {
+  static thread_local MachinePool machines;
+  Machine &machine = *machines.get(engine, c.Prof, c.Rom, c.RomSize);
+  Memory &mem = machine.Mem;
+  Chip8 &cpu = machine.Cpu;
+  cpu.seed(c.Seed);
+
+  const size_t table = size_t(c.Prof) * K_COUNT * K_COUNT;
+  Kind last = K_COUNT;
+  size_t next = 0;
+  uint64_t nextTick = FARM_FRAME_INSTRUCTIONS;
+  while (cpu.InstrCount < budget) {
+    while (next < c.Inputs.size() && c.Inputs[next].At <= cpu.InstrCount) {
+      cpu.sendInput(c.Inputs[next].Key, c.Inputs[next].Down);
+      next++;
+    }
+    if (cpu.Paused) {
+      if (next == c.Inputs.size()) {
+        break;
+      }
+      cpu.sendInput(c.Inputs[next].Key, c.Inputs[next].Down);
+      next++;
+      continue;
+    }
+    uint64_t stop = std::min(nextTick, budget);
+    if (next < c.Inputs.size()) {
+      stop = std::min(stop, c.Inputs[next].At);
+    }
+    if (coverage != nullptr) {
+      const uint64_t before = cpu.InstrCount;
+      cpu.step(1);
+      if (cpu.InstrCount != before) {
+        const Kind kind = decodeKind(cpu.IR[0], cpu.IR[1], cpu.quirks());
+        if (last != K_COUNT) {
+          uint8_t &counter = coverage[table + last * K_COUNT + kind];
+          counter += counter != 0xFF;
+        }
+        last = kind;
+      }
+    } else {
+      cpu.step(stop - cpu.InstrCount);
+    }
+    if (cpu.WaitTick) {
+      cpu.fixedUpdate();
+      nextTick = cpu.InstrCount + FARM_FRAME_INSTRUCTIONS;
+    } else if (cpu.InstrCount >= nextTick) {
+      cpu.fixedUpdate();
+      nextTick += FARM_FRAME_INSTRUCTIONS;
+    }
+  }
+
+  FuzzRun run;
+  run.Instructions = cpu.InstrCount;
+  run.StateHash = stateHash(cpu);
+  run.MemoryHash = memoryHash(mem);
+  run.StackError = cpu.errStackUnderflow || cpu.errStackOverflow;
+  return run;
+}
+
+std::string fuzzOne(const uint8_t *data, size_t size, uint64_t budget,
+                    uint8_t *coverage) {
+  const FuzzCase c = decodeFuzzCase(data, size);
+  const FuzzRun want = runFuzzCase(c, Engine::Table, budget, coverage);
+  if (c.Eng == Engine::Table) {
+    return "";
+  }
+  const FuzzRun got = runFuzzCase(c, c.Eng, budget);
+  if (got.Instructions == want.Instructions &&
+      got.StateHash == want.StateHash && got.MemoryHash == want.MemoryHash) {
+    return "";
+  }
+  static const char *ENGINE_NAMES[] = {"table", "threaded", "jit"};
+  char buf[256];
+  snprintf(buf, sizeof(buf),
+           "%s disagrees with table on %s: instructions %" PRIu64
+           " vs %" PRIu64 ", state %016" PRIx64 " vs %016" PRIx64
+           ", memory %016" PRIx64 " vs %016" PRIx64,
+           ENGINE_NAMES[size_t(c.Eng)], quirksOf(c.Prof).Name,
+           got.Instructions, want.Instructions, got.StateHash, want.StateHash,
+           got.MemoryHash, want.MemoryHash);
+  return buf;
+}
@@ -0,0 +1,61 @@
+#ifndef FUZZ_HPP
+#define FUZZ_HPP
+
+#include "chip8.hpp"
+#include "farm.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// instructions a fuzz case may run, CHIP8_FUZZ_INSTRUCTIONS overrides it
+const uint64_t FUZZ_INSTRUCTIONS = 20'000;
+// FUZZ_HEADER_SIZE bytes lead every input: engine and profile, seed, events
+const size_t FUZZ_HEADER_SIZE = 4;
+const size_t FUZZ_EVENT_SIZE = 3;
+// one counter per profile and pair of consecutive instruction kinds
+const size_t FUZZ_COVERAGE_SIZE = PROFILE_COUNT * K_COUNT * K_COUNT;
+
+// FuzzCase is a fuzzer input taken apart. The layout is
+//   byte 0     profile in bits 0-1, engine to check in bits 2-3 (table,
+//              threaded, jit, table)
+//   bytes 1-2  RND seed, big endian
+//   byte 3     number of input events
+//   3 bytes    per event: instructions since the previous one (16 bits, big
+//              endian), then the key in bits 0-3 and down in bit 4
+//   the rest   the ROM, cut to what fits in memory
+// Any string of bytes is a valid case.
+struct FuzzCase {
+  Profile Prof = Profile::Chip8;
+  Engine Eng = Engine::Table;
+  uint16_t Seed = DEFAULT_SEED;
+  std::vector<InputEvent> Inputs;
+  const uint8_t *Rom = nullptr;
+  size_t RomSize = 0;
+};
+
+FuzzCase decodeFuzzCase(const uint8_t *data, size_t size);
+// encodeFuzzCase wraps a ROM into an input, used to seed a corpus
+std::vector<uint8_t> encodeFuzzCase(const FuzzCase &c);
+
+struct FuzzRun {
+  uint64_t Instructions = 0;
+  uint64_t StateHash = 0;
+  uint64_t MemoryHash = 0;
+  bool StackError = false;
+};
+
+// runFuzzCase runs the case headless the way a farm job does, on engine and
+// for at most budget instructions. With coverage set it steps one
+// instruction at a time and bumps coverage[FUZZ_COVERAGE_SIZE] for every pair
+// of consecutive instruction kinds.
+FuzzRun runFuzzCase(const FuzzCase &c, Engine engine, uint64_t budget,
+                    uint8_t *coverage = nullptr);
+
+// fuzzOne runs an input on the table interpreter collecting coverage, then on
+// the engine the input picked, and returns why the two disagree, empty when
+// they match
+std::string fuzzOne(const uint8_t *data, size_t size, uint64_t budget,
+                    uint8_t *coverage);
+
+#endif // FUZZ_HPP
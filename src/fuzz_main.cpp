@@ -0,0 +1,238 @@
+#include "fuzz.hpp"
+#include "rom.hpp"
+#include "rom_index.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+
+static uint64_t budget() {
+  const char *env = getenv("CHIP8_FUZZ_INSTRUCTIONS");
+  return env != nullptr ? strtoull(env, nullptr, 10) : FUZZ_INSTRUCTIONS;
+}
+
+#ifdef CHIP8_LIBFUZZER
+
+// libFuzzer folds these into its own coverage, so a new pair of instruction
+// kinds counts as progress even when it runs code that was already covered
+extern "C" {
+__attribute__((used, section("__libfuzzer_extra_counters"))) uint8_t
+    opcodeCoverage[FUZZ_COVERAGE_SIZE];
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+  static const uint64_t instructions = budget();
+  const std::string err = fuzzOne(data, size, instructions, opcodeCoverage);
+  if (!err.empty()) {
+    fprintf(stderr, "%s\n", err.c_str());
+    abort();
+  }
+  return 0;
+}
+
+#else
+
+// Without libFuzzer the target runs with a small mutator of its own: inputs
+// that reach a new pair of instruction kinds join the corpus, inputs on which
+// the engines disagree are written out as crash files.
+
+static void usage(const char *name) {
+  fprintf(stderr,
+          "usage: %s [-n runs] [-s seed] [-o dir] [-r rom]... [input]...\n"
+          "\n"
+          "without -n every input is run once and checked, with -n the\n"
+          "inputs and roms seed a corpus that is mutated runs times\n"
+          "-o is where crash files go, . by default\n"
+          "CHIP8_FUZZ_INSTRUCTIONS is the instruction budget per run\n",
+          name);
+}
+
+static bool readFile(const std::string &filename, std::vector<uint8_t> *out) {
+  std::ifstream in(filename, std::ios::binary);
+  if (!in) {
+    return false;
+  }
+  out->assign(std::istreambuf_iterator<char>(in),
+              std::istreambuf_iterator<char>());
+  return true;
+}
+
+// mutate changes a few bytes of input, mostly whole instructions of the ROM
+static void mutate(std::vector<uint8_t> *input,
+                   const std::vector<std::vector<uint8_t>> &corpus,
+                   std::mt19937_64 &rng) {
+  auto pick = [&](size_t n) { return size_t(rng() % n); };
+  const size_t changes = 1 + pick(4);
+  for (size_t i = 0; i < changes; i++) {
+    if (input->size() < FUZZ_HEADER_SIZE + 2) {
+      input->resize(FUZZ_HEADER_SIZE + 2);
+    }
+    const size_t rom = FUZZ_HEADER_SIZE;
+    const size_t at = rom + (pick(input->size() - rom) & ~size_t(1));
+    switch (pick(7)) {
+    case 0: // flip a bit anywhere, header included
+      (*input)[pick(input->size())] ^= 1 << pick(8);
+      break;
+    case 1: // random byte
+      (*input)[at] = rng();
+      break;
+    case 2: // random instruction, every opcode group equally likely
+      (*input)[at] = (pick(0x10) << 4) | pick(0x10);
+      if (at + 1 < input->size()) {
+        (*input)[at + 1] = rng();
+      }
+      break;
+    case 3: { // insert an instruction
+      const uint8_t instr[2] = {uint8_t(rng()), uint8_t(rng())};
+      input->insert(input->begin() + at, instr, instr + 2);
+      break;
+    }
+    case 4: // drop an instruction
+      input->erase(input->begin() + at,
+                   input->begin() + std::min(at + 2, input->size()));
+      break;
+    case 5: { // splice in part of another input's ROM
+      const std::vector<uint8_t> &other = corpus[pick(corpus.size())];
+      if (other.size() > rom) {
+        const size_t from = rom + pick(other.size() - rom);
+        const size_t len = 1 + pick(std::min<size_t>(other.size() - from, 64));
+        input->insert(input->begin() + at, other.begin() + from,
+                      other.begin() + from + len);
+      }
+      break;
+    }
+    case 6: // another profile or engine
+      (*input)[0] = rng();
+      break;
+    }
+  }
+}
+
+static std::string crashName(const std::string &dir,
+                             const std::vector<uint8_t> &input) {
+  char name[32];
+  snprintf(name, sizeof(name), "/crash-%016" PRIx64,
+           romHash(input.data(), input.size()));
+  return dir + name;
+}
+
+int main(int argc, char **argv) {
+  uint64_t runs = 0;
+  uint64_t seed = 1;
+  std::string dir = ".";
+  std::vector<std::vector<uint8_t>> corpus;
+  std::vector<std::string> inputs;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+      runs = strtoull(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+      seed = strtoull(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+      dir = argv[++i];
+    } else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+      RomFile rom(argv[++i]);
+      if (!rom.ok()) {
+        fprintf(stderr, "cannot read rom %s: %s\n", argv[i],
+                rom.error().c_str());
+        return 2;
+      }
+      // one seed per profile, each checked against the threaded engine
+      FuzzCase c;
+      c.Eng = Engine::Threaded;
+      c.Rom = rom.data();
+      c.RomSize = rom.size();
+      for (size_t p = 0; p < PROFILE_COUNT; p++) {
+        c.Prof = Profile(p);
+        corpus.push_back(encodeFuzzCase(c));
+      }
+    } else if (argv[i][0] == '-') {
+      usage(argv[0]);
+      return 2;
+    } else {
+      inputs.push_back(argv[i]);
+    }
+  }
+
+  const uint64_t instructions = budget();
+  std::vector<uint8_t> coverage(FUZZ_COVERAGE_SIZE);
+  int failed = 0;
+  for (const auto &name : inputs) {
+    std::vector<uint8_t> input;
+    if (!readFile(name, &input)) {
+      fprintf(stderr, "cannot read %s\n", name.c_str());
+      return 2;
+    }
+    const std::string err =
+        fuzzOne(input.data(), input.size(), instructions, coverage.data());
+    if (!err.empty()) {
+      printf("%s: %s\n", name.c_str(), err.c_str());
+      failed++;
+    }
+    corpus.push_back(input);
+  }
+  if (runs == 0) {
+    if (inputs.empty()) {
+      usage(argv[0]);
+      return 2;
+    }
+    return failed != 0;
+  }
+
+  // a JMP to itself, so the corpus is never empty
+  if (corpus.empty()) {
+    corpus.push_back({0x04, 0, 0, 0, 0x12, 0x00});
+  }
+  std::vector<uint8_t> seen(FUZZ_COVERAGE_SIZE);
+  auto covered = [&] {
+    bool fresh = false;
+    for (size_t i = 0; i < FUZZ_COVERAGE_SIZE; i++) {
+      if (coverage[i] != 0 && seen[i] == 0) {
+        seen[i] = 1;
+        fresh = true;
+      }
+    }
+    std::fill(coverage.begin(), coverage.end(), 0);
+    return fresh;
+  };
+  covered();
+
+  std::mt19937_64 rng(seed);
+  const auto start = std::chrono::steady_clock::now();
+  size_t edges = std::count(seen.begin(), seen.end(), 1);
+  for (uint64_t run = 1; run <= runs; run++) {
+    std::vector<uint8_t> input = corpus[rng() % corpus.size()];
+    mutate(&input, corpus, rng);
+    const std::string err =
+        fuzzOne(input.data(), input.size(), instructions, coverage.data());
+    if (!err.empty()) {
+      const std::string name = crashName(dir, input);
+      std::ofstream(name, std::ios::binary)
+          .write(reinterpret_cast<const char *>(input.data()), input.size());
+      printf("%s: %s\n", name.c_str(), err.c_str());
+      failed++;
+    }
+    if (covered()) {
+      corpus.push_back(input);
+      edges = std::count(seen.begin(), seen.end(), 1);
+    }
+    if (run % 10000 == 0 || run == runs) {
+      const double secs = std::chrono::duration<double>(
+                              std::chrono::steady_clock::now() - start)
+                              .count();
+      printf("run %" PRIu64 "\tcorpus %zu\tpairs %zu\t%.0f runs/s\n", run,
+             corpus.size(), edges, run / secs);
+    }
+  }
+  return failed != 0;
+}
+
+#endif
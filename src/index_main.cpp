@@ -0,0 +1,47 @@
+#include "rom_index.hpp"
+
+#include <cinttypes>
+#include <cstdio>
+#include <fstream>
+#include <string>
+
+static void usage(const char *name) {
+  fprintf(stderr,
+          "usage: %s dir\n"
+          "\n"
+          "indexes the ROMs in dir into dir/%s and lists them, ROMs that did\n"
+          "not change since the last run are not read again\n",
+          name, ROM_INDEX_NAME);
+}
+
+int main(int argc, char **argv) {
+  if (argc != 2) {
+    usage(argv[0]);
+    return 2;
+  }
+  const std::string dir(argv[1]);
+  const std::string indexPath = dir + "/" + ROM_INDEX_NAME;
+
+  std::vector<RomInfo> previous;
+  std::ifstream in(indexPath);
+  if (in && !readRomIndex(in, &previous)) {
+    fprintf(stderr, "ignoring unreadable index %s\n", indexPath.c_str());
+    previous.clear();
+  }
+
+  size_t read = 0;
+  const auto roms = indexRoms(dir, previous, &read);
+  std::ofstream out(indexPath);
+  if (!out || !writeRomIndex(out, roms)) {
+    fprintf(stderr, "cannot write index %s\n", indexPath.c_str());
+    return 1;
+  }
+
+  printf("rom\tprofile\tsize\thash\ttitle\n");
+  for (const auto &info : roms) {
+    printf("%s\t%s\t%" PRIu64 "\t%016" PRIx64 "\t%s\n", info.Path.c_str(),
+           quirksOf(info.Prof).Name, info.Size, info.Hash, info.Title.c_str());
+  }
+  fprintf(stderr, "%zu roms, %zu read\n", roms.size(), read);
+  return 0;
+}
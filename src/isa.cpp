@@ -0,0 +1,168 @@
+#include "isa.hpp"
+
+#include <cstdio>
+
+std::string disassemble(uint8_t hi, uint8_t lo, const Quirks &q, int next) {
+  char buf[64];
+  const uint8_t x = hi & 0xF;
+  const uint8_t y = lo >> 4;
+  const uint8_t n = lo & 0xF;
+  const uint16_t nnn = (x << 8) | lo;
+
+  switch (decodeKind(hi, lo, q)) {
+  case K_SYS:
+    if ((hi >> 4) != 0) {
+      return "";
+    }
+    snprintf(buf, sizeof(buf), "SYS %03x", nnn);
+    break;
+  case K_CLS:
+    return "CLS";
+  case K_RET:
+    return "RET";
+  case K_JMP:
+    snprintf(buf, sizeof(buf), "JP %08x", nnn);
+    break;
+  case K_CALL:
+    snprintf(buf, sizeof(buf), "CALL %08x", nnn);
+    break;
+  case K_SE:
+    snprintf(buf, sizeof(buf), "SE V%02X, %04x", x, lo);
+    break;
+  case K_SNE:
+    snprintf(buf, sizeof(buf), "SNE V%02x, %04x", x, lo);
+    break;
+  case K_SEREG:
+    snprintf(buf, sizeof(buf), "SE V%02x, V%02x", x, y);
+    break;
+  case K_LDI:
+    snprintf(buf, sizeof(buf), "LD V%02x, %04x", x, lo);
+    break;
+  case K_ADDI:
+    snprintf(buf, sizeof(buf), "ADD V%02x, %04x", x, lo);
+    break;
+  case K_LDR:
+    snprintf(buf, sizeof(buf), "LD V%02x, V%02x", x, y);
+    break;
+  case K_OR:
+    snprintf(buf, sizeof(buf), "OR V%02x, V%02x", x, y);
+    break;
+  case K_AND:
+    snprintf(buf, sizeof(buf), "AND V%02x, V%02x", x, y);
+    break;
+  case K_XOR:
+    snprintf(buf, sizeof(buf), "XOR V%02x, V%02x", x, y);
+    break;
+  case K_ADDR:
+    snprintf(buf, sizeof(buf), "ADD V%02x, V%02x", x, y);
+    break;
+  case K_SUB:
+    snprintf(buf, sizeof(buf), "SUB V%02x, V%02x", x, y);
+    break;
+  case K_SHR:
+    snprintf(buf, sizeof(buf), "SHR V%02x", x);
+    break;
+  case K_SUBN:
+    snprintf(buf, sizeof(buf), "SUBN V%02x, V%02x", x, y);
+    break;
+  case K_SHL:
+    snprintf(buf, sizeof(buf), "SHL V%02x", x);
+    break;
+  case K_SNEREG:
+    snprintf(buf, sizeof(buf), "SNE V%02x, V%02x", x, y);
+    break;
+  case K_LDII:
+    snprintf(buf, sizeof(buf), "LD I, %08x", nnn);
+    break;
+  case K_JPOff:
+    snprintf(buf, sizeof(buf), "JP V%02x, %04x", q.JumpVx ? x : 0, nnn);
+    break;
+  case K_RND:
+    snprintf(buf, sizeof(buf), "RND V%02x, %04x", x, lo);
+    break;
+  case K_DRW:
+    snprintf(buf, sizeof(buf), "DRW (V%02x V%02x), %02x", x, y, n);
+    break;
+  case K_SKP:
+    snprintf(buf, sizeof(buf), "SKPKP V%02x", x);
+    break;
+  case K_SKNP:
+    snprintf(buf, sizeof(buf), "SKPNKP V%02x", x);
+    break;
+  case K_LDVDT:
+    snprintf(buf, sizeof(buf), "LD V%02x, DT", x);
+    break;
+  case K_LDK:
+    snprintf(buf, sizeof(buf), "LD V%02x, K", x);
+    break;
+  case K_LDDT:
+    snprintf(buf, sizeof(buf), "LD DT, V%02x", x);
+    break;
+  case K_LDST:
+    snprintf(buf, sizeof(buf), "LD ST, V%02x", x);
+    break;
+  case K_ADDIV:
+    snprintf(buf, sizeof(buf), "ADD I, V%02x", x);
+    break;
+  case K_LDF:
+    snprintf(buf, sizeof(buf), "LD F, V%02x", x);
+    break;
+  case K_LDB:
+    snprintf(buf, sizeof(buf), "LD B, V%02x", x);
+    break;
+  case K_STORE:
+    snprintf(buf, sizeof(buf), "LD [I], V%02x", x);
+    break;
+  case K_LOAD:
+    snprintf(buf, sizeof(buf), "LD V%02x, [I]", x);
+    break;
+  case K_SCD:
+    snprintf(buf, sizeof(buf), "SCD %x", n);
+    break;
+  case K_SCR:
+    return "SCR";
+  case K_SCL:
+    return "SCL";
+  case K_EXIT:
+    return "EXIT";
+  case K_LOW:
+    return "LOW";
+  case K_HIGH:
+    return "HIGH";
+  case K_LDHF:
+    snprintf(buf, sizeof(buf), "LD HF, V%02x", x);
+    break;
+  case K_SRPL:
+    snprintf(buf, sizeof(buf), "LD R, V%02x", x);
+    break;
+  case K_LRPL:
+    snprintf(buf, sizeof(buf), "LD V%02x, R", x);
+    break;
+  case K_SCU:
+    snprintf(buf, sizeof(buf), "SCU %x", n);
+    break;
+  case K_SAVER:
+    snprintf(buf, sizeof(buf), "SAVE V%02x - V%02x", x, y);
+    break;
+  case K_LOADR:
+    snprintf(buf, sizeof(buf), "LOAD V%02x - V%02x", x, y);
+    break;
+  case K_LDIL:
+    if (next < 0) {
+      return "LD I, LONG";
+    }
+    snprintf(buf, sizeof(buf), "LD I, %08x", next);
+    break;
+  case K_PLANE:
+    snprintf(buf, sizeof(buf), "PLANE %x", x);
+    break;
+  case K_AUDIO:
+    return "AUDIO";
+  case K_PITCH:
+    snprintf(buf, sizeof(buf), "PITCH V%02x", x);
+    break;
+  default:
+    return "";
+  }
+  return buf;
+}
@@ -0,0 +1,222 @@
+#ifndef ISA_HPP
+#define ISA_HPP
+
+#include "quirks.hpp"
+#include <cstdint>
+#include <string>
+
+class Chip8;
+
+// CHIP8_INSTRUCTIONS lists every instruction the interpreter understands,
+// X(name) is expanded once per instruction, in the order of Kind
+#define CHIP8_INSTRUCTIONS(X)                                                  \
+  X(SYS)    /* 0nnn and anything undefined */                            \
+  X(CLS)    /* 00E0 */                                                       \
+  X(RET)    /* 00EE */                                                       \
+  X(JMP)    /* 1nnn */                                                       \
+  X(CALL)   /* 2nnn */                                                       \
+  X(SE)     /* 3xkk */                                                       \
+  X(SNE)    /* 4xkk */                                                       \
+  X(SEREG)  /* 5xy0 */                                                       \
+  X(LDI)    /* 6xkk */                                                       \
+  X(ADDI)   /* 7xkk */                                                       \
+  X(LDR)    /* 8xy0 */                                                       \
+  X(OR)     /* 8xy1 */                                                       \
+  X(AND)    /* 8xy2 */                                                       \
+  X(XOR)    /* 8xy3 */                                                       \
+  X(ADDR)   /* 8xy4 */                                                       \
+  X(SUB)    /* 8xy5 */                                                       \
+  X(SHR)    /* 8xy6 */                                                       \
+  X(SUBN)   /* 8xy7 */                                                       \
+  X(SHL)    /* 8xyE */                                                       \
+  X(SNEREG) /* 9xy0 */                                                       \
+  X(LDII)   /* Annn */                                                       \
+  X(JPOff)  /* Bnnn */                                                       \
+  X(RND)    /* Cxkk */                                                       \
+  X(DRW)    /* Dxyn */                                                       \
+  X(SKP)    /* Ex9E */                                                       \
+  X(SKNP)   /* ExA1 */                                                       \
+  X(LDVDT)  /* Fx07 */                                                       \
+  X(LDK)    /* Fx0A */                                                       \
+  X(LDDT)   /* Fx15 */                                                       \
+  X(LDST)   /* Fx18 */                                                       \
+  X(ADDIV)  /* Fx1E */                                                       \
+  X(LDF)    /* Fx29 */                                                       \
+  X(LDB)    /* Fx33 */                                                       \
+  X(STORE)  /* Fx55 */                                                       \
+  X(LOAD)   /* Fx65 */                                                       \
+  X(SCD)    /* 00Cn, SCHIP */                                                \
+  X(SCR)    /* 00FB, SCHIP */                                                \
+  X(SCL)    /* 00FC, SCHIP */                                                \
+  X(EXIT)   /* 00FD, SCHIP */                                                \
+  X(LOW)    /* 00FE, SCHIP */                                                \
+  X(HIGH)   /* 00FF, SCHIP */                                                \
+  X(LDHF)   /* Fx30, SCHIP */                                                \
+  X(SRPL)   /* Fx75, SCHIP */                                                \
+  X(LRPL)   /* Fx85, SCHIP */                                                \
+  X(SCU)    /* 00Dn, XO-CHIP */                                              \
+  X(SAVER)  /* 5xy2, XO-CHIP */                                              \
+  X(LOADR)  /* 5xy3, XO-CHIP */                                              \
+  X(LDIL)   /* F000 nnnn, XO-CHIP */                                         \
+  X(PLANE)  /* Fn01, XO-CHIP */                                              \
+  X(AUDIO)  /* F002, XO-CHIP */                                              \
+  X(PITCH)  /* Fx3A, XO-CHIP */
+
+#define CHIP8_KIND(name) K_##name,
+enum Kind : uint8_t { CHIP8_INSTRUCTIONS(CHIP8_KIND) K_COUNT };
+#undef CHIP8_KIND
+
+// Instruction is one decoded instruction, the handler and its operands are
+// extracted once and reused every time the address is executed
+struct Instruction {
+  using op = bool (*)(Chip8 *, const Instruction &);
+  op handler = nullptr; // nullptr until the address is decoded
+  uint8_t raw[2] = {0, 0};
+  uint8_t kind = K_SYS; // flattened opcode for the threaded engine
+  uint8_t x = 0;        // low nibble of the high byte
+  uint8_t y = 0;        // high nibble of the low byte
+  uint8_t n = 0;        // low nibble of the low byte
+  uint8_t kk = 0;       // low byte
+  uint16_t nnn = 0;     // low 12 bits, the whole second word for LDIL
+};
+
+// decodeKind maps raw instruction bytes to a single dispatch level, matching
+// what the per nibble handlers in the opcode table do with the same bytes.
+// Instructions outside the profile's instruction set decode as SYS.
+inline Kind decodeKind(uint8_t hi, uint8_t lo,
+                       const Quirks &q = PROFILES[0]) {
+  switch (hi >> 4) {
+  case 0x0:
+    if (lo == 0xE0) {
+      return K_CLS;
+    } else if (lo == 0xEE) {
+      return K_RET;
+    } else if (hi != 0x00 || !q.SChip) {
+      return K_SYS;
+    }
+    switch (lo) {
+    case 0xFB:
+      return K_SCR;
+    case 0xFC:
+      return K_SCL;
+    case 0xFD:
+      return K_EXIT;
+    case 0xFE:
+      return K_LOW;
+    case 0xFF:
+      return K_HIGH;
+    }
+    if ((lo & 0xF0) == 0xC0) {
+      return K_SCD;
+    } else if ((lo & 0xF0) == 0xD0 && q.XOChip) {
+      return K_SCU;
+    }
+    return K_SYS;
+  case 0x1:
+    return K_JMP;
+  case 0x2:
+    return K_CALL;
+  case 0x3:
+    return K_SE;
+  case 0x4:
+    return K_SNE;
+  case 0x5:
+    if (q.XOChip && (lo & 0xF) == 0x2) {
+      return K_SAVER;
+    } else if (q.XOChip && (lo & 0xF) == 0x3) {
+      return K_LOADR;
+    }
+    return K_SEREG;
+  case 0x6:
+    return K_LDI;
+  case 0x7:
+    return K_ADDI;
+  case 0x8:
+    switch (lo & 0xF) {
+    case 0x0:
+      return K_LDR;
+    case 0x1:
+      return K_OR;
+    case 0x2:
+      return K_AND;
+    case 0x3:
+      return K_XOR;
+    case 0x4:
+      return K_ADDR;
+    case 0x5:
+      return K_SUB;
+    case 0x6:
+      return K_SHR;
+    case 0x7:
+      return K_SUBN;
+    case 0xE:
+      return K_SHL;
+    }
+    return K_SYS;
+  case 0x9:
+    return K_SNEREG;
+  case 0xA:
+    return K_LDII;
+  case 0xB:
+    return K_JPOff;
+  case 0xC:
+    return K_RND;
+  case 0xD:
+    return K_DRW;
+  case 0xE:
+    return (lo == 0x9E) ? K_SKP : (lo == 0xA1) ? K_SKNP : K_SYS;
+  case 0xF:
+    switch (lo) {
+    case 0x07:
+      return K_LDVDT;
+    case 0x0A:
+      return K_LDK;
+    case 0x15:
+      return K_LDDT;
+    case 0x18:
+      return K_LDST;
+    case 0x1E:
+      return K_ADDIV;
+    case 0x29:
+      return K_LDF;
+    case 0x33:
+      return K_LDB;
+    case 0x55:
+      return K_STORE;
+    case 0x65:
+      return K_LOAD;
+    }
+    if (q.SChip) {
+      switch (lo) {
+      case 0x30:
+        return K_LDHF;
+      case 0x75:
+        return K_SRPL;
+      case 0x85:
+        return K_LRPL;
+      }
+    }
+    if (q.XOChip) {
+      switch (lo) {
+      case 0x00:
+        return (hi == 0xF0) ? K_LDIL : K_SYS;
+      case 0x01:
+        return K_PLANE;
+      case 0x02:
+        return (hi == 0xF0) ? K_AUDIO : K_SYS;
+      case 0x3A:
+        return K_PITCH;
+      }
+    }
+    return K_SYS;
+  }
+  return K_SYS;
+}
+
+// disassemble formats one instruction for the debugger and listings, next is
+// the word after it, which only XO-CHIP's F000 nnnn reads, or -1 if unknown.
+// Bytes that are not an instruction of the profile give an empty string.
+std::string disassemble(uint8_t hi, uint8_t lo, const Quirks &q,
+                        int next = -1);
+
+#endif // ISA_HPP
@@ -0,0 +1,437 @@
+#include "jit.hpp"
+#include "chip8.hpp"
+#include "isa.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__x86_64__) && defined(__unix__)
+#define CHIP8_JIT_X64 1
+#include <sys/mman.h>
+#endif
+
+const size_t CODE_SIZE = 1 << 20;
+const int MAX_BLOCK_LENGTH = 64;
+
+static int32_t offsetIn(const Chip8 *c, const void *field) {
+  return static_cast<int32_t>(reinterpret_cast<const char *>(field) -
+                              reinterpret_cast<const char *>(c));
+}
+
+Jit::Jit(Chip8 *c, size_t memSize)
+    : blockAt(memSize, NOT_COMPILED),
+      pageHasCode((memSize >> PAGE_SHIFT) + 1, false),
+      pageModified((memSize >> PAGE_SHIFT) + 1, false) {
+  offV = offsetIn(c, c->V);
+  offI = offsetIn(c, &c->I);
+  offPC = offsetIn(c, &c->PC);
+  offDT = offsetIn(c, &c->DT);
+  offIR = offsetIn(c, c->IR);
+  offKeyPad = offsetIn(c, c->KeyPad);
+#ifdef CHIP8_JIT_X64
+  void *mem = mmap(nullptr, CODE_SIZE, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mem != MAP_FAILED) {
+    code = static_cast<uint8_t *>(mem);
+  }
+#endif
+}
+
+Jit::~Jit() {
+#ifdef CHIP8_JIT_X64
+  if (code != nullptr) {
+    munmap(code, CODE_SIZE);
+  }
+#endif
+}
+
+int Jit::run(Chip8 *c, int budget) {
+  if (code == nullptr) {
+    return 0;
+  }
+  int executed = 0;
+  while (executed < budget) {
+    const uint16_t pc = c->PC;
+    if (pc >= blockAt.size()) {
+      break;
+    }
+    int32_t idx = blockAt[pc];
+    if (idx == NOT_COMPILED) {
+      idx = compile(c, pc);
+    }
+    if (idx == INTERPRET || blocks[idx].length > budget - executed) {
+      break;
+    }
+    const Block &block = blocks[idx];
+    block.code(c);
+    executed += block.length;
+    c->InstrCount += block.length;
+    if (c->PC <= pc && c->idleLap()) {
+      break;
+    }
+  }
+  return executed;
+}
+
+void Jit::invalidate(uint16_t addr, size_t len) {
+  const std::vector<bool> pages = pagesOf(addr, len);
+  bool hit = false;
+  for (size_t p = 0; p < pageHasCode.size(); p++) {
+    if (pages[p] && pageHasCode[p]) {
+      pageModified[p] = true;
+      hit = true;
+    }
+  }
+  // the ROM writes to its own code, drop every block on those pages and
+  // leave them to the interpreter from now on
+  if (hit) {
+    drop(pageModified);
+  }
+}
+
+void Jit::reload(uint16_t addr, size_t len) {
+  std::vector<bool> pages = pagesOf(addr, len);
+  bool hit = false;
+  for (size_t p = 0; p < pageHasCode.size(); p++) {
+    pages[p] = pages[p] && pageHasCode[p];
+    hit = hit || pages[p];
+  }
+  if (hit) {
+    drop(pages);
+  }
+}
+
+std::vector<bool> Jit::pagesOf(uint16_t addr, size_t len) const {
+  std::vector<bool> pages(pageHasCode.size(), false);
+  // an instruction starting the byte before addr also reads it, addresses
+  // wrap at the end of memory like Memory's do
+  const size_t size = blockAt.size();
+  const size_t start = (addr + size - 1) & (size - 1);
+  const size_t count = std::min(len + 1, size);
+  const size_t end = std::min(start + count, size);
+  for (size_t p = start >> PAGE_SHIFT; p <= (end - 1) >> PAGE_SHIFT; p++) {
+    pages[p] = true;
+  }
+  if (start + count > size) {
+    for (size_t p = 0; p <= (start + count - size - 1) >> PAGE_SHIFT; p++) {
+      pages[p] = true;
+    }
+  }
+  return pages;
+}
+
+void Jit::drop(const std::vector<bool> &pages) {
+  for (auto &block : blocks) {
+    if (block.code == nullptr) {
+      continue;
+    }
+    for (size_t p = block.start >> PAGE_SHIFT;
+         p <= (size_t(block.end) - 1) >> PAGE_SHIFT; p++) {
+      if (pages[p]) {
+        blockAt[block.start] = NOT_COMPILED;
+        block.code = nullptr;
+        break;
+      }
+    }
+  }
+}
+
+void Jit::flush() {
+  blocks.clear();
+  std::fill(blockAt.begin(), blockAt.end(), NOT_COMPILED);
+  std::fill(pageHasCode.begin(), pageHasCode.end(), false);
+  std::fill(pageModified.begin(), pageModified.end(), false);
+  codeUsed = 0;
+}
+
+#ifdef CHIP8_JIT_X64
+
+// Emitter writes x86-64 machine code, every memory operand is a byte or word
+// at [rdi + disp32] where rdi holds the Chip8 pointer
+class Emitter {
+public:
+  std::vector<uint8_t> buf;
+
+  void byte(uint8_t b) { buf.push_back(b); }
+  void bytes(std::initializer_list<uint8_t> bs) {
+    buf.insert(buf.end(), bs.begin(), bs.end());
+  }
+  void imm16(uint16_t v) {
+    byte(v & 0xFF);
+    byte(v >> 8);
+  }
+  void imm32(int32_t v) {
+    for (int i = 0; i < 4; i++) {
+      byte((static_cast<uint32_t>(v) >> (i * 8)) & 0xFF);
+    }
+  }
+  // op r8/r32, [rdi + disp]
+  void mem(std::initializer_list<uint8_t> opcode, uint8_t reg, int32_t disp) {
+    bytes(opcode);
+    byte(0x80 | (reg << 3) | 7);
+    imm32(disp);
+  }
+
+  static const uint8_t AL = 0, CL = 1, DL = 2;
+
+  void loadByte(uint8_t reg, int32_t disp) { mem({0x8A}, reg, disp); }
+  void storeByte(int32_t disp, uint8_t reg) { mem({0x88}, reg, disp); }
+  void storeByteImm(int32_t disp, uint8_t v) {
+    mem({0xC6}, 0, disp);
+    byte(v);
+  }
+  void addByteImm(int32_t disp, uint8_t v) {
+    mem({0x80}, 0, disp);
+    byte(v);
+  }
+  void cmpByteImm(int32_t disp, uint8_t v) {
+    mem({0x80}, 7, disp);
+    byte(v);
+  }
+  void storeWordImm(int32_t disp, uint16_t v) {
+    mem({0x66, 0xC7}, 0, disp);
+    imm16(v);
+  }
+  void storeWordAX(int32_t disp) { mem({0x66, 0x89}, AL, disp); }
+  void addWordAX(int32_t disp) { mem({0x66, 0x01}, AL, disp); }
+  void zeroExtendByte(int32_t disp) { mem({0x0F, 0xB6}, AL, disp); }
+  // al = al op [rdi + disp]
+  void orAL(int32_t disp) { mem({0x0A}, AL, disp); }
+  void andAL(int32_t disp) { mem({0x22}, AL, disp); }
+  void xorAL(int32_t disp) { mem({0x32}, AL, disp); }
+  void addAL(int32_t disp) { mem({0x02}, AL, disp); }
+  void subAL(int32_t disp) { mem({0x2A}, AL, disp); }
+  void cmpAL(int32_t disp) { mem({0x3A}, AL, disp); }
+  void setcDL() { bytes({0x0F, 0x92, 0xC2}); }
+  void setaDL() { bytes({0x0F, 0x97, 0xC2}); }
+
+  // PC = taken ? skip : next, flags must come from the preceding compare
+  void branchPC(int32_t offPC, uint8_t jccSkipIfNot, uint16_t next,
+                uint16_t skip) {
+    storeWordImm(offPC, next);
+    bytes({jccSkipIfNot, 9}); // over the 9 byte store below
+    storeWordImm(offPC, skip);
+  }
+  static const uint8_t JE = 0x74, JNE = 0x75;
+};
+
+// compile translates the block starting at addr, returns its index in blocks
+// or INTERPRET when the first instruction cannot be compiled
+int Jit::compile(Chip8 *c, uint16_t addr) {
+  Emitter e;
+  const int32_t VF = offV + 0xF;
+  uint16_t pc = addr;
+  int length = 0;
+  bool terminated = false;
+  uint8_t lastRaw[2] = {0, 0};
+
+  while (length < MAX_BLOCK_LENGTH && !terminated &&
+         size_t(pc) + 1 < blockAt.size() && !pageModified[pc >> PAGE_SHIFT] &&
+         !pageModified[(pc + 1) >> PAGE_SHIFT]) {
+    const uint8_t hi = c->mem->get(pc);
+    const uint8_t lo = c->mem->get(pc + 1);
+    const uint8_t x = hi & 0xF;
+    const uint8_t y = lo >> 4;
+    const uint16_t nnn = ((hi & 0xF) << 8) | lo;
+    const int32_t Vx = offV + x;
+    const int32_t Vy = offV + y;
+    const uint16_t next = pc + 2;
+    const uint16_t skip = pc + 4;
+
+    const Quirks &q = c->quirks();
+    const Kind kind = decodeKind(hi, lo, q);
+    // quirks other than plain CHIP-8 are left to the interpreter, as are
+    // XO-CHIP skips that may have to step over a four byte instruction
+    if (((kind == K_SHR || kind == K_SHL) && q.ShiftVy) ||
+        (kind == K_JPOff && q.JumpVx) ||
+        ((kind == K_SE || kind == K_SNE || kind == K_SEREG ||
+          kind == K_SNEREG || kind == K_SKP || kind == K_SKNP) &&
+         q.XOChip)) {
+      goto done;
+    }
+    switch (kind) {
+    case K_SYS:
+      break;
+    case K_JMP:
+      e.storeWordImm(offPC, nnn);
+      terminated = true;
+      break;
+    case K_JPOff:
+      e.zeroExtendByte(offV);
+      e.byte(0x05); // add eax, imm32
+      e.imm32(nnn);
+      e.storeWordAX(offPC);
+      terminated = true;
+      break;
+    case K_SE:
+      e.cmpByteImm(Vx, lo);
+      e.branchPC(offPC, Emitter::JNE, next, skip);
+      terminated = true;
+      break;
+    case K_SNE:
+      e.cmpByteImm(Vx, lo);
+      e.branchPC(offPC, Emitter::JE, next, skip);
+      terminated = true;
+      break;
+    case K_SEREG:
+      e.loadByte(Emitter::AL, Vx);
+      e.cmpAL(Vy);
+      e.branchPC(offPC, Emitter::JNE, next, skip);
+      terminated = true;
+      break;
+    case K_SNEREG:
+      e.loadByte(Emitter::AL, Vx);
+      e.cmpAL(Vy);
+      e.branchPC(offPC, Emitter::JE, next, skip);
+      terminated = true;
+      break;
+    case K_SKP:
+    case K_SKNP:
+      e.zeroExtendByte(Vx);
+      e.bytes({0x83, 0xE0, 0x0F}); // and eax, 0xF
+      e.bytes({0x80, 0xBC, 0x07}); // cmp byte [rdi + rax + disp32], 0
+      e.imm32(offKeyPad);
+      e.byte(0);
+      e.branchPC(offPC,
+                 kind == K_SKP ? Emitter::JE : Emitter::JNE,
+                 next, skip);
+      terminated = true;
+      break;
+    case K_LDI:
+      e.storeByteImm(Vx, lo);
+      break;
+    case K_ADDI:
+      e.addByteImm(Vx, lo);
+      break;
+    case K_LDR:
+      e.loadByte(Emitter::AL, Vy);
+      e.storeByte(Vx, Emitter::AL);
+      break;
+    case K_OR:
+      e.loadByte(Emitter::AL, Vx);
+      e.orAL(Vy);
+      e.storeByte(Vx, Emitter::AL);
+      break;
+    case K_AND:
+      e.loadByte(Emitter::AL, Vx);
+      e.andAL(Vy);
+      e.storeByte(Vx, Emitter::AL);
+      break;
+    case K_XOR:
+      e.loadByte(Emitter::AL, Vx);
+      e.xorAL(Vy);
+      e.storeByte(Vx, Emitter::AL);
+      break;
+    // the flag setting ops store VF before Vx and reread their operands
+    // after the VF store exactly like the interpreter, so x or y being F
+    // gives the same result
+    case K_ADDR:
+      e.loadByte(Emitter::AL, Vx);
+      e.addAL(Vy);
+      e.setcDL();
+      e.storeByte(VF, Emitter::DL);
+      e.storeByte(Vx, Emitter::AL);
+      break;
+    case K_SUB:
+      e.loadByte(Emitter::AL, Vx);
+      e.cmpAL(Vy);
+      e.setaDL();
+      e.storeByte(VF, Emitter::DL);
+      e.loadByte(Emitter::AL, Vx);
+      e.subAL(Vy);
+      e.storeByte(Vx, Emitter::AL);
+      break;
+    case K_SUBN:
+      e.loadByte(Emitter::AL, Vy);
+      e.cmpAL(Vx);
+      e.setaDL();
+      e.storeByte(VF, Emitter::DL);
+      e.loadByte(Emitter::AL, Vy);
+      e.subAL(Vx);
+      e.storeByte(Vx, Emitter::AL);
+      break;
+    case K_SHR:
+      e.loadByte(Emitter::AL, Vx);
+      e.bytes({0x24, 0x01}); // and al, 1
+      e.storeByte(VF, Emitter::AL);
+      e.loadByte(Emitter::AL, Vx);
+      e.bytes({0xD0, 0xE8}); // shr al, 1
+      e.storeByte(Vx, Emitter::AL);
+      break;
+    case K_SHL:
+      e.loadByte(Emitter::AL, Vx);
+      e.bytes({0xC0, 0xE8, 0x07}); // shr al, 7
+      e.storeByte(VF, Emitter::AL);
+      e.loadByte(Emitter::AL, Vx);
+      e.bytes({0x00, 0xC0}); // add al, al
+      e.storeByte(Vx, Emitter::AL);
+      break;
+    case K_LDII:
+      e.storeWordImm(offI, nnn);
+      break;
+    case K_ADDIV:
+      e.zeroExtendByte(Vx);
+      e.addWordAX(offI);
+      break;
+    case K_LDF:
+      e.zeroExtendByte(Vx);
+      e.bytes({0x6B, 0xC0, CHAR_SPRITE_SIZE}); // imul eax, eax, imm8
+      e.storeWordAX(offI);
+      break;
+    case K_LDVDT:
+      e.loadByte(Emitter::AL, offDT);
+      e.storeByte(Vx, Emitter::AL);
+      break;
+    case K_LDDT:
+      e.loadByte(Emitter::AL, Vx);
+      e.storeByte(offDT, Emitter::AL);
+      break;
+    default:
+      // interpreted, the block ends before it
+      goto done;
+    }
+    lastRaw[0] = hi;
+    lastRaw[1] = lo;
+    length++;
+    pc += 2;
+  }
+done:
+  if (length == 0) {
+    blockAt[addr] = INTERPRET;
+    return INTERPRET;
+  }
+  if (!terminated) {
+    e.storeWordImm(offPC, pc);
+  }
+  e.storeWordImm(offIR, lastRaw[0] | (lastRaw[1] << 8));
+  e.byte(0xC3); // ret
+
+  if (codeUsed + e.buf.size() > CODE_SIZE) {
+    flush();
+  }
+  if (mprotect(code, CODE_SIZE, PROT_READ | PROT_WRITE) != 0) {
+    blockAt[addr] = INTERPRET;
+    return INTERPRET;
+  }
+  uint8_t *fn = code + codeUsed;
+  memcpy(fn, e.buf.data(), e.buf.size());
+  codeUsed += e.buf.size();
+  mprotect(code, CODE_SIZE, PROT_READ | PROT_EXEC);
+
+  for (size_t p = addr >> PAGE_SHIFT; p <= (size_t(pc) - 1) >> PAGE_SHIFT;
+       p++) {
+    pageHasCode[p] = true;
+  }
+  blocks.push_back(Block{addr, pc, length, reinterpret_cast<Fn>(fn)});
+  blockAt[addr] = blocks.size() - 1;
+  return blocks.size() - 1;
+}
+
+#else
+
+int Jit::compile(Chip8 *c, uint16_t addr) {
+  blockAt[addr] = INTERPRET;
+  return INTERPRET;
+}
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef JIT_HPP
+#define JIT_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class Chip8;
+
+// Jit recompiles basic blocks of CHIP-8 code to x86-64. Blocks read and write
+// the Chip8 registers in place, so the interpreter can take over between any
+// two blocks. Anything a block cannot express (DRW, CALL, RET, key waits,
+// memory stores, RND) ends the block and is left to the interpreter, as is
+// any page that has been written to after code was compiled from it.
+//
+// On hosts other than x86-64 unix run always returns 0 and the interpreter
+// does all the work.
+class Jit {
+public:
+  Jit(Chip8 *c, size_t memSize);
+  ~Jit();
+  Jit(const Jit &) = delete;
+  Jit &operator=(const Jit &) = delete;
+
+  // run executes compiled blocks starting at PC until budget instructions
+  // ran, the next instruction has to be interpreted or Chip8::idleLap found
+  // an idle loop, returns the number of instructions executed
+  int run(Chip8 *c, int budget);
+
+  // invalidate drops blocks overlapping a write to [addr, addr + len)
+  void invalidate(uint16_t addr, size_t len);
+  // reload drops blocks overlapping [addr, addr + len) after the memory was
+  // replaced by a snapshot, unlike invalidate the pages stay compilable
+  void reload(uint16_t addr, size_t len);
+  // flush drops every block, used when memory changed from outside the CPU
+  void flush();
+
+private:
+  using Fn = void (*)(Chip8 *);
+  struct Block {
+    uint16_t start;
+    uint16_t end; // one past the last byte compiled
+    int length;   // instructions
+    Fn code;
+  };
+
+  int compile(Chip8 *c, uint16_t addr);
+  // pagesOf marks the pages a write to [addr, addr + len) can change code on
+  std::vector<bool> pagesOf(uint16_t addr, size_t len) const;
+  // drop forgets every block touching one of the pages
+  void drop(const std::vector<bool> &pages);
+
+  static constexpr int32_t NOT_COMPILED = -1;
+  static constexpr int32_t INTERPRET = -2;
+  static constexpr size_t PAGE_SHIFT = 8;
+
+  std::vector<Block> blocks;
+  std::vector<int32_t> blockAt; // per address index into blocks
+  std::vector<bool> pageHasCode;
+  std::vector<bool> pageModified; // self modified, always interpreted
+
+  // offsets of the Chip8 registers, generated code addresses them relative
+  // to the Chip8 pointer it is called with
+  int32_t offV, offI, offPC, offDT, offIR, offKeyPad;
+
+  uint8_t *code = nullptr;
+  size_t codeUsed = 0;
+};
+
+#endif // JIT_HPP
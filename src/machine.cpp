@@ -0,0 +1,17 @@
+#include "machine.hpp"
+
+Machine::Machine(Engine e, Profile p)
+    : Mem(quirksOf(p).MemorySize), Cpu(&Mem, e, p) {}
+
+Machine *MachinePool::get(Engine e, Profile p, const uint8_t *rom,
+                          size_t len) {
+  std::unique_ptr<Machine> &m = machines[size_t(e)][size_t(p)];
+  if (!m) {
+    m.reset(new Machine(e, p));
+  }
+  if (rom == nullptr) {
+    m->Cpu.reset();
+    return m.get();
+  }
+  return m->Cpu.reset(rom, len) ? m.get() : nullptr;
+}
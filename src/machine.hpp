@@ -0,0 +1,34 @@
+#ifndef MACHINE_HPP
+#define MACHINE_HPP
+
+#include "chip8.hpp"
+#include "memory.hpp"
+#include <cstddef>
+#include <memory>
+
+// Machine is a Memory and the Chip8 running on it, kept together so code
+// going through many ROMs can reset one instead of building a new one
+struct Machine {
+  Machine(Engine e, Profile p);
+  Machine(const Machine &) = delete;
+  Machine &operator=(const Machine &) = delete;
+
+  Memory Mem;
+  Chip8 Cpu;
+};
+
+// MachinePool keeps a machine per engine and profile, built the first time
+// it is asked for. It is not shared between threads, farm workers each keep
+// their own.
+class MachinePool {
+public:
+  // get returns the machine for engine and profile reset to boot, with rom
+  // loaded when it is given, nullptr if the ROM does not fit in memory
+  Machine *get(Engine e, Profile p, const uint8_t *rom = nullptr,
+               size_t len = 0);
+
+private:
+  std::unique_ptr<Machine> machines[ENGINE_COUNT][PROFILE_COUNT];
+};
+
+#endif // MACHINE_HPP
@@ -1,6 +1,16 @@
+#include "audio.hpp"
 #include "chip8.hpp"
+#include "cpu_thread.hpp"
+#include "frontend.hpp"
 #include "memory.hpp"
+#include "replay.hpp"
+#include "rewind.hpp"
+#include "rom.hpp"
+#include "scheduler.hpp"
 //#include <SDL2/SDL.h>
+#include <algorithm>
+#include <cstdlib>
+#include <ctime>
 #include <fstream>
 #include <iostream>
 #include <map>
@@ -18,16 +28,54 @@ const int SCREEN_HEIGHT = WIN_SIZE_Y * SCREEN_SIZE_MULTIPLIER;
 const int SCREEN_WIDTH = WIN_SIZE_X * SCREEN_SIZE_MULTIPLIER;
 const int CPU_INFO_HEIGHT = 240;
 const int CPU_INFO_WIDTH = 560;
-
-void load_rom(Memory *mem, uint16_t starting_address, std::string filename);
+// samples handed to raylib's stream at a time, more than a frame's worth
+const int AUDIO_STREAM_BUFFER = 1024;
 
 int main() {
   InitWindow(SCREEN_WIDTH + CPU_INFO_WIDTH, SCREEN_HEIGHT + CPU_INFO_HEIGHT,
              TITLE);
   SetTargetFPS(60);
-
-  Memory mem(4096);
-  Chip8 cpu(&mem);
+  InitAudioDevice();
+  SetAudioStreamBufferSizeDefault(AUDIO_STREAM_BUFFER);
+  AudioStream stream = LoadAudioStream(AUDIO_SAMPLE_RATE, 16, 1);
+  PlayAudioStream(stream);
+
+  // CHIP8_PROFILE picks the instruction set and quirks, chip8 by default
+  Profile profile = Profile::Chip8;
+  const char *profileEnv = getenv("CHIP8_PROFILE");
+  if (profileEnv != nullptr && !parseProfile(profileEnv, &profile)) {
+    std::cerr << "unknown profile " << profileEnv << std::endl;
+  }
+  Memory mem(quirksOf(profile).MemorySize);
+  Chip8 cpu(&mem, Engine::Table, profile);
+  Frontend frontend;
+  Rewind rewind;
+  // CHIP8_RECORD=file saves the session for chip-8-replay on exit, rewinding
+  // would make it unreplayable so it is off while recording
+  const char *recordPath = getenv("CHIP8_RECORD");
+  Recorder recorder;
+  // CHIP8_IPS sets the clock rate, TAB toggles turbo
+  const char *ipsEnv = getenv("CHIP8_IPS");
+  Scheduler scheduler(ipsEnv ? strtoull(ipsEnv, nullptr, 10) : DEFAULT_IPS);
+  scheduler.onTick([&](Chip8 &c) {
+    recorder.fixedUpdate(c);
+    rewind.record(c);
+  });
+  // the CPU thread renders sound into speaker, the window's loop feeds it to
+  // the audio stream
+  RingSink speaker;
+  Audio audio(&speaker);
+  scheduler.onSync([&](const Chip8 &c, uint64_t cycle) {
+    audio.follow(c, cycle, scheduler.ips());
+  });
+  int16_t streamBuffer[AUDIO_STREAM_BUFFER];
+  // the CPU runs on its own thread, the window draws the latest state it
+  // published through view
+  CpuThread cpuThread(cpu, scheduler, &recorder,
+                      recordPath == nullptr ? &rewind : nullptr);
+  Memory viewMem(quirksOf(profile).MemorySize);
+  Chip8 view(&viewMem, Engine::Table, profile);
+  cpuThread.start();
 
   std::map<int, std::pair<int, bool>> keyboard;
   keyboard[KEY_ONE] = {0x1, false};
@@ -48,7 +96,8 @@ int main() {
   keyboard[KEY_V] = {0xF, false};
 
   auto runMode = StepMode::SINGLE;
-  bool shouldStep = false;
+  bool turbo = false;
+  bool rewinding = false;
 
   int count = 0;
   char **droppedFiles = {0};
@@ -57,65 +106,81 @@ int main() {
 
     if (IsFileDropped()) {
       droppedFiles = GetDroppedFiles(&count);
-      mem.clear();
-      cpu = Chip8(&mem);
-      load_rom(&mem, 0x200, droppedFiles[0]);
+      cpuThread.stop();
+      cpu.reset();
+      scheduler.reset();
+      cpu.seed(time(NULL));
+      std::string err;
+      if (loadRom(&mem, ROM_START, droppedFiles[0], &err) == 0) {
+        std::cerr << "cannot load rom " << droppedFiles[0] << ": " << err
+                  << std::endl;
+      }
+      rewind.clear();
+      recorder.start(cpu);
+      cpuThread.start();
       ClearDroppedFiles();
       std::string newTitle(TITLE);
       newTitle += std::string(droppedFiles[0]);
       SetWindowTitle(newTitle.c_str());
     }
 
-    if (shouldStep) {
-      cpu.step((runMode == StepMode::RUN) ? 1000 : 1);
-      if (runMode == StepMode::SINGLE) {
-        shouldStep = false;
-      }
-      cpu.fixedUpdate();
-    }
-
     for (auto &i : keyboard) {
       if (IsKeyDown(i.first)) {
         if (!i.second.second) {
-          cpu.sendInput(i.second.first, true);
+          cpuThread.send(CpuOp::KeyDown, i.second.first);
           i.second.second = true;
         }
       } else if (i.second.second) {
-        cpu.sendInput(i.second.first, false);
+        cpuThread.send(CpuOp::KeyUp, i.second.first);
         i.second.second = false;
       }
     }
+    // holding backspace runs time backwards one frame per timer tick
+    if (IsKeyDown(KEY_BACKSPACE) != rewinding) {
+      rewinding = !rewinding;
+      cpuThread.send(CpuOp::Rewind, rewinding);
+    }
     if (IsKeyPressed(KEY_SPACE)) {
-      shouldStep = true;
+      cpuThread.send(CpuOp::Step);
+    }
+    if (IsKeyPressed(KEY_TAB)) {
+      turbo = !turbo;
+      cpuThread.send(CpuOp::Turbo, turbo);
     }
     if (IsKeyPressed(KEY_ENTER)) {
-      if (runMode == StepMode::SINGLE) {
-        runMode = StepMode::RUN;
-        shouldStep = true;
-      } else {
-        runMode = StepMode::SINGLE;
-        shouldStep = false;
-      }
+      runMode =
+          (runMode == StepMode::SINGLE) ? StepMode::RUN : StepMode::SINGLE;
+      cpuThread.send(CpuOp::Run, runMode == StepMode::RUN);
+    }
+
+    if (cpuThread.update()) {
+      cpuThread.frame().show(view);
+    }
+    while (IsAudioStreamProcessed(stream)) {
+      const size_t got = speaker.read(streamBuffer, AUDIO_STREAM_BUFFER);
+      std::fill(streamBuffer + got, streamBuffer + AUDIO_STREAM_BUFFER, 0);
+      UpdateAudioStream(stream, streamBuffer, AUDIO_STREAM_BUFFER);
     }
 
     BeginDrawing();
     ClearBackground(DARKGRAY);
-    cpu.drawScr(SCREEN_WIDTH, SCREEN_HEIGHT);
-    cpu.drawReg(SCREEN_WIDTH, SCREEN_HEIGHT);
+    frontend.drawScr(view, SCREEN_WIDTH, SCREEN_HEIGHT);
+    frontend.drawReg(view, SCREEN_WIDTH, SCREEN_HEIGHT);
     EndDrawing();
   }
 
+  cpuThread.stop();
+  frontend.close();
+  UnloadAudioStream(stream);
+  CloseAudioDevice();
   CloseWindow();
 
-  return 0;
-}
-
-void load_rom(Memory *mem, uint16_t starting_address, std::string filename) {
-  std::ifstream input(filename.c_str(), std::ios::binary);
-
-  // copies all data into buffer
-  std::vector<unsigned char> buffer(std::istreambuf_iterator<char>(input), {});
-  for (const auto &i : buffer) {
-    mem->set(starting_address++, i);
+  if (recordPath != nullptr) {
+    std::ofstream out(recordPath);
+    if (!writeRecording(out, recorder.recording())) {
+      std::cerr << "cannot write recording " << recordPath << std::endl;
+    }
   }
+
+  return 0;
 }
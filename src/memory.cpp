@@ -1,9 +1,64 @@
 #include "memory.hpp"
 
+#include <algorithm>
 #include <cstdint>
 #include <cstdio>
 
-Memory::Memory(size_t size) : memory(size) {}
+static size_t roundUpPowerOfTwo(size_t size) {
+  size_t p = 1;
+  while (p < size) {
+    p <<= 1;
+  }
+  return p;
+}
+
+Memory::Memory(size_t size)
+    : memory(roundUpPowerOfTwo(size)), mask(memory.size() - 1),
+      shared((memory.size() + MEM_PAGE_SIZE - 1) / MEM_PAGE_SIZE),
+      dirty(shared.size(), true) {}
+
+void Memory::readWrapped(size_t idx, uint8_t *dst, size_t len) const {
+  for (size_t i = 0; i < len; i++) {
+    dst[i] = memory[(idx + i) & mask];
+  }
+}
+
+void Memory::writeWrapped(size_t idx, const uint8_t *src, size_t len) {
+  while (len > 0) {
+    const size_t n = std::min(len, memory.size() - idx);
+    write(idx, src, n);
+    idx = (idx + n) & mask;
+    src += n;
+    len -= n;
+  }
+}
+
+SharedPage Memory::page(size_t i) {
+  if (dirty[i] || !shared[i]) {
+    auto copy = std::make_shared<MemoryPage>();
+    const size_t start = i * MEM_PAGE_SIZE;
+    const size_t end = std::min(start + MEM_PAGE_SIZE, memory.size());
+    std::copy(memory.begin() + start, memory.begin() + end, copy->begin());
+    std::fill(copy->begin() + (end - start), copy->end(), 0);
+    shared[i] = copy;
+    dirty[i] = false;
+  }
+  return shared[i];
+}
+
+bool Memory::loadPage(size_t i, const SharedPage &page) {
+  if (!dirty[i] && shared[i] == page) {
+    return false;
+  }
+  const size_t start = i * MEM_PAGE_SIZE;
+  const size_t end = std::min(start + MEM_PAGE_SIZE, memory.size());
+  std::copy(page->begin(), page->begin() + (end - start),
+            memory.begin() + start);
+  shared[i] = page;
+  dirty[i] = false;
+  gen++;
+  return true;
+}
 
 void Memory::dump() { dump(0, memory.size()); }
 
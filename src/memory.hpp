@@ -1,33 +1,107 @@
 #ifndef MEMORY_HPP
 #define MEMORY_HPP
 
+#include <algorithm>
+#include <array>
+#include <cstddef>
 #include <cstdint>
+#include <memory>
 #include <vector>
 
+const size_t MEM_PAGE_SHIFT = 8;
+const size_t MEM_PAGE_SIZE = size_t(1) << MEM_PAGE_SHIFT;
+
+// MemoryPage is an immutable copy of one page, snapshots taken while a page
+// is not written share the same copy
+using MemoryPage = std::array<uint8_t, MEM_PAGE_SIZE>;
+using SharedPage = std::shared_ptr<const MemoryPage>;
+
 class Memory {
 public:
   Memory() = delete;
+  // size is rounded up to a power of two so addresses wrap with a mask
   explicit Memory(size_t size);
 
-  inline uint8_t get(size_t idx) { return memory[idx % memory.size()]; };
+  inline uint8_t get(size_t idx) const { return memory[idx & mask]; };
   inline void set(size_t idx, uint8_t val) {
-    memory[idx % memory.size()] = val;
+    idx &= mask;
+    memory[idx] = val;
+    dirty[idx >> MEM_PAGE_SHIFT] = true;
+    gen++;
   };
+  // fetch16 reads the big endian word at idx, the order instructions are in
+  inline uint16_t fetch16(size_t idx) const {
+    return (memory[idx & mask] << 8) | memory[(idx + 1) & mask];
+  }
+  // set16 stores val big endian at idx
   inline void set16(size_t idx, uint16_t val) {
-    memory[idx] = val & 0xFF;
-    memory[idx + 1] = val >> 8;
+    const uint8_t bytes[2] = {uint8_t(val >> 8), uint8_t(val & 0xFF)};
+    write(idx, bytes, 2);
   }
-  inline void clear() {
-    for (int i = 0; i < memory.size(); i++) {
-      memory[i] = 0;
+  // read copies len bytes from idx and write copies them to idx, both in one
+  // go unless they wrap at the end of memory
+  inline void read(size_t idx, uint8_t *dst, size_t len) const {
+    idx &= mask;
+    if (idx + len <= memory.size()) {
+      std::copy(memory.data() + idx, memory.data() + idx + len, dst);
+    } else {
+      readWrapped(idx, dst, len);
+    }
+  }
+  inline void write(size_t idx, const uint8_t *src, size_t len) {
+    idx &= mask;
+    if (len == 0) {
+      return;
+    } else if (idx + len <= memory.size()) {
+      std::copy(src, src + len, memory.data() + idx);
+      for (size_t p = idx >> MEM_PAGE_SHIFT;
+           p <= (idx + len - 1) >> MEM_PAGE_SHIFT; p++) {
+        dirty[p] = true;
+      }
+      gen++;
+    } else {
+      writeWrapped(idx, src, len);
     }
   }
+  inline void clear() {
+    std::fill(memory.begin(), memory.end(), 0);
+    std::fill(dirty.begin(), dirty.end(), true);
+    gen++;
+  }
+  // load replaces all of memory with image followed by zeros
+  inline void load(const uint8_t *image, size_t len) {
+    len = std::min(len, memory.size());
+    std::copy(image, image + len, memory.begin());
+    std::fill(memory.begin() + len, memory.end(), 0);
+    std::fill(dirty.begin(), dirty.end(), true);
+    gen++;
+  }
+  inline size_t size() const { return memory.size(); }
+  // generation changes on every write, caches of memory contents compare it
+  // to find out they are stale
+  inline uint32_t generation() const { return gen; }
+
+  inline size_t pageCount() const { return dirty.size(); }
+  // page returns a copy of page i, only pages written since the last call
+  // are copied again, clean ones hand out the previous copy
+  SharedPage page(size_t i);
+  // loadPage overwrites page i with a copy from page, returns false without
+  // touching memory when the page already holds that copy
+  bool loadPage(size_t i, const SharedPage &page);
 
   void dump();
   void dump(size_t low, size_t high);
 
 private:
+  void readWrapped(size_t idx, uint8_t *dst, size_t len) const;
+  void writeWrapped(size_t idx, const uint8_t *src, size_t len);
+
   std::vector<uint8_t> memory;
+  size_t mask; // memory.size() - 1
+  uint32_t gen = 0;
+
+  std::vector<SharedPage> shared; // last copy of every page handed out
+  std::vector<uint8_t> dirty;     // page written since its copy was made
 };
 
 #endif // MEMORY_HPP
\ No newline at end of file
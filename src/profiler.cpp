@@ -0,0 +1,128 @@
+#include "profiler.hpp"
+#include "chip8.hpp"
+
+#include <cinttypes>
+#include <cstdio>
+
+#define CHIP8_KIND_NAME(name) #name,
+static const char *KIND_NAMES[K_COUNT] = {
+    CHIP8_INSTRUCTIONS(CHIP8_KIND_NAME)};
+#undef CHIP8_KIND_NAME
+
+static const char *STEP_END_NAMES[STEP_END_COUNT] = {
+    "budget", "draw", "clear", "paused", "wait_tick", "other",
+};
+
+Profiler::Profiler(size_t memSize) : Heat(memSize) {
+  frames.push_back(Frame{0, 0});
+}
+
+uint32_t Profiler::child(uint32_t parent, uint16_t entry) {
+  auto it = frames[parent].Children.find(entry);
+  if (it != frames[parent].Children.end()) {
+    return it->second;
+  }
+  const uint32_t index = frames.size();
+  frames.push_back(Frame{entry, parent});
+  frames[parent].Children[entry] = index;
+  return index;
+}
+
+void Profiler::resync(const Chip8 &cpu) {
+  current = 0;
+  for (size_t i = 0; i < cpu.SP && i < STACK_SIZE; i++) {
+    // the CALL that pushed a return address sits right before it
+    current = child(current, cpu.mem->fetch16(cpu.Stack[i] - 2) & 0xFFF);
+  }
+  depth = cpu.SP;
+}
+
+void Profiler::instruction(const Chip8 &cpu, const Instruction &instr,
+                           uint16_t pc) {
+  Kinds[instr.kind]++;
+  Heat[pc % Heat.size()]++;
+  if (depth != cpu.SP) {
+    resync(cpu);
+  }
+  frames[current].Self++;
+  if (instr.kind == K_CALL) {
+    current = child(current, instr.nnn);
+    depth++;
+  } else if (instr.kind == K_RET && depth > 0) {
+    current = frames[current].Parent;
+    depth--;
+  }
+}
+
+void Profiler::step(StepEnd end, uint64_t nanos, uint64_t instructions) {
+  StepStats &stats = Steps[size_t(end)];
+  stats.Calls++;
+  stats.Nanos += nanos;
+  stats.Instructions += instructions;
+  size_t bucket = 0;
+  while (bucket + 1 < PROFILER_BUCKETS && (nanos >> (bucket + 1)) != 0) {
+    bucket++;
+  }
+  StepNanos[bucket]++;
+}
+
+bool Profiler::writeJson(std::ostream &out) const {
+  char buf[64];
+  uint64_t total = JitInstructions;
+  for (auto count : Kinds) {
+    total += count;
+  }
+  out << "{\n  \"instructions\": " << total
+      << ",\n  \"jit_instructions\": " << JitInstructions
+      << ",\n  \"kinds\": {";
+  const char *sep = "";
+  for (size_t k = 0; k < K_COUNT; k++) {
+    if (Kinds[k] != 0) {
+      out << sep << "\n    \"" << KIND_NAMES[k] << "\": " << Kinds[k];
+      sep = ",";
+    }
+  }
+  out << "\n  },\n  \"heat\": {";
+  sep = "";
+  for (size_t addr = 0; addr < Heat.size(); addr++) {
+    if (Heat[addr] != 0) {
+      snprintf(buf, sizeof(buf), "%s\n    \"%04zx\": %" PRIu64, sep, addr,
+               Heat[addr]);
+      out << buf;
+      sep = ",";
+    }
+  }
+  out << "\n  },\n  \"steps\": {";
+  sep = "";
+  for (size_t e = 0; e < STEP_END_COUNT; e++) {
+    out << sep << "\n    \"" << STEP_END_NAMES[e]
+        << "\": {\"calls\": " << Steps[e].Calls
+        << ", \"ns\": " << Steps[e].Nanos
+        << ", \"instructions\": " << Steps[e].Instructions << "}";
+    sep = ",";
+  }
+  out << "\n  },\n  \"step_ns_log2\": [";
+  for (size_t b = 0; b < PROFILER_BUCKETS; b++) {
+    out << (b == 0 ? "" : ", ") << StepNanos[b];
+  }
+  out << "]\n}\n";
+  return bool(out);
+}
+
+std::string Profiler::path(uint32_t frame) const {
+  if (frame == 0) {
+    return "main";
+  }
+  char buf[16];
+  snprintf(buf, sizeof(buf), ";sub_%04x", frames[frame].Entry);
+  return path(frames[frame].Parent) + buf;
+}
+
+bool Profiler::writeFolded(std::ostream &out) const {
+  for (uint32_t f = 0; f < frames.size(); f++) {
+    if (frames[f].Self != 0) {
+      out << path(f) << " " << frames[f].Self << "\n";
+    }
+  }
+  return bool(out);
+}
@@ -0,0 +1,82 @@
+#ifndef PROFILER_HPP
+#define PROFILER_HPP
+
+#include "isa.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// The profiler hooks in Chip8 only exist in builds configured with
+// CHIP8_PROFILER, everywhere else they compile to nothing
+#ifdef CHIP8_PROFILER
+const bool PROFILER_ENABLED = true;
+#else
+const bool PROFILER_ENABLED = false;
+#endif
+
+// StepEnd is why a step call returned before or at its instruction budget
+enum class StepEnd : uint8_t {
+  Budget,   // ran every instruction it was asked to
+  Draw,     // DRW ended the step early
+  Clear,    // CLS ended the step early
+  Paused,   // waiting for a key
+  WaitTick, // waiting for the display, DisplayWait
+  Other,    // scrolls, resolution changes, sound, EXIT
+};
+const size_t STEP_END_COUNT = 6;
+// step durations are kept in power of two buckets of nanoseconds
+const size_t PROFILER_BUCKETS = 32;
+
+class Chip8;
+
+// Profiler counts what a Chip8 spends its time on while it is attached as
+// cpu.profiler. Instructions run inside Jit blocks are only counted in total.
+class Profiler {
+public:
+  explicit Profiler(size_t memSize);
+
+  // instruction is called for every interpreted instruction before it runs
+  void instruction(const Chip8 &cpu, const Instruction &instr, uint16_t pc);
+  void jitRan(uint64_t instructions) { JitInstructions += instructions; }
+  void step(StepEnd end, uint64_t nanos, uint64_t instructions);
+
+  // writeJson exports every counter, writeFolded the instructions spent in
+  // each CALL stack as flamegraph.pl folded stacks
+  bool writeJson(std::ostream &out) const;
+  bool writeFolded(std::ostream &out) const;
+
+  struct StepStats {
+    uint64_t Calls = 0;
+    uint64_t Nanos = 0;
+    uint64_t Instructions = 0;
+  };
+
+  uint64_t Kinds[K_COUNT] = {}; // executions per decoded instruction
+  std::vector<uint64_t> Heat;   // executions per address
+  uint64_t JitInstructions = 0;
+  StepStats Steps[STEP_END_COUNT];
+  uint64_t StepNanos[PROFILER_BUCKETS] = {}; // bucket i is [2^i, 2^(i+1)) ns
+
+private:
+  // Frame is a node of the call tree, the root is the code outside any CALL
+  struct Frame {
+    uint16_t Entry;
+    uint32_t Parent;
+    uint64_t Self = 0; // instructions run in this frame itself
+    std::map<uint16_t, uint32_t> Children;
+  };
+  uint32_t child(uint32_t parent, uint16_t entry);
+  // resync rebuilds the current frame from the CPU stack, after a restore or
+  // a stack error the tree and the stack disagree
+  void resync(const Chip8 &cpu);
+  std::string path(uint32_t frame) const;
+
+  std::vector<Frame> frames;
+  uint32_t current = 0;
+  uint8_t depth = 0;
+};
+
+#endif // PROFILER_HPP
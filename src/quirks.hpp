@@ -0,0 +1,53 @@
+#ifndef QUIRKS_HPP
+#define QUIRKS_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Profile picks the instruction set and the behaviour of the instructions
+// interpreters historically disagreed on
+enum class Profile : uint8_t {
+  Chip8,  // devernay's reference, what this emulator always ran
+  Cosmac, // the original COSMAC VIP interpreter
+  SChip,  // SUPER-CHIP 1.1 as modern SCHIP ROMs expect it
+  XOChip, // Octo's XO-CHIP
+};
+const size_t PROFILE_COUNT = 4;
+
+// Quirks is one row of the profile table, fixed when a Chip8 is constructed
+struct Quirks {
+  const char *Name;
+  bool SChip;         // hi-res, scrolling, 16x16 sprites, big font, RPL flags
+  bool XOChip;        // bit-planes, F000 nnnn, register ranges, audio pattern
+  bool ShiftVy;       // 8xy6/8xyE shift Vy into Vx instead of Vx in place
+  bool LoadStoreIncI; // Fx55/Fx65 leave I one past the last register
+  bool JumpVx;        // Bxnn jumps to xnn + Vx instead of nnn + V0
+  bool DisplayWait;   // DRW waits for the next timer tick
+  size_t MemorySize;
+};
+
+// clang-format off
+constexpr Quirks PROFILES[PROFILE_COUNT] = {
+  // name      schip  xochip shiftVy incI   jumpVx wait   memory
+  {"chip8",    false, false, false,  false, false, false, 4096},
+  {"cosmac",   false, false, true,   true,  false, true,  4096},
+  {"schip",    true,  false, false,  false, true,  false, 4096},
+  {"xochip",   true,  true,  true,   true,  false, false, 65536},
+};
+// clang-format on
+
+constexpr const Quirks &quirksOf(Profile p) { return PROFILES[size_t(p)]; }
+
+// parseProfile looks a profile up by its name in the table
+inline bool parseProfile(const std::string &name, Profile *p) {
+  for (size_t i = 0; i < PROFILE_COUNT; i++) {
+    if (name == PROFILES[i].Name) {
+      *p = Profile(i);
+      return true;
+    }
+  }
+  return false;
+}
+
+#endif // QUIRKS_HPP
@@ -0,0 +1,207 @@
+#include "replay.hpp"
+
+#include <algorithm>
+#include <cinttypes>
+#include <climits>
+#include <cstdio>
+#include <sstream>
+
+// version 2 moved the fonts, checkpoints of version 1 no longer hold
+static const char *REPLAY_HEADER = "chip8-replay 2";
+
+// mix adds the low bytes of val to the FNV-1a hash h
+static void mix(uint64_t *h, uint64_t val, size_t bytes) {
+  for (size_t i = 0; i < bytes; i++) {
+    *h ^= (val >> (8 * i)) & 0xFF;
+    *h *= 0x100000001b3ULL;
+  }
+}
+
+uint64_t stateHash(const Chip8 &cpu) {
+  uint64_t h = 0xcbf29ce484222325ULL;
+  mix(&h, cpu.FrameBuffer.hash(), 8);
+  for (auto v : cpu.V) {
+    mix(&h, v, 1);
+  }
+  mix(&h, cpu.I, 2);
+  mix(&h, cpu.PC, 2);
+  mix(&h, cpu.SP, 1);
+  mix(&h, cpu.DT, 1);
+  mix(&h, cpu.ST, 1);
+  mix(&h, cpu.SEED, 2);
+  for (auto addr : cpu.Stack) {
+    mix(&h, addr, 2);
+  }
+  // state only the extended instruction sets have
+  if (cpu.quirks().SChip) {
+    for (auto flag : cpu.RPL) {
+      mix(&h, flag, 1);
+    }
+  }
+  if (cpu.quirks().XOChip) {
+    for (auto sample : cpu.Pattern) {
+      mix(&h, sample, 1);
+    }
+    mix(&h, cpu.Pitch, 1);
+  }
+  return h;
+}
+
+Recorder::Recorder(uint64_t checkTicks) : checkTicks(checkTicks) {}
+
+void Recorder::start(const Chip8 &cpu) {
+  rec = Recording{};
+  rec.Prof = cpu.profile();
+  rec.Seed = cpu.SEED;
+  ticks = 0;
+}
+
+void Recorder::sendInput(Chip8 &cpu, uint8_t key, bool value) {
+  rec.Events.push_back({cpu.InstrCount,
+                        value ? ReplayOp::KeyDown : ReplayOp::KeyUp,
+                        uint64_t(key & 0xF)});
+  cpu.sendInput(key, value);
+}
+
+void Recorder::fixedUpdate(Chip8 &cpu) {
+  rec.Events.push_back({cpu.InstrCount, ReplayOp::Tick, 0});
+  cpu.fixedUpdate();
+  if (checkTicks > 0 && ++ticks % checkTicks == 0) {
+    rec.Events.push_back({cpu.InstrCount, ReplayOp::Check, stateHash(cpu)});
+  }
+}
+
+ReplayResult replay(const Recording &rec, Chip8 &cpu) {
+  ReplayResult result;
+  if (cpu.profile() != rec.Prof) {
+    result.Error = std::string("recorded with profile ") +
+                   quirksOf(rec.Prof).Name + ", replaying with " +
+                   cpu.quirks().Name;
+    return result;
+  }
+  cpu.seed(rec.Seed);
+  char buf[128];
+  for (const auto &event : rec.Events) {
+    while (cpu.InstrCount < event.At) {
+      if (cpu.Paused || cpu.WaitTick) {
+        // waiting for a key the recording pressed later or a tick it had
+        // later, the run diverged
+        snprintf(buf, sizeof(buf),
+                 "waiting for a %s at %" PRIu64 ", next event at %" PRIu64,
+                 cpu.Paused ? "key" : "tick", cpu.InstrCount, event.At);
+        result.Error = buf;
+        result.At = cpu.InstrCount;
+        return result;
+      }
+      cpu.step(std::min<uint64_t>(event.At - cpu.InstrCount, INT_MAX));
+    }
+    if (cpu.InstrCount > event.At) {
+      snprintf(buf, sizeof(buf), "ran past event at %" PRIu64, event.At);
+      result.Error = buf;
+      result.At = cpu.InstrCount;
+      return result;
+    }
+    switch (event.Op) {
+    case ReplayOp::KeyDown:
+    case ReplayOp::KeyUp:
+      cpu.sendInput(event.Value, event.Op == ReplayOp::KeyDown);
+      break;
+    case ReplayOp::Tick:
+      cpu.fixedUpdate();
+      break;
+    case ReplayOp::Check: {
+      const uint64_t hash = stateHash(cpu);
+      if (hash != event.Value) {
+        snprintf(buf, sizeof(buf),
+                 "state hash %016" PRIx64 " expected %016" PRIx64
+                 " at %" PRIu64,
+                 hash, event.Value, event.At);
+        result.Error = buf;
+        result.At = event.At;
+        return result;
+      }
+      result.Checks++;
+      break;
+    }
+    }
+  }
+  result.Ok = true;
+  result.At = cpu.InstrCount;
+  return result;
+}
+
+bool writeRecording(std::ostream &out, const Recording &rec) {
+  out << REPLAY_HEADER << "\n";
+  out << "seed " << rec.Seed << "\n";
+  out << "profile " << quirksOf(rec.Prof).Name << "\n";
+  for (const auto &event : rec.Events) {
+    out << event.At << " ";
+    switch (event.Op) {
+    case ReplayOp::KeyDown:
+      out << "down " << std::hex << event.Value << std::dec;
+      break;
+    case ReplayOp::KeyUp:
+      out << "up " << std::hex << event.Value << std::dec;
+      break;
+    case ReplayOp::Tick:
+      out << "tick";
+      break;
+    case ReplayOp::Check:
+      out << "check " << std::hex << event.Value << std::dec;
+      break;
+    }
+    out << "\n";
+  }
+  return bool(out);
+}
+
+bool readRecording(std::istream &in, Recording *rec, std::string *error) {
+  std::string line;
+  auto fail = [&](const std::string &why) {
+    if (error != nullptr) {
+      *error = why;
+    }
+    return false;
+  };
+  if (!std::getline(in, line) || line != REPLAY_HEADER) {
+    return fail(line.compare(0, 13, "chip8-replay ") == 0
+                    ? line + " is an unsupported format, record it again"
+                    : "not a recording");
+  }
+  std::string word;
+  unsigned seed;
+  if (!std::getline(in, line) ||
+      !(std::istringstream(line) >> word >> seed) || word != "seed") {
+    return fail("no seed line");
+  }
+  rec->Seed = seed;
+  std::string name;
+  if (!std::getline(in, line) ||
+      !(std::istringstream(line) >> word >> name) || word != "profile" ||
+      !parseProfile(name, &rec->Prof)) {
+    return fail("no profile line");
+  }
+  rec->Events.clear();
+  while (std::getline(in, line)) {
+    if (line.empty()) {
+      continue;
+    }
+    std::istringstream fields(line);
+    ReplayEvent event{0, ReplayOp::Tick, 0};
+    if (!(fields >> event.At >> word)) {
+      return fail("bad line: " + line);
+    }
+    if (word == "down" || word == "up" || word == "check") {
+      if (!(fields >> std::hex >> event.Value)) {
+        return fail("bad line: " + line);
+      }
+      event.Op = (word == "down") ? ReplayOp::KeyDown
+                 : (word == "up") ? ReplayOp::KeyUp
+                                  : ReplayOp::Check;
+    } else if (word != "tick") {
+      return fail("bad line: " + line);
+    }
+    rec->Events.push_back(event);
+  }
+  return true;
+}
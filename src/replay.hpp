@@ -0,0 +1,83 @@
+#ifndef REPLAY_HPP
+#define REPLAY_HPP
+
+#include "chip8.hpp"
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// ticks between checkpoints while recording, 1 second at 60 Hz
+const uint64_t REPLAY_CHECK_TICKS = 60;
+
+enum class ReplayOp : uint8_t {
+  KeyDown, // Value is the key
+  KeyUp,   // Value is the key
+  Tick,    // fixedUpdate
+  Check,   // Value is stateHash at this point
+};
+
+// ReplayEvent happens once the CPU executed At instructions
+struct ReplayEvent {
+  uint64_t At;
+  ReplayOp Op;
+  uint64_t Value;
+};
+
+// Recording is everything needed to run a session again on the same ROM,
+// the profile and seed it started from and every event in order
+struct Recording {
+  Profile Prof = Profile::Chip8;
+  uint16_t Seed = DEFAULT_SEED;
+  std::vector<ReplayEvent> Events;
+};
+
+// stateHash covers the framebuffer and every register, checkpoints compare
+// it to find where a replay went its own way
+uint64_t stateHash(const Chip8 &cpu);
+
+// Recorder sits between the frontend and the CPU and logs what it forwards
+class Recorder {
+public:
+  explicit Recorder(uint64_t checkTicks = REPLAY_CHECK_TICKS);
+
+  // start begins a new recording from the current state of cpu, which should
+  // be freshly constructed with the ROM loaded and seeded
+  void start(const Chip8 &cpu);
+  void sendInput(Chip8 &cpu, uint8_t key, bool value);
+  // fixedUpdate ticks the timers, every checkTicks ticks it adds a checkpoint
+  void fixedUpdate(Chip8 &cpu);
+
+  const Recording &recording() const { return rec; }
+
+private:
+  uint64_t checkTicks;
+  uint64_t ticks = 0;
+  Recording rec;
+};
+
+struct ReplayResult {
+  bool Ok = false;
+  std::string Error;
+  uint64_t At = 0;     // instruction count the replay stopped at
+  uint64_t Checks = 0; // checkpoints that matched
+};
+
+// replay runs rec headless on cpu, freshly constructed with the same ROM, and
+// stops at the first checkpoint that does not match
+ReplayResult replay(const Recording &rec, Chip8 &cpu);
+
+// Recordings are stored as text:
+//   chip8-replay 2
+//   seed <n>
+//   profile <name>
+//   <instructions> down|up <hex key>
+//   <instructions> tick
+//   <instructions> check <hex hash>
+bool writeRecording(std::ostream &out, const Recording &rec);
+// readRecording says why it failed in error when one is given
+bool readRecording(std::istream &in, Recording *rec,
+                   std::string *error = nullptr);
+
+#endif // REPLAY_HPP
@@ -0,0 +1,82 @@
+#include "replay.hpp"
+#include "rom.hpp"
+
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+
+static void usage(const char *name) {
+  fprintf(stderr,
+          "usage: %s [-e table|threaded|jit] rom recording\n"
+          "\n"
+          "runs a recording made by the frontend (CHIP8_RECORD=file) headless\n"
+          "and checks every checkpoint in it\n",
+          name);
+}
+
+int main(int argc, char **argv) {
+  Engine engine = Engine::Table;
+  const char *rom = nullptr;
+  const char *recording = nullptr;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-e") == 0 && i + 1 < argc) {
+      std::string name(argv[++i]);
+      if (name == "table") {
+        engine = Engine::Table;
+      } else if (name == "threaded") {
+        engine = Engine::Threaded;
+      } else if (name == "jit") {
+        engine = Engine::Jit;
+      } else {
+        usage(argv[0]);
+        return 2;
+      }
+    } else if (rom == nullptr) {
+      rom = argv[i];
+    } else if (recording == nullptr) {
+      recording = argv[i];
+    } else {
+      usage(argv[0]);
+      return 2;
+    }
+  }
+  if (recording == nullptr) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  std::ifstream in(recording);
+  Recording rec;
+  std::string why = "cannot open";
+  if (!in || !readRecording(in, &rec, &why)) {
+    fprintf(stderr, "cannot read recording %s: %s\n", recording,
+            why.c_str());
+    return 1;
+  }
+
+  Memory mem(quirksOf(rec.Prof).MemorySize);
+  Chip8 cpu(&mem, engine, rec.Prof);
+  std::string err;
+  if (loadRom(&mem, ROM_START, rom, &err) == 0) {
+    fprintf(stderr, "cannot load rom %s: %s\n", rom, err.c_str());
+    return 1;
+  }
+
+  const auto start = std::chrono::steady_clock::now();
+  const ReplayResult result = replay(rec, cpu);
+  const double seconds =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - start)
+          .count();
+  if (!result.Ok) {
+    fprintf(stderr, "%s: %s\n", recording, result.Error.c_str());
+    return 1;
+  }
+  fprintf(stderr,
+          "%s: %" PRIu64 " checkpoints ok, %" PRIu64 " instructions in %.3fs\n",
+          recording, result.Checks, result.At, seconds);
+  return 0;
+}
@@ -0,0 +1,223 @@
+#include "rewind.hpp"
+
+#include <algorithm>
+
+// The delta format is a list of (zero run, literal length, literal bytes)
+// with both lengths as LEB128 varints. Deltas are XORs, so runs of zero are
+// the bytes that did not change.
+
+static void putVarint(std::vector<uint8_t> *out, size_t val) {
+  while (val >= 0x80) {
+    out->push_back((val & 0x7F) | 0x80);
+    val >>= 7;
+  }
+  out->push_back(val);
+}
+
+static bool getVarint(const std::vector<uint8_t> &in, size_t *pos,
+                      size_t *val) {
+  *val = 0;
+  for (size_t shift = 0; *pos < in.size() && shift < 64; shift += 7) {
+    const uint8_t byte = in[(*pos)++];
+    *val |= size_t(byte & 0x7F) << shift;
+    if ((byte & 0x80) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// encodeDelta run length encodes the n bytes of cur XOR prev, prev being
+// zeros past prevLen. A short zero run between two literals is cheaper kept
+// in the literal.
+static std::vector<uint8_t> encodeDelta(const uint8_t *cur, size_t n,
+                                        const uint8_t *prev, size_t prevLen) {
+  auto diff = [&](size_t i) -> uint8_t {
+    return cur[i] ^ (i < prevLen ? prev[i] : 0);
+  };
+  std::vector<uint8_t> out;
+  putVarint(&out, n);
+  size_t i = 0;
+  while (i < n) {
+    const size_t runStart = i;
+    while (i < n && diff(i) == 0) {
+      i++;
+    }
+    const size_t litStart = i;
+    size_t zeros = 0;
+    while (i < n && zeros < 4) {
+      zeros = (diff(i) == 0) ? zeros + 1 : 0;
+      i++;
+    }
+    const size_t litEnd = (zeros > 0) ? i - zeros : i;
+    i = litEnd;
+    putVarint(&out, litStart - runStart);
+    putVarint(&out, litEnd - litStart);
+    for (size_t j = litStart; j < litEnd; j++) {
+      out.push_back(diff(j));
+    }
+  }
+  return out;
+}
+
+// applyDelta XORs a delta into state, resizing it to the encoded length
+static bool applyDelta(const std::vector<uint8_t> &delta,
+                       std::vector<uint8_t> *state) {
+  size_t pos = 0;
+  size_t n;
+  if (!getVarint(delta, &pos, &n)) {
+    return false;
+  }
+  state->resize(n, 0);
+  size_t i = 0;
+  while (pos < delta.size()) {
+    size_t zeros, lit;
+    if (!getVarint(delta, &pos, &zeros) || !getVarint(delta, &pos, &lit) ||
+        i + zeros + lit > n || delta.size() - pos < lit) {
+      return false;
+    }
+    i += zeros;
+    for (size_t j = 0; j < lit; j++) {
+      (*state)[i++] ^= delta[pos++];
+    }
+  }
+  return true;
+}
+
+Rewind::Rewind(size_t frames, size_t keyframeInterval)
+    : capacity(std::max<size_t>(frames, 1)),
+      interval(std::max<size_t>(keyframeInterval, 1)) {}
+
+void Rewind::record(Chip8 &cpu) {
+  Snapshot snap = cpu.snapshot();
+  const std::vector<uint8_t> state = encodeSnapshotState(snap);
+  const size_t pages = snap.Pages.size();
+  if (groups.empty() || groups.back().Deltas.size() + 1 >= interval ||
+      state.size() != base.size() || pages != groups.back().Pages.size()) {
+    Group group;
+    group.Keyframe = encodeDelta(state.data(), state.size(), nullptr, 0);
+    group.Pages = snap.Pages;
+    group.Bytes = group.Keyframe.size();
+    // pages the previous keyframe holds as well are only counted there
+    for (size_t i = 0; i < pages; i++) {
+      if (groups.empty() || i >= groups.back().Pages.size() ||
+          groups.back().Pages[i] != snap.Pages[i]) {
+        group.Bytes += MEM_PAGE_SIZE;
+      }
+    }
+    used += group.Bytes;
+    groups.push_back(std::move(group));
+    base = state;
+    lastDeltas.assign(pages, nullptr);
+  } else {
+    const Group &group = groups.back();
+    Frame frame;
+    frame.State =
+        encodeDelta(state.data(), state.size(), base.data(), base.size());
+    frame.Bytes = frame.State.size();
+    if (lastPages.size() != pages) {
+      lastDeltas.assign(pages, nullptr);
+    }
+    for (size_t i = 0; i < pages; i++) {
+      PageDelta delta;
+      if (snap.Pages[i] == group.Pages[i]) {
+        // not written since the keyframe
+      } else if (lastDeltas[i] && snap.Pages[i] == lastPages[i]) {
+        delta = lastDeltas[i];
+      } else {
+        delta = std::make_shared<const std::vector<uint8_t>>(
+            encodeDelta(snap.Pages[i]->data(), MEM_PAGE_SIZE,
+                        group.Pages[i]->data(), MEM_PAGE_SIZE));
+        frame.Bytes += delta->size();
+      }
+      if (delta) {
+        frame.Pages.emplace_back(i, delta);
+      }
+      lastDeltas[i] = std::move(delta);
+    }
+    used += frame.Bytes;
+    groups.back().Deltas.push_back(std::move(frame));
+  }
+  lastPages = std::move(snap.Pages);
+  count++;
+  while (count - (groups.front().Deltas.size() + 1) >= capacity) {
+    dropOldest();
+  }
+}
+
+bool Rewind::seek(Chip8 &cpu, size_t ago) const {
+  if (ago >= count) {
+    return false;
+  }
+  // walk back from the newest group, each holds its keyframe and deltas
+  size_t g = groups.size() - 1;
+  while (ago > groups[g].Deltas.size()) {
+    ago -= groups[g].Deltas.size() + 1;
+    g--;
+  }
+  const Group &group = groups[g];
+  std::vector<uint8_t> state;
+  if (!applyDelta(group.Keyframe, &state)) {
+    return false;
+  }
+  Snapshot s;
+  s.Pages = group.Pages;
+  const size_t frame = group.Deltas.size() - ago; // 0 is the keyframe
+  if (frame > 0) {
+    const Frame &delta = group.Deltas[frame - 1];
+    if (!applyDelta(delta.State, &state)) {
+      return false;
+    }
+    for (const auto &page : delta.Pages) {
+      const MemoryPage &key = *group.Pages[page.first];
+      std::vector<uint8_t> bytes(key.begin(), key.end());
+      if (!applyDelta(*page.second, &bytes) || bytes.size() != key.size()) {
+        return false;
+      }
+      auto copy = std::make_shared<MemoryPage>();
+      std::copy(bytes.begin(), bytes.end(), copy->begin());
+      s.Pages[page.first] = copy;
+    }
+  }
+  return decodeSnapshotState(state, &s) && cpu.restore(s);
+}
+
+bool Rewind::back(Chip8 &cpu) {
+  if (count < 2) {
+    return false;
+  }
+  Group &group = groups.back();
+  if (group.Deltas.empty()) {
+    used -= group.Bytes;
+    groups.pop_back();
+    base.clear();
+    applyDelta(groups.back().Keyframe, &base);
+  } else {
+    used -= group.Deltas.back().Bytes;
+    group.Deltas.pop_back();
+  }
+  // the frame the next record compares against is gone
+  lastPages.clear();
+  lastDeltas.clear();
+  count--;
+  return seek(cpu, 0);
+}
+
+void Rewind::clear() {
+  groups.clear();
+  base.clear();
+  lastPages.clear();
+  lastDeltas.clear();
+  count = 0;
+  used = 0;
+}
+
+void Rewind::dropOldest() {
+  Group &group = groups.front();
+  used -= group.Bytes;
+  for (auto &delta : group.Deltas) {
+    used -= delta.Bytes;
+  }
+  count -= group.Deltas.size() + 1;
+  groups.pop_front();
+}
@@ -0,0 +1,74 @@
+#ifndef REWIND_HPP
+#define REWIND_HPP
+
+#include "chip8.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <utility>
+#include <vector>
+
+// five minutes of 60 Hz frames
+const size_t REWIND_DEFAULT_FRAMES = 5 * 60 * 60;
+const size_t REWIND_KEYFRAME_INTERVAL = 60;
+
+// Rewind keeps a history of frames to step back through. A frame is the
+// registers and screen (snapshot.hpp without the memory) XORed against the
+// last keyframe and run length encoded, plus the memory pages that differ
+// from the keyframe's. Pages come from Chip8::snapshot, which only copies the
+// ones written since the last call, so a page nobody wrote costs a pointer
+// compare and a page left alone since the previous frame reuses its delta.
+// A full keyframe starts a new group every keyframeInterval frames, going back
+// to any frame decodes one keyframe and one delta. The oldest group is dropped
+// as long as the history still holds frames frames without it.
+class Rewind {
+public:
+  Rewind(size_t frames = REWIND_DEFAULT_FRAMES,
+         size_t keyframeInterval = REWIND_KEYFRAME_INTERVAL);
+
+  // record stores the state at the end of a frame, call it next to every
+  // Chip8::fixedUpdate
+  void record(Chip8 &cpu);
+  // seek restores the frame ago frames before the newest, 0 being the newest,
+  // and keeps the history, returns false when it does not go back that far
+  bool seek(Chip8 &cpu, size_t ago) const;
+  // back drops the newest frame and restores the one before it
+  bool back(Chip8 &cpu);
+  void clear();
+
+  size_t frames() const { return count; }
+  // bytes is roughly what the history holds: the encoded deltas and the
+  // keyframe pages not shared with the keyframe before
+  size_t bytes() const { return used; }
+
+private:
+  // PageDelta is one page XORed against the keyframe's and run length
+  // encoded, shared by the frames the page did not change in
+  using PageDelta = std::shared_ptr<const std::vector<uint8_t>>;
+  struct Frame {
+    std::vector<uint8_t> State; // against the keyframe's state
+    std::vector<std::pair<size_t, PageDelta>> Pages; // by page, if changed
+    size_t Bytes = 0; // what this frame added to used
+  };
+  struct Group {
+    std::vector<uint8_t> Keyframe; // RLE of the encoded state
+    std::vector<SharedPage> Pages; // memory at the keyframe
+    std::vector<Frame> Deltas;
+    size_t Bytes = 0;
+  };
+
+  void dropOldest();
+
+  size_t capacity;
+  size_t interval;
+  std::deque<Group> groups;
+  std::vector<uint8_t> base; // decoded keyframe state of the newest group
+  // pages of the newest frame and their deltas, null where unchanged
+  std::vector<SharedPage> lastPages;
+  std::vector<PageDelta> lastDeltas;
+  size_t count = 0;
+  size_t used = 0;
+};
+
+#endif // REWIND_HPP
@@ -0,0 +1,68 @@
+#include "rom.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+RomFile::RomFile(const std::string &filename) {
+  const int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    err = strerror(errno);
+    return;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    err = strerror(errno);
+  } else if (!S_ISREG(st.st_mode)) {
+    err = "not a regular file";
+  } else if (st.st_size == 0) {
+    err = "empty file";
+  } else {
+    void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p == MAP_FAILED) {
+      err = strerror(errno);
+    } else {
+      bytes = static_cast<const uint8_t *>(p);
+      len = st.st_size;
+    }
+  }
+  // the mapping outlives the descriptor
+  close(fd);
+}
+
+RomFile::~RomFile() {
+  if (bytes != nullptr) {
+    munmap(const_cast<uint8_t *>(bytes), len);
+  }
+}
+
+size_t loadRom(Memory *mem, uint16_t starting_address, std::string filename,
+               std::string *err) {
+  RomFile rom(filename);
+  return loadRom(mem, starting_address, rom, err);
+}
+
+size_t loadRom(Memory *mem, uint16_t starting_address, const RomFile &rom,
+               std::string *err) {
+  if (!rom.ok()) {
+    if (err != nullptr) {
+      *err = rom.error();
+    }
+    return 0;
+  }
+  // a ROM too large for the profile's memory would wrap over the font
+  const size_t room =
+      starting_address < mem->size() ? mem->size() - starting_address : 0;
+  if (rom.size() > room) {
+    if (err != nullptr) {
+      *err = "rom is " + std::to_string(rom.size()) + " bytes, only " +
+             std::to_string(room) + " fit in memory";
+    }
+    return 0;
+  }
+  mem->write(starting_address, rom.data(), rom.size());
+  return rom.size();
+}
@@ -0,0 +1,40 @@
+#ifndef ROM_HPP
+#define ROM_HPP
+
+#include "memory.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+const uint16_t ROM_START = 0x200;
+
+// RomFile maps a ROM read only, data stays valid for as long as it is open
+class RomFile {
+public:
+  explicit RomFile(const std::string &filename);
+  ~RomFile();
+  RomFile(const RomFile &) = delete;
+  RomFile &operator=(const RomFile &) = delete;
+
+  bool ok() const { return bytes != nullptr; }
+  // error says why the file could not be mapped
+  const std::string &error() const { return err; }
+  const uint8_t *data() const { return bytes; }
+  size_t size() const { return len; }
+
+private:
+  const uint8_t *bytes = nullptr;
+  size_t len = 0;
+  std::string err;
+};
+
+// loadRom copies the file into memory starting at starting_address and
+// returns the number of bytes read. Files that cannot be read, are empty or
+// do not fit between starting_address and the end of memory load nothing and
+// return 0, with the reason in err if it is given.
+size_t loadRom(Memory *mem, uint16_t starting_address, std::string filename,
+               std::string *err = nullptr);
+size_t loadRom(Memory *mem, uint16_t starting_address, const RomFile &rom,
+               std::string *err = nullptr);
+
+#endif // ROM_HPP
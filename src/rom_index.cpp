@@ -0,0 +1,190 @@
+#include "rom_index.hpp"
+#include "analyser.hpp"
+#include "rom.hpp"
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <dirent.h>
+#include <map>
+#include <sstream>
+#include <sys/stat.h>
+
+static const char *ROM_INDEX_HEADER = "chip8-romindex 1";
+
+// ROM_EXTENSIONS are the files indexRoms picks up, with the least profile
+// the extension promises
+static const struct {
+  const char *Ext;
+  Profile Prof;
+} ROM_EXTENSIONS[] = {
+    {".ch8", Profile::Chip8},
+    {".c8", Profile::Chip8},
+    {".sc8", Profile::SChip},
+    {".xo8", Profile::XOChip},
+};
+
+static bool endsWith(const std::string &s, const std::string &suffix) {
+  return s.size() >= suffix.size() &&
+         s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+uint64_t romHash(const uint8_t *rom, size_t len) {
+  uint64_t h = 0xcbf29ce484222325ULL;
+  for (size_t i = 0; i < len; i++) {
+    h ^= rom[i];
+    h *= 0x100000001b3ULL;
+  }
+  return h;
+}
+
+Profile detectProfile(const uint8_t *rom, size_t len) {
+  if (len > quirksOf(Profile::SChip).MemorySize - ROM_START) {
+    return Profile::XOChip;
+  }
+  // only instructions on a path from the entry point count, sprite data that
+  // happens to look like an SCHIP instruction is not taken for one
+  const Quirks &all = quirksOf(Profile::XOChip);
+  const Analysis a = analyseRom(rom, len, all);
+  bool schip = false;
+  for (size_t off = 0; off < len; off++) {
+    if (a.Bytes[off] != RomByte::Code) {
+      continue;
+    }
+    switch (decodeKind(rom[off], rom[off + 1], all)) {
+    case K_SCU:
+    case K_SAVER:
+    case K_LOADR:
+    case K_LDIL:
+    case K_PLANE:
+    case K_AUDIO:
+    case K_PITCH:
+      return Profile::XOChip;
+    case K_SCD:
+    case K_SCR:
+    case K_SCL:
+    case K_EXIT:
+    case K_LOW:
+    case K_HIGH:
+    case K_LDHF:
+    case K_SRPL:
+    case K_LRPL:
+      schip = true;
+      break;
+    case K_DRW:
+      schip |= (rom[off + 1] & 0xF) == 0;
+      break;
+    default:
+      break;
+    }
+  }
+  return schip ? Profile::SChip : Profile::Chip8;
+}
+
+std::string romTitle(const std::string &filename) {
+  std::string title = filename.substr(filename.find_last_of('/') + 1);
+  const size_t dot = title.find_last_of('.');
+  if (dot != std::string::npos && dot > 0) {
+    title.erase(dot);
+  }
+  std::replace(title.begin(), title.end(), '_', ' ');
+  return title;
+}
+
+std::vector<RomInfo> indexRoms(const std::string &dir,
+                               const std::vector<RomInfo> &previous,
+                               size_t *read) {
+  std::map<std::string, const RomInfo *> known;
+  for (const auto &info : previous) {
+    known[info.Path] = &info;
+  }
+  std::vector<RomInfo> roms;
+  DIR *d = opendir(dir.c_str());
+  if (d == nullptr) {
+    return roms;
+  }
+  while (auto entry = readdir(d)) {
+    const std::string name(entry->d_name);
+    Profile least = Profile::Chip8;
+    bool isRom = false;
+    for (const auto &ext : ROM_EXTENSIONS) {
+      if (endsWith(name, ext.Ext)) {
+        least = ext.Prof;
+        isRom = true;
+      }
+    }
+    struct stat st;
+    const std::string path = dir + "/" + name;
+    if (!isRom || stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+      continue;
+    }
+    auto it = known.find(name);
+    if (it != known.end() && it->second->Size == uint64_t(st.st_size) &&
+        it->second->MTime == int64_t(st.st_mtime)) {
+      roms.push_back(*it->second);
+      continue;
+    }
+    RomFile rom(path);
+    if (!rom.ok()) {
+      continue;
+    }
+    RomInfo info;
+    info.Path = name;
+    info.Size = rom.size();
+    info.MTime = st.st_mtime;
+    info.Hash = romHash(rom.data(), rom.size());
+    info.Prof = std::max(least, detectProfile(rom.data(), rom.size()));
+    info.Title = romTitle(name);
+    roms.push_back(info);
+    if (read != nullptr) {
+      (*read)++;
+    }
+  }
+  closedir(d);
+  std::sort(roms.begin(), roms.end(),
+            [](const RomInfo &a, const RomInfo &b) { return a.Path < b.Path; });
+  return roms;
+}
+
+bool writeRomIndex(std::ostream &out, const std::vector<RomInfo> &roms) {
+  out << ROM_INDEX_HEADER << "\n";
+  for (const auto &info : roms) {
+    char hash[17];
+    snprintf(hash, sizeof(hash), "%016" PRIx64, info.Hash);
+    out << hash << "\t" << info.Size << "\t" << info.MTime << "\t"
+        << quirksOf(info.Prof).Name << "\t" << info.Path << "\t" << info.Title
+        << "\n";
+  }
+  return bool(out);
+}
+
+bool readRomIndex(std::istream &in, std::vector<RomInfo> *roms) {
+  std::string line;
+  if (!std::getline(in, line) || line != ROM_INDEX_HEADER) {
+    return false;
+  }
+  roms->clear();
+  while (std::getline(in, line)) {
+    if (line.empty()) {
+      continue;
+    }
+    std::vector<std::string> fields;
+    std::istringstream split(line);
+    std::string field;
+    while (std::getline(split, field, '\t')) {
+      fields.push_back(field);
+    }
+    RomInfo info;
+    if (fields.size() != 6 ||
+        !(std::istringstream(fields[0]) >> std::hex >> info.Hash) ||
+        !(std::istringstream(fields[1]) >> info.Size) ||
+        !(std::istringstream(fields[2]) >> info.MTime) ||
+        !parseProfile(fields[3], &info.Prof)) {
+      return false;
+    }
+    info.Path = fields[4];
+    info.Title = fields[5];
+    roms->push_back(info);
+  }
+  return true;
+}
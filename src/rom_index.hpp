@@ -0,0 +1,48 @@
+#ifndef ROM_INDEX_HPP
+#define ROM_INDEX_HPP
+
+#include "quirks.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// ROM_INDEX_NAME is where chip-8-index keeps the index of a ROM directory
+const char *const ROM_INDEX_NAME = ".chip8-index";
+
+// RomInfo is one ROM of a library index, enough to pick and start it without
+// opening the file
+struct RomInfo {
+  std::string Path; // relative to the indexed directory
+  uint64_t Size = 0;
+  int64_t MTime = 0; // seconds, a changed size or time means rereading it
+  uint64_t Hash = 0; // FNV-1a of the contents
+  Profile Prof = Profile::Chip8;
+  std::string Title;
+};
+
+// romHash is FNV-1a over the ROM
+uint64_t romHash(const uint8_t *rom, size_t len);
+// detectProfile guesses the profile a ROM needs from its size and the
+// instructions analyseRom finds reachable, it never picks cosmac
+Profile detectProfile(const uint8_t *rom, size_t len);
+// romTitle turns a file name into a title, "space_invaders.ch8" becomes
+// "space invaders"
+std::string romTitle(const std::string &filename);
+
+// indexRoms lists the ROM files (.ch8 .c8 .sc8 .xo8) in dir sorted by path.
+// Entries of previous whose size and modification time still match are
+// reused without reading the file, read counts the files that were read.
+std::vector<RomInfo> indexRoms(const std::string &dir,
+                               const std::vector<RomInfo> &previous = {},
+                               size_t *read = nullptr);
+
+// Indexes are stored as text, one tab separated line per ROM:
+//   chip8-romindex 1
+//   <hex hash> <size> <mtime> <profile> <path> <title>
+bool writeRomIndex(std::ostream &out, const std::vector<RomInfo> &roms);
+bool readRomIndex(std::istream &in, std::vector<RomInfo> *roms);
+
+#endif // ROM_INDEX_HPP
@@ -0,0 +1,78 @@
+#include "scheduler.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <climits>
+
+Scheduler::Scheduler(uint64_t ips)
+    : rate(std::max<uint64_t>(ips, 1)),
+      tick([](Chip8 &cpu) { cpu.fixedUpdate(); }) {}
+
+void Scheduler::setIps(uint64_t ips) {
+  // ticks from here on are spaced for the new rate
+  rate = std::max<uint64_t>(ips, 1);
+  baseCycle = Cycles;
+  baseTick = Ticks;
+  owed = 0;
+}
+
+void Scheduler::reset() {
+  Cycles = 0;
+  Ticks = 0;
+  baseCycle = 0;
+  baseTick = 0;
+  owed = 0;
+}
+
+void Scheduler::advance(Chip8 &cpu, uint64_t cycles) {
+  const uint64_t target = Cycles + cycles;
+  while (Cycles < target) {
+    const uint64_t next = tickAt(Ticks + 1);
+    const uint64_t until = std::min(target, next);
+    while (Cycles < until) {
+      const uint64_t before = cpu.InstrCount;
+      if (!cpu.Paused) {
+        cpu.step(std::min<uint64_t>(until - Cycles, INT_MAX));
+      }
+      if (cpu.InstrCount == before) {
+        // waiting for a key, time passes without instructions
+        Cycles = until;
+        break;
+      }
+      Cycles += cpu.InstrCount - before;
+      if (sync) {
+        sync(cpu, Cycles);
+      }
+    }
+    if (Cycles == next) {
+      tick(cpu);
+      Ticks++;
+      if (sync) {
+        sync(cpu, Cycles);
+      }
+      if (frame) {
+        frame(cpu);
+      }
+    }
+  }
+}
+
+void Scheduler::run(Chip8 &cpu, double seconds) {
+  seconds = std::min(std::max(seconds, 0.0), SCHEDULER_MAX_CATCH_UP);
+  if (!turbo) {
+    owed += seconds * rate;
+    const uint64_t cycles = owed;
+    owed -= cycles;
+    advance(cpu, cycles);
+    return;
+  }
+  // turbo, run a frame worth of cycles at a time until the time is used up
+  using Clock = std::chrono::steady_clock;
+  const auto end =
+      Clock::now() + std::chrono::duration_cast<Clock::duration>(
+                         std::chrono::duration<double>(seconds));
+  const uint64_t chunk = std::max<uint64_t>(rate / TIMER_HZ, 1);
+  do {
+    advance(cpu, chunk);
+  } while (Clock::now() < end);
+}
@@ -0,0 +1,70 @@
+#ifndef SCHEDULER_HPP
+#define SCHEDULER_HPP
+
+#include "chip8.hpp"
+#include <cstdint>
+#include <functional>
+
+const uint64_t DEFAULT_IPS = 700;
+const uint64_t TIMER_HZ = 60;
+// longest stretch of host time run catches up on, after a stall the
+// emulation slows down rather than running a burst
+const double SCHEDULER_MAX_CATCH_UP = 0.25;
+
+// Scheduler clocks the CPU at a fixed number of instructions per second and
+// ticks DT and ST on the 60 Hz boundaries of its cycle count, so both run at
+// the same speed however often step returns and whatever the display does.
+// The clock keeps running while the CPU waits for a key, the timers do too.
+class Scheduler {
+public:
+  using TickFn = std::function<void(Chip8 &)>;
+  using SyncFn = std::function<void(const Chip8 &, uint64_t cycle)>;
+  using FrameFn = std::function<void(const Chip8 &)>;
+
+  explicit Scheduler(uint64_t ips = DEFAULT_IPS);
+
+  // onTick replaces what a timer tick does, Chip8::fixedUpdate by default,
+  // for frontends that record or rewind on every tick
+  void onTick(TickFn fn) { tick = std::move(fn); }
+  // onSync is called after every step and every tick with the cycle they
+  // ended on, for what follows the machine in emulated time like Audio
+  void onSync(SyncFn fn) { sync = std::move(fn); }
+  // onFrame is called once a timer tick and its onSync ran, with the machine
+  // on the 60 Hz boundary, a frame the program finished. CpuThread publishes
+  // from it while it runs.
+  void onFrame(FrameFn fn) { frame = std::move(fn); }
+  void setIps(uint64_t ips);
+  uint64_t ips() const { return rate; }
+  // turbo runs as many cycles as fit in the host time given to run
+  void setTurbo(bool on) { turbo = on; }
+  bool turboOn() const { return turbo; }
+
+  // run emulates seconds of host time, at the configured rate or in turbo
+  // for as long as that takes on the host
+  void run(Chip8 &cpu, double seconds);
+  // advance runs exactly cycles cycles, ticking timers on the way
+  void advance(Chip8 &cpu, uint64_t cycles);
+  // reset restarts the clock for a new program, rate and turbo stay
+  void reset();
+
+  uint64_t Cycles = 0; // cycles since construction, paused ones included
+  uint64_t Ticks = 0;  // timer ticks since construction
+
+private:
+  // tickAt is the cycle timer tick n happens on, counted from the last rate
+  // change
+  uint64_t tickAt(uint64_t n) const {
+    return baseCycle + ((n - baseTick) * rate + TIMER_HZ - 1) / TIMER_HZ;
+  }
+
+  uint64_t rate;
+  uint64_t baseCycle = 0;
+  uint64_t baseTick = 0;
+  bool turbo = false;
+  double owed = 0; // cycles run still owes, below one
+  TickFn tick;
+  SyncFn sync;
+  FrameFn frame;
+};
+
+#endif // SCHEDULER_HPP
@@ -0,0 +1,191 @@
+#include "screen.hpp"
+
+#include <cstring>
+
+Screen::Screen() {
+  memset(Plane2, 0, sizeof(Plane2));
+  clear();
+}
+
+void Screen::clear() {
+  for (int p = 0; p < 2; p++) {
+    if (Planes & (1 << p)) {
+      memset(*plane(p), 0, sizeof(Rows));
+    }
+  }
+  Damage = ALL_ROWS;
+}
+
+void Screen::copyFrom(const Screen &other) {
+  uint64_t damage = Damage;
+  if (Hires != other.Hires) {
+    damage = ALL_ROWS;
+  }
+  for (size_t y = 0; y < WIN_SIZE_Y; y++) {
+    if (memcmp(Rows[y], other.Rows[y], sizeof(Rows[y])) != 0 ||
+        memcmp(Plane2[y], other.Plane2[y], sizeof(Plane2[y])) != 0) {
+      damage |= uint64_t(1) << y;
+    }
+  }
+  *this = other;
+  Damage = damage;
+}
+
+void Screen::setHires(bool on) {
+  Hires = on;
+  memset(Rows, 0, sizeof(Rows));
+  memset(Plane2, 0, sizeof(Plane2));
+  Damage = ALL_ROWS;
+}
+
+// placeRow rotates a row that starts at pixel 0 right by x pixels, pixels
+// pushed past the right edge come back in on the left
+static inline void placeRow(uint64_t row[ROW_WORDS], size_t x) {
+  if (x >= 64) {
+    uint64_t tmp = row[0];
+    row[0] = row[1];
+    row[1] = tmp;
+    x -= 64;
+  }
+  if (x != 0) {
+    const uint64_t w0 = row[0];
+    const uint64_t w1 = row[1];
+    row[0] = (w0 >> x) | (w1 << (64 - x));
+    row[1] = (w1 >> x) | (w0 << (64 - x));
+  }
+}
+
+bool Screen::draw(size_t x, size_t y, const uint8_t *sprite, size_t height,
+                  bool wide) {
+  const size_t w = width();
+  const size_t h = this->height();
+  x %= w;
+  bool collision = false;
+  for (int p = 0; p < 2; p++) {
+    if ((Planes & (1 << p)) == 0) {
+      continue;
+    }
+    Plane &rows = *plane(p);
+    for (size_t i = 0; i < height; i++) {
+      uint64_t bits = uint64_t(sprite[0]) << 56;
+      if (wide) {
+        bits |= uint64_t(sprite[1]) << 48;
+      }
+      sprite += wide ? 2 : 1;
+      uint64_t row[ROW_WORDS] = {bits, 0};
+      if (Hires) {
+        placeRow(row, x);
+      } else if (x != 0) {
+        // low resolution rows wrap within the first word
+        row[0] = (bits >> x) | (bits << (64 - x));
+      }
+      const size_t rowY = (y + i) % h;
+      uint64_t *dst = rows[rowY];
+      Damage |= uint64_t(1) << rowY;
+      collision |= ((dst[0] & row[0]) | (dst[1] & row[1])) != 0;
+      dst[0] ^= row[0];
+      dst[1] ^= row[1];
+    }
+  }
+  return collision;
+}
+
+void Screen::scrollDown(size_t n) {
+  const size_t h = height();
+  for (int p = 0; p < 2; p++) {
+    if (Planes & (1 << p)) {
+      Plane &rows = *plane(p);
+      for (size_t y = h; y-- > 0;) {
+        rows[y][0] = (y >= n) ? rows[y - n][0] : 0;
+        rows[y][1] = (y >= n) ? rows[y - n][1] : 0;
+      }
+    }
+  }
+  Damage |= visible();
+}
+
+void Screen::scrollUp(size_t n) {
+  const size_t h = height();
+  for (int p = 0; p < 2; p++) {
+    if (Planes & (1 << p)) {
+      Plane &rows = *plane(p);
+      for (size_t y = 0; y < h; y++) {
+        rows[y][0] = (y + n < h) ? rows[y + n][0] : 0;
+        rows[y][1] = (y + n < h) ? rows[y + n][1] : 0;
+      }
+    }
+  }
+  Damage |= visible();
+}
+
+void Screen::scrollLeft(size_t n) {
+  if (n == 0 || n >= 64) {
+    return;
+  }
+  for (int p = 0; p < 2; p++) {
+    if (Planes & (1 << p)) {
+      for (auto &row : *plane(p)) {
+        // in low resolution the second word is always blank
+        row[0] = (row[0] << n) | (row[1] >> (64 - n));
+        row[1] <<= n;
+      }
+    }
+  }
+  Damage |= visible();
+}
+
+void Screen::scrollRight(size_t n) {
+  if (n == 0 || n >= 64) {
+    return;
+  }
+  for (int p = 0; p < 2; p++) {
+    if (Planes & (1 << p)) {
+      for (auto &row : *plane(p)) {
+        row[1] = Hires ? (row[1] >> n) | (row[0] << (64 - n)) : 0;
+        row[0] >>= n;
+      }
+    }
+  }
+  Damage |= visible();
+}
+
+bool Screen::pixel(size_t x, size_t y) const {
+  x %= WIN_SIZE_X;
+  return (Rows[y % WIN_SIZE_Y][x / 64] >> (63 - (x % 64))) & 1;
+}
+
+uint8_t Screen::color(size_t x, size_t y) const {
+  x %= WIN_SIZE_X;
+  y %= WIN_SIZE_Y;
+  const size_t shift = 63 - (x % 64);
+  return ((Rows[y][x / 64] >> shift) & 1) |
+         (((Plane2[y][x / 64] >> shift) & 1) << 1);
+}
+
+static inline void mixWord(uint64_t *h, uint64_t word) {
+  for (int b = 56; b >= 0; b -= 8) {
+    *h ^= (word >> b) & 0xFF;
+    *h *= 0x100000001b3;
+  }
+}
+
+uint64_t Screen::hash() const {
+  uint64_t h = 0xcbf29ce484222325;
+  bool extended = Hires;
+  for (size_t y = 0; y < WIN_SIZE_Y; y++) {
+    for (size_t w = 0; w < ROW_WORDS; w++) {
+      mixWord(&h, Rows[y][w]);
+      extended |= Plane2[y][w] != 0;
+    }
+  }
+  // plain CHIP-8 screens hash the same as before SCHIP and XO-CHIP existed
+  if (extended) {
+    mixWord(&h, Hires);
+    for (size_t y = 0; y < WIN_SIZE_Y; y++) {
+      for (size_t w = 0; w < ROW_WORDS; w++) {
+        mixWord(&h, Plane2[y][w]);
+      }
+    }
+  }
+  return h;
+}
@@ -0,0 +1,81 @@
+#ifndef SCREEN_HPP
+#define SCREEN_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+const size_t WIN_SIZE_X = 128;
+const size_t WIN_SIZE_Y = 64;
+const size_t WIN_SIZE = (WIN_SIZE_X * WIN_SIZE_Y);
+const size_t ROW_WORDS = WIN_SIZE_X / 64;
+const uint64_t ALL_ROWS = ~uint64_t(0);
+static_assert(WIN_SIZE_Y <= 64, "damage tracking keeps one bit per row");
+
+// Screen is the packed framebuffer, one bit per pixel and one 128 bit row
+// per scanline. The leftmost pixel of a row is the top bit of Rows[y][0] so
+// sprite bytes shift straight into place and a whole sprite row is drawn with
+// one XOR per word.
+//
+// In low resolution the screen is 64x32 and uses the top left quarter of the
+// rows, one bit per pixel all the same, high resolution (SCHIP) uses all of
+// it. XO-CHIP adds a second plane, drawing, clearing and scrolling only touch
+// the planes selected in Planes.
+class Screen {
+public:
+  Screen();
+
+  // clear blanks the selected planes
+  void clear();
+  // draw XORs height sprite rows onto the selected planes at (x, y), wrapping
+  // at the edges, and returns true when any lit pixel was turned off. Rows
+  // are one byte, or two when wide. With both planes selected the sprite for
+  // the second plane follows the first.
+  bool draw(size_t x, size_t y, const uint8_t *sprite, size_t height,
+            bool wide = false);
+  bool pixel(size_t x, size_t y) const;
+  // color returns the pixel of every plane, bit 0 for the first
+  uint8_t color(size_t x, size_t y) const;
+  // hash is a 64 bit FNV-1a of the pixels, stable across hosts
+  uint64_t hash() const;
+
+  size_t width() const { return Hires ? WIN_SIZE_X : WIN_SIZE_X / 2; }
+  size_t height() const { return Hires ? WIN_SIZE_Y : WIN_SIZE_Y / 2; }
+  // setHires switches resolution and clears both planes
+  void setHires(bool on);
+  // scrolling moves the selected planes by n pixels, pixels moved off the
+  // screen are lost and blank ones move in
+  void scrollDown(size_t n);
+  void scrollUp(size_t n);
+  void scrollLeft(size_t n);
+  void scrollRight(size_t n);
+
+  // copyFrom takes the pixels, resolution and planes of other, only rows
+  // that differ are added to the damage already owed
+  void copyFrom(const Screen &other);
+
+  // changed reports whether anything was drawn since the last takeDamage
+  bool changed() const { return Damage != 0; }
+  // takeDamage returns the rows drawn since the last call, bit y for row y,
+  // and resets the record
+  uint64_t takeDamage() {
+    uint64_t damage = Damage;
+    Damage = 0;
+    return damage;
+  }
+
+  uint64_t Rows[WIN_SIZE_Y][ROW_WORDS];
+  uint64_t Plane2[WIN_SIZE_Y][ROW_WORDS]; // XO-CHIP second plane
+  uint64_t Damage = 0;  // one bit per row, set by draw and clear
+  bool Hires = false;   // 128x64 instead of 64x32
+  uint8_t Planes = 1;   // planes drawn to, bit 0 for Rows and bit 1 for Plane2
+
+private:
+  using Plane = uint64_t[WIN_SIZE_Y][ROW_WORDS];
+  Plane *plane(int i) { return i == 0 ? &Rows : &Plane2; }
+  // visible is the damage mask of every row in the current resolution
+  uint64_t visible() const {
+    return Hires ? ALL_ROWS : (uint64_t(1) << (WIN_SIZE_Y / 2)) - 1;
+  }
+};
+
+#endif // SCREEN_HPP
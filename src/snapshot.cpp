@@ -0,0 +1,197 @@
+#include "snapshot.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+static const char SNAPSHOT_MAGIC[4] = {'C', '8', 'S', 'S'};
+
+static void put(std::vector<uint8_t> *out, uint64_t val, size_t bytes) {
+  for (size_t i = 0; i < bytes; i++) {
+    out->push_back(val >> (8 * i));
+  }
+}
+
+// Reader pulls little endian values off the encoded stream, once it runs out
+// every read returns 0 and ok stays false
+struct Reader {
+  const std::vector<uint8_t> &data;
+  size_t pos = 0;
+  bool ok = true;
+
+  uint64_t get(size_t bytes) {
+    if (data.size() - pos < bytes) {
+      ok = false;
+      pos = data.size();
+      return 0;
+    }
+    uint64_t val = 0;
+    for (size_t i = 0; i < bytes; i++) {
+      val |= uint64_t(data[pos++]) << (8 * i);
+    }
+    return val;
+  }
+};
+
+std::vector<uint8_t> encodeSnapshotState(const Snapshot &s) {
+  std::vector<uint8_t> out(SNAPSHOT_MAGIC, SNAPSHOT_MAGIC + 4);
+  put(&out, s.Version, 4);
+  put(&out, s.MemorySize, 4);
+  put(&out, uint8_t(s.Prof), 1);
+
+  for (auto v : s.V) {
+    put(&out, v, 1);
+  }
+  put(&out, s.I, 2);
+  put(&out, s.DT, 1);
+  put(&out, s.ST, 1);
+  put(&out, s.SEED, 2);
+  put(&out, s.PC, 2);
+  put(&out, s.SP, 1);
+  put(&out, s.IR[0], 1);
+  put(&out, s.IR[1], 1);
+  for (auto addr : s.Stack) {
+    put(&out, addr, 2);
+  }
+  uint16_t keys = 0;
+  for (size_t i = 0; i < 0x10; i++) {
+    keys |= s.KeyPad[i] << i;
+  }
+  put(&out, keys, 2);
+  put(&out, s.InstrCount, 8);
+  put(&out, s.InputReg, 1);
+  put(&out,
+      s.Paused | s.ErrStackUnderflow << 1 | s.ErrStackOverflow << 2 |
+          s.WaitTick << 3,
+      1);
+  for (auto flag : s.RPL) {
+    put(&out, flag, 1);
+  }
+  for (auto sample : s.Pattern) {
+    put(&out, sample, 1);
+  }
+  put(&out, s.Pitch, 1);
+
+  put(&out, s.FrameBuffer.Hires | s.FrameBuffer.Planes << 1, 1);
+  for (auto &row : s.FrameBuffer.Rows) {
+    for (auto word : row) {
+      put(&out, word, 8);
+    }
+  }
+  for (auto &row : s.FrameBuffer.Plane2) {
+    for (auto word : row) {
+      put(&out, word, 8);
+    }
+  }
+  return out;
+}
+
+std::vector<uint8_t> encodeSnapshot(const Snapshot &s) {
+  std::vector<uint8_t> out = encodeSnapshotState(s);
+  out.reserve(out.size() + s.MemorySize);
+  for (size_t addr = 0; addr < s.MemorySize; addr++) {
+    out.push_back((*s.Pages[addr / MEM_PAGE_SIZE])[addr % MEM_PAGE_SIZE]);
+  }
+  return out;
+}
+
+// decodeState parses the part encodeSnapshotState wrote and sets end to
+// where it stopped
+static bool decodeState(const std::vector<uint8_t> &data, Snapshot *s,
+                        size_t *end) {
+  if (data.size() < 4 || memcmp(data.data(), SNAPSHOT_MAGIC, 4) != 0) {
+    return false;
+  }
+  Reader in{data, 4};
+  s->Version = in.get(4);
+  if (s->Version != SNAPSHOT_VERSION) {
+    return false;
+  }
+  s->MemorySize = in.get(4);
+  // Memory only comes in powers of two
+  if (s->MemorySize == 0 || (s->MemorySize & (s->MemorySize - 1)) != 0) {
+    return false;
+  }
+  const uint8_t prof = in.get(1);
+  if (prof >= PROFILE_COUNT) {
+    return false;
+  }
+  s->Prof = Profile(prof);
+
+  for (auto &v : s->V) {
+    v = in.get(1);
+  }
+  s->I = in.get(2);
+  s->DT = in.get(1);
+  s->ST = in.get(1);
+  s->SEED = in.get(2);
+  s->PC = in.get(2);
+  s->SP = in.get(1);
+  if (s->SP > sizeof(s->Stack) / sizeof(s->Stack[0])) {
+    return false;
+  }
+  s->IR[0] = in.get(1);
+  s->IR[1] = in.get(1);
+  for (auto &addr : s->Stack) {
+    addr = in.get(2);
+  }
+  const uint16_t keys = in.get(2);
+  for (size_t i = 0; i < 0x10; i++) {
+    s->KeyPad[i] = (keys >> i) & 1;
+  }
+  s->InstrCount = in.get(8);
+  s->InputReg = in.get(1);
+  if (s->InputReg > 0xF) {
+    return false;
+  }
+  const uint8_t flags = in.get(1);
+  s->Paused = flags & 1;
+  s->ErrStackUnderflow = flags & 2;
+  s->ErrStackOverflow = flags & 4;
+  s->WaitTick = flags & 8;
+  for (auto &flag : s->RPL) {
+    flag = in.get(1);
+  }
+  for (auto &sample : s->Pattern) {
+    sample = in.get(1);
+  }
+  s->Pitch = in.get(1);
+
+  const uint8_t mode = in.get(1);
+  s->FrameBuffer.Hires = mode & 1;
+  s->FrameBuffer.Planes = (mode >> 1) & 3;
+  for (auto &row : s->FrameBuffer.Rows) {
+    for (auto &word : row) {
+      word = in.get(8);
+    }
+  }
+  for (auto &row : s->FrameBuffer.Plane2) {
+    for (auto &word : row) {
+      word = in.get(8);
+    }
+  }
+  s->FrameBuffer.Damage = ALL_ROWS;
+  *end = in.pos;
+  return in.ok;
+}
+
+bool decodeSnapshotState(const std::vector<uint8_t> &data, Snapshot *s) {
+  size_t end;
+  return decodeState(data, s, &end) && end == data.size();
+}
+
+bool decodeSnapshot(const std::vector<uint8_t> &data, Snapshot *s) {
+  size_t pos;
+  if (!decodeState(data, s, &pos) || data.size() - pos != s->MemorySize) {
+    return false;
+  }
+  s->Pages.clear();
+  for (size_t start = 0; start < s->MemorySize; start += MEM_PAGE_SIZE) {
+    auto page = std::make_shared<MemoryPage>();
+    page->fill(0);
+    const size_t len = std::min(MEM_PAGE_SIZE, s->MemorySize - start);
+    std::copy(data.begin() + pos + start, data.begin() + pos + start + len,
+              page->begin());
+    s->Pages.push_back(page);
+  }
+  return true;
+}
@@ -0,0 +1,56 @@
+#ifndef SNAPSHOT_HPP
+#define SNAPSHOT_HPP
+
+#include "memory.hpp"
+#include "quirks.hpp"
+#include "screen.hpp"
+#include <cstdint>
+#include <vector>
+
+// bump whenever the encoded layout changes, decodeSnapshot rejects others
+const uint32_t SNAPSHOT_VERSION = 2;
+
+// Snapshot is the whole machine state, taken by Chip8::snapshot and put back
+// by Chip8::restore. Memory is held as shared pages, so snapshots taken in a
+// row only own copies of the pages written in between.
+struct Snapshot {
+  uint32_t Version = SNAPSHOT_VERSION;
+  Profile Prof = Profile::Chip8; // restore refuses other profiles
+
+  uint8_t V[0x10];
+  uint16_t I = 0;
+  uint8_t DT = 0;
+  uint8_t ST = 0;
+  uint16_t SEED = 0;
+  uint16_t PC = 0;
+  uint8_t SP = 0;
+  uint8_t IR[2];
+  uint16_t Stack[0x10];
+  bool KeyPad[0x10];
+  uint64_t InstrCount = 0;
+  uint8_t InputReg = 0;
+  bool Paused = false;
+  bool ErrStackUnderflow = false;
+  bool ErrStackOverflow = false;
+  bool WaitTick = false;
+  uint8_t RPL[0x10];
+  uint8_t Pattern[0x10];
+  uint8_t Pitch = 0;
+
+  Screen FrameBuffer;
+  size_t MemorySize = 0;
+  std::vector<SharedPage> Pages;
+};
+
+// encodeSnapshot writes s as a little endian byte stream:
+//   "C8SS" version memory-size profile registers screen memory
+std::vector<uint8_t> encodeSnapshot(const Snapshot &s);
+// decodeSnapshot parses what encodeSnapshot wrote, returns false for a
+// different version, truncated data or fields no machine could have
+bool decodeSnapshot(const std::vector<uint8_t> &data, Snapshot *s);
+// encodeSnapshotState and decodeSnapshotState leave out the memory, for
+// callers that keep the pages themselves. Pages is left as it was.
+std::vector<uint8_t> encodeSnapshotState(const Snapshot &s);
+bool decodeSnapshotState(const std::vector<uint8_t> &data, Snapshot *s);
+
+#endif // SNAPSHOT_HPP
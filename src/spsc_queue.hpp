@@ -0,0 +1,67 @@
+#ifndef SPSC_QUEUE_HPP
+#define SPSC_QUEUE_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+
+// SpscQueue is a bounded lock-free ring for one producer and one consumer
+// thread, N has to be a power of two
+template <typename T, size_t N> class SpscQueue {
+  static_assert(N != 0 && (N & (N - 1)) == 0, "N must be a power of two");
+
+public:
+  // push returns false without blocking when the queue is full
+  bool push(const T &item) {
+    const size_t t = tail.load(std::memory_order_relaxed);
+    if (t - head.load(std::memory_order_acquire) == N) {
+      return false;
+    }
+    items[t & (N - 1)] = item;
+    tail.store(t + 1, std::memory_order_release);
+    return true;
+  }
+  // pop returns false when the queue is empty
+  bool pop(T *item) {
+    const size_t h = head.load(std::memory_order_relaxed);
+    if (h == tail.load(std::memory_order_acquire)) {
+      return false;
+    }
+    *item = items[h & (N - 1)];
+    head.store(h + 1, std::memory_order_release);
+    return true;
+  }
+  // write pushes as many of the n items as fit, returns how many did
+  size_t write(const T *src, size_t n) {
+    const size_t t = tail.load(std::memory_order_relaxed);
+    n = std::min(n, N - (t - head.load(std::memory_order_acquire)));
+    for (size_t i = 0; i < n; i++) {
+      items[(t + i) & (N - 1)] = src[i];
+    }
+    tail.store(t + n, std::memory_order_release);
+    return n;
+  }
+  // read pops up to n items into dst, returns how many it got
+  size_t read(T *dst, size_t n) {
+    const size_t h = head.load(std::memory_order_relaxed);
+    n = std::min(n, tail.load(std::memory_order_acquire) - h);
+    for (size_t i = 0; i < n; i++) {
+      dst[i] = items[(h + i) & (N - 1)];
+    }
+    head.store(h + n, std::memory_order_release);
+    return n;
+  }
+  // empty is for the consumer, a push may land right after it returns true
+  bool empty() const {
+    return head.load(std::memory_order_relaxed) ==
+           tail.load(std::memory_order_acquire);
+  }
+
+private:
+  // on separate cache lines so the two threads do not share one
+  alignas(64) std::atomic<size_t> head{0};
+  alignas(64) std::atomic<size_t> tail{0};
+  T items[N];
+};
+
+#endif // SPSC_QUEUE_HPP
@@ -1,4 +1,1840 @@
+#include "analyser.hpp"
+#include "audio.hpp"
+#include "batch.hpp"
+#include "chip8.hpp"
+#include "cpu_thread.hpp"
+#include "farm.hpp"
+#include "fuzz.hpp"
+#include "machine.hpp"
+#include "memory.hpp"
+#include "replay.hpp"
+#include "rewind.hpp"
+#include "rom.hpp"
+#include "rom_index.hpp"
+#include "scheduler.hpp"
+#include "screen.hpp"
+#include "snapshot.hpp"
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <dirent.h>
+#include <fstream>
 #include <gtest/gtest.h>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+static const Engine ENGINES[] = {Engine::Table, Engine::Threaded, Engine::Jit};
+
+static void loadProgram(Memory *mem, const std::vector<uint16_t> &program) {
+  uint16_t addr = ROM_START;
+  for (auto instr : program) {
+    mem->set(addr++, instr >> 8);
+    mem->set(addr++, instr & 0xFF);
+  }
+}
+
+// KEY_GAME waits for a key, draws a random glyph at the key's column and
+// keeps drawing while the key is held
+static const std::vector<uint16_t> KEY_GAME = {
+    0xF00A, // 200: LD V0, K
+    0xC1FF, // 202: RND V1, 0xFF
+    0xF129, // 204: LD F, V1
+    0xD015, // 206: DRW V0, V1, 5
+    0xF215, // 208: LD DT, V2
+    0x7201, // 20A: ADD V2, 1
+    0xE09E, // 20C: SKP V0
+    0x1200, // 20E: JP 0x200
+    0x1202, // 210: JP 0x202
+};
+
+// session drives KEY_GAME the way the frontend does, a step call per frame
+// and a key pressed and released now and then
+static Recording session(Engine engine, uint16_t seed) {
+  Memory mem(4096);
+  Chip8 cpu(&mem, engine);
+  cpu.seed(seed);
+  loadProgram(&mem, KEY_GAME);
+  Recorder recorder(10);
+  recorder.start(cpu);
+  for (int frame = 0; frame < 300; frame++) {
+    if (frame % 7 == 0) {
+      recorder.sendInput(cpu, frame % 16, true);
+    } else if (frame % 7 == 3) {
+      recorder.sendInput(cpu, (frame - 3) % 16, false);
+    }
+    cpu.step(1000);
+    recorder.fixedUpdate(cpu);
+  }
+  return recorder.recording();
+}
+
+static ReplayResult replayProgram(const Recording &rec, Engine engine) {
+  Memory mem(4096);
+  Chip8 cpu(&mem, engine);
+  loadProgram(&mem, KEY_GAME);
+  return replay(rec, cpu);
+}
+
+TEST(Random, SameSeedSameSequence) {
+  Memory memA(4096), memB(4096);
+  Chip8 a(&memA), b(&memB);
+  loadProgram(&memA, {0xC0FF, 0x1200});
+  loadProgram(&memB, {0xC0FF, 0x1200});
+  a.seed(1234);
+  b.seed(1234);
+  for (int i = 0; i < 1000; i++) {
+    a.step(2);
+    b.step(2);
+    ASSERT_EQ(a.V[0], b.V[0]);
+  }
+}
+
+TEST(Random, ZeroSeedFallsBackToDefault) {
+  Memory mem(4096);
+  Chip8 cpu(&mem);
+  cpu.seed(0);
+  EXPECT_EQ(cpu.SEED, DEFAULT_SEED);
+  // 0xFFFF xorshifts to 0, RND has to restart from the default, not time
+  loadProgram(&mem, {0xC0FF});
+  cpu.SEED = 0xFFFF;
+  cpu.step(1);
+  EXPECT_EQ(cpu.SEED, DEFAULT_SEED);
+}
+
+TEST(Replay, RecordedSessionReplaysOnEveryEngine) {
+  for (Engine recorded : ENGINES) {
+    const Recording rec = session(recorded, 0x5EED);
+    for (Engine engine : ENGINES) {
+      const ReplayResult result = replayProgram(rec, engine);
+      EXPECT_TRUE(result.Ok) << result.Error;
+      EXPECT_EQ(result.Checks, 30u);
+    }
+  }
+}
+
+TEST(Replay, DifferentSeedIsCaught) {
+  Recording rec = session(Engine::Table, 0x5EED);
+  rec.Seed = 0x5EEE;
+  const ReplayResult result = replayProgram(rec, Engine::Table);
+  EXPECT_FALSE(result.Ok);
+  EXPECT_FALSE(result.Error.empty());
+}
+
+TEST(Replay, DifferentInputIsCaught) {
+  Recording rec = session(Engine::Table, 0x5EED);
+  // press the key next to every recorded one
+  for (auto &event : rec.Events) {
+    if (event.Op == ReplayOp::KeyDown) {
+      event.Value = (event.Value + 1) & 0xF;
+    }
+  }
+  EXPECT_FALSE(replayProgram(rec, Engine::Table).Ok);
+}
+
+TEST(Replay, TextRoundTrip) {
+  const Recording rec = session(Engine::Table, 0x5EED);
+  std::stringstream text;
+  ASSERT_TRUE(writeRecording(text, rec));
+  Recording read;
+  ASSERT_TRUE(readRecording(text, &read));
+  EXPECT_EQ(read.Seed, rec.Seed);
+  EXPECT_EQ(read.Prof, rec.Prof);
+  ASSERT_EQ(read.Events.size(), rec.Events.size());
+  for (size_t i = 0; i < rec.Events.size(); i++) {
+    EXPECT_EQ(read.Events[i].At, rec.Events[i].At);
+    EXPECT_EQ(read.Events[i].Op, rec.Events[i].Op);
+    EXPECT_EQ(read.Events[i].Value, rec.Events[i].Value);
+  }
+  EXPECT_TRUE(replayProgram(read, Engine::Table).Ok);
+}
+
+TEST(Replay, OldFormatIsRejected) {
+  std::stringstream text("chip8-replay 1\nseed 1\n0 tick\n");
+  Recording rec;
+  std::string err;
+  EXPECT_FALSE(readRecording(text, &rec, &err));
+  EXPECT_NE(err.find("chip8-replay 1"), std::string::npos) << err;
+}
+
+TEST(Replay, ProfileLineFollowsTheSeed) {
+  Recording rec;
+  std::string err;
+  std::stringstream good("chip8-replay 2\nseed 1\nprofile schip\n0 tick\n");
+  ASSERT_TRUE(readRecording(good, &rec, &err)) << err;
+  EXPECT_EQ(rec.Prof, Profile::SChip);
+  for (const char *bad : {"chip8-replay 2\nseed 1\n0 tick\n",
+                          "chip8-replay 2\nseed 1\n0 tick\nprofile schip\n",
+                          "chip8-replay 2\nseed 1\nprofile nope\n"}) {
+    std::stringstream text(bad);
+    EXPECT_FALSE(readRecording(text, &rec, &err)) << bad;
+  }
+}
+
+// run loads program and executes count instructions of it, or until the CPU
+// waits for a key, ignoring the display wait
+static void run(Chip8 &cpu, Memory &mem, const std::vector<uint16_t> &program,
+                int count) {
+  loadProgram(&mem, program);
+  cpu.PC = ROM_START;
+  while (count-- > 0 && !cpu.Paused) {
+    cpu.step(1);
+    cpu.WaitTick = false;
+  }
+}
+
+TEST(Quirks, ShiftSourceFollowsProfile) {
+  for (Engine engine : ENGINES) {
+    Memory memA(4096), memB(4096);
+    Chip8 chip8(&memA, engine), cosmac(&memB, engine, Profile::Cosmac);
+    const std::vector<uint16_t> program = {0x6003, 0x6106, 0x8016, 0x1206};
+    run(chip8, memA, program, 10);
+    run(cosmac, memB, program, 10);
+    EXPECT_EQ(chip8.V[0], 1); // V0 >> 1
+    EXPECT_EQ(chip8.V[0xF], 1);
+    EXPECT_EQ(cosmac.V[0], 3); // V1 >> 1
+    EXPECT_EQ(cosmac.V[0xF], 0);
+  }
+}
+
+TEST(Quirks, StoreAndLoadStopAtVx) {
+  for (Profile profile : {Profile::Chip8, Profile::Cosmac}) {
+    Memory mem(4096);
+    Chip8 cpu(&mem, Engine::Table, profile);
+    // V0..V2 = 1..3 stored at 0x300, then V0..V1 loaded back from 0x300
+    run(cpu, mem,
+        {0x6001, 0x6102, 0x6203, 0x6309, 0xA300, 0xF255, 0x6000, 0x6100,
+         0x6200, 0xA300, 0xF165, 0x1216},
+        20);
+    EXPECT_EQ(mem.get(0x302), 3);
+    EXPECT_EQ(mem.get(0x303), 0); // V3 is not stored
+    EXPECT_EQ(cpu.V[0], 1);
+    EXPECT_EQ(cpu.V[1], 2);
+    EXPECT_EQ(cpu.V[2], 0); // nor is V2 loaded
+    EXPECT_EQ(cpu.I, profile == Profile::Cosmac ? 0x302 : 0x300);
+  }
+}
+
+TEST(Quirks, JumpOffsetRegister) {
+  for (Engine engine : ENGINES) {
+    Memory memA(4096), memB(4096);
+    Chip8 chip8(&memA, engine), schip(&memB, engine, Profile::SChip);
+    const std::vector<uint16_t> program = {0x6010, 0x6320, 0xB300};
+    run(chip8, memA, program, 3);
+    run(schip, memB, program, 3);
+    EXPECT_EQ(chip8.PC, 0x310); // 0x300 + V0
+    EXPECT_EQ(schip.PC, 0x320); // 0x300 + V3
+  }
+}
+
+TEST(Quirks, DisplayWaitHoldsDrawsUntilTick) {
+  Memory mem(4096);
+  Chip8 cpu(&mem, Engine::Table, Profile::Cosmac);
+  loadProgram(&mem, {0xD001, 0xD001, 0x1204});
+  cpu.step(100);
+  EXPECT_EQ(cpu.InstrCount, 1u);
+  cpu.step(100);
+  EXPECT_EQ(cpu.InstrCount, 1u);
+  cpu.fixedUpdate();
+  cpu.step(100);
+  EXPECT_EQ(cpu.InstrCount, 2u);
+}
+
+// sameAsTable runs program on engine and on the table interpreter, a frame
+// of perFrame instructions at a time with keys going down and up, and fails
+// on the first frame their state or memory differ
+static testing::AssertionResult
+sameAsTable(Engine engine, Profile profile,
+            const std::vector<uint16_t> &program, int frames, int perFrame) {
+  Memory memA(quirksOf(profile).MemorySize), memB(quirksOf(profile).MemorySize);
+  Chip8 want(&memA, Engine::Table, profile), got(&memB, engine, profile);
+  loadProgram(&memA, program);
+  loadProgram(&memB, program);
+  for (int frame = 0; frame < frames; frame++) {
+    want.sendInput(frame % 16, frame % 3 == 0);
+    got.sendInput(frame % 16, frame % 3 == 0);
+    want.step(perFrame);
+    got.step(perFrame);
+    if (want.InstrCount != got.InstrCount ||
+        stateHash(want) != stateHash(got)) {
+      return testing::AssertionFailure()
+             << "state differs after frame " << frame << " at PC " << std::hex
+             << want.PC << " and " << got.PC;
+    }
+    for (size_t addr = 0; addr < memA.size(); addr++) {
+      if (memA.get(addr) != memB.get(addr)) {
+        return testing::AssertionFailure() << "memory differs at " << std::hex
+                                           << addr << " after frame " << frame;
+      }
+    }
+    want.fixedUpdate();
+    got.fixedUpdate();
+  }
+  return testing::AssertionSuccess();
+}
+
+// EVERY_GROUP touches every opcode group of CHIP-8: ALU ops, skips, BCD,
+// stores and loads, a call, the timers, RND and DRW, 64 times round
+static const std::vector<uint16_t> EVERY_GROUP = {
+    0x6A05, // 200: LD VA, 5
+    0x6B03, // 202: LD VB, 3
+    0x8AB4, // 204: ADD VA, VB
+    0x8AB5, // 206: SUB VA, VB
+    0x8AB7, // 208: SUBN VA, VB
+    0x8AB1, // 20A: OR VA, VB
+    0x8AB2, // 20C: AND VA, VB
+    0x8AB3, // 20E: XOR VA, VB
+    0x8A06, // 210: SHR VA
+    0x8A0E, // 212: SHL VA
+    0x8AB0, // 214: LD VA, VB
+    0xCCFF, // 216: RND VC, 0xFF
+    0x3C10, // 218: SE VC, 0x10
+    0x4C20, // 21A: SNE VC, 0x20
+    0x5AB0, // 21C: SE VA, VB
+    0x9AB0, // 21E: SNE VA, VB
+    0xA300, // 220: LD I, 0x300
+    0xFC33, // 222: LD B, VC
+    0xF265, // 224: LD V2, [I]
+    0xFA1E, // 226: ADD I, VA
+    0xFC29, // 228: LD F, VC
+    0xD125, // 22A: DRW V1, V2, 5
+    0x2240, // 22C: CALL 0x240
+    0xFC15, // 22E: LD DT, VC
+    0xFD07, // 230: LD VD, DT
+    0x7E01, // 232: ADD VE, 1
+    0x3E40, // 234: SE VE, 0x40
+    0x1200, // 236: JP 0x200
+    0x1238, // 238: JP 0x238
+    0x0000, 0x0000, 0x0000,
+    0xF355, // 240: LD [I], V3
+    0x00EE, // 242: RET
+};
+
+TEST(Engines, ThreadedRunsLikeTable) {
+  for (size_t p = 0; p < PROFILE_COUNT; p++) {
+    EXPECT_TRUE(sameAsTable(Engine::Threaded, Profile(p), EVERY_GROUP, 40, 50))
+        << quirksOf(Profile(p)).Name;
+    // and whatever random words do, including stack errors and key waits
+    std::mt19937 rng(p + 1);
+    std::vector<uint16_t> program(512);
+    for (auto &word : program) {
+      word = rng();
+    }
+    EXPECT_TRUE(sameAsTable(Engine::Threaded, Profile(p), program, 40, 50))
+        << quirksOf(Profile(p)).Name;
+  }
+}
+
+TEST(Jit, RunsLikeTable) {
+  // ALU blocks, skips that leave a block on either side and jumps back
+  const std::vector<uint16_t> blocks = {
+      0x6001, 0x6102, 0x8014, 0x8105, 0x8012, 0x8103, 0x8016, 0x810E,
+      0x7203, 0x3203, 0x7301, 0x4204, 0x7302, 0x5010, 0x7303, 0x9010,
+      0x7304, 0x3360, 0x1200, 0x1224};
+  for (size_t p = 0; p < PROFILE_COUNT; p++) {
+    EXPECT_TRUE(sameAsTable(Engine::Jit, Profile(p), blocks, 40, 50))
+        << quirksOf(Profile(p)).Name;
+    EXPECT_TRUE(sameAsTable(Engine::Jit, Profile(p), EVERY_GROUP, 40, 50))
+        << quirksOf(Profile(p)).Name;
+    std::mt19937 rng(p + 1);
+    std::vector<uint16_t> program(512);
+    for (auto &word : program) {
+      word = rng();
+    }
+    EXPECT_TRUE(sameAsTable(Engine::Jit, Profile(p), program, 40, 50))
+        << quirksOf(Profile(p)).Name;
+  }
+}
+
+TEST(Jit, CodePatchingItsOwnBlock) {
+  // every pass LD [I], V0 patches the immediate of the ADD VB compiled in
+  // the block before it, VB ends up 0 + 1 + 2 + 3 + 4. V1 to V8 hold the
+  // code after it, so storing them changes nothing else.
+  const std::vector<uint16_t> program = {
+      0x61F0, 0x6255, 0x6330, 0x6405, 0x6512, 0x6612, 0x6712, 0x681C,
+      0xA215, 0x7001, 0x7B00, 0xF055, 0x3005, 0x1212, 0x121C};
+  Memory mem(4096);
+  Chip8 cpu(&mem, Engine::Jit);
+  loadProgram(&mem, program);
+  cpu.step(100);
+  EXPECT_EQ(cpu.V[0xB], 10);
+  EXPECT_EQ(cpu.PC, 0x21C);
+  // the page stays interpreted, and right, when it is patched again
+  EXPECT_TRUE(sameAsTable(Engine::Jit, Profile::Chip8, program, 4, 11));
+}
+
+TEST(Jit, CodePatchedThroughAnAddressPastMemory) {
+  // the same patching loop, but I = 0xB205 only reaches the ADD VB at 0x205
+  // once masked to 4 KiB
+  const std::vector<uint16_t> program = {
+      0x1210, 0x7001, 0x7B00, 0xF055, 0x3005, 0x1202, 0x120C, 0x0000,
+      0xAFFF, 0x61FF, 0xF11E, 0xF11E, 0x6108, 0xF11E, 0x1202};
+  Memory mem(4096);
+  Chip8 cpu(&mem, Engine::Jit);
+  loadProgram(&mem, program);
+  cpu.step(200);
+  EXPECT_EQ(cpu.V[0xB], 10);
+  EXPECT_EQ(cpu.PC, 0x20C);
+  EXPECT_TRUE(sameAsTable(Engine::Jit, Profile::Chip8, program, 20, 10));
+}
+
+TEST(Jit, BlocksStopAtTheBudget) {
+  // one straight block of 30 ADDs, then a jump back
+  std::vector<uint16_t> program;
+  for (int i = 0; i < 30; i++) {
+    program.push_back(0x7001 | (i % 15) << 8);
+  }
+  program.push_back(0x1200);
+  for (int count = 1; count <= 70; count++) {
+    Memory memA(4096), memB(4096);
+    Chip8 table(&memA, Engine::Table), jit(&memB, Engine::Jit);
+    loadProgram(&memA, program);
+    loadProgram(&memB, program);
+    // compile the block first, then stop inside it
+    jit.step(31);
+    table.step(31);
+    jit.step(count);
+    table.step(count);
+    ASSERT_EQ(jit.InstrCount, 31u + count);
+    ASSERT_EQ(jit.PC, table.PC) << count;
+    ASSERT_EQ(stateHash(jit), stateHash(table)) << count;
+  }
+  EXPECT_TRUE(sameAsTable(Engine::Jit, Profile::Chip8, program, 50, 7));
+}
+
+// batchLikeChip8 runs random ROMs on a Batch and on one Chip8 per lane with
+// the same seeds and keys, comparing every lane after each frame. Lanes start
+// apart so they diverge and merge again.
+static testing::AssertionResult batchLikeChip8(BatchIsa isa) {
+  const size_t lanes = 37; // not a whole vector, the tail is padding
+  const int frames = 20;
+  const int perFrame = 60;
+  std::mt19937 rng(5);
+  for (int rom = 0; rom < 4; rom++) {
+    Memory image(4096);
+    // random code at any alignment, kept off CALL and RET, which would only
+    // run off the stack, and jumps below ROM_START, where the font's bytes
+    // hold CALLs
+    for (size_t addr = ROM_START; addr < image.size(); addr++) {
+      uint8_t byte = rng();
+      const uint8_t op = byte >> 4;
+      if (op == 0x2) {
+        byte = 0x70 | (byte & 0xF);
+      } else if ((op == 0x1 || op == 0xB) && (byte & 0xF) < 0x2) {
+        byte |= 0x2;
+      } else if (byte == 0xBF || byte == 0xEE) {
+        byte--;
+      }
+      image.set(addr, byte);
+    }
+    // running off the end jumps back instead of wrapping
+    for (size_t addr = image.size() - 4; addr < image.size(); addr++) {
+      image.set(addr, 0x12);
+    }
+    Batch batch(lanes, image, isa);
+    std::vector<Memory> mems(lanes, image);
+    std::vector<Chip8> cpus;
+    for (size_t lane = 0; lane < lanes; lane++) {
+      cpus.emplace_back(&mems[lane]);
+      const uint16_t seed = rng() | 1;
+      batch.SEED[lane] = cpus[lane].SEED = seed;
+      if (lane % 3 == 0) {
+        batch.reg(lane, 1) = cpus[lane].V[1] = lane;
+      }
+    }
+    for (int frame = 0; frame < frames; frame++) {
+      for (size_t lane = 0; lane < lanes; lane++) {
+        const uint8_t key = (frame + lane) % 16;
+        const bool down = (frame + lane) % 3 != 0;
+        batch.sendInput(lane, key, down);
+        cpus[lane].sendInput(key, down);
+      }
+      batch.step(perFrame);
+      for (Chip8 &cpu : cpus) {
+        // DRW and CLS end a Chip8 step, a Batch runs through them
+        const uint64_t target = cpu.InstrCount + perFrame;
+        while (cpu.InstrCount < target && !cpu.Paused) {
+          cpu.step(target - cpu.InstrCount);
+        }
+      }
+      batch.fixedUpdate();
+      for (Chip8 &cpu : cpus) {
+        cpu.fixedUpdate();
+      }
+      for (size_t lane = 0; lane < lanes; lane++) {
+        const Chip8 &cpu = cpus[lane];
+        bool same = cpu.PC == batch.PC[lane] && cpu.I == batch.I[lane] &&
+                    cpu.SP == batch.SP[lane] && cpu.DT == batch.DT[lane] &&
+                    cpu.ST == batch.ST[lane] && cpu.SEED == batch.SEED[lane] &&
+                    cpu.Paused == bool(batch.Paused[lane]) &&
+                    cpu.InstrCount == batch.InstrCount[lane] &&
+                    cpu.FrameBuffer.hash() == batch.FrameBuffers[lane].hash();
+        for (size_t r = 0; r < 0x10; r++) {
+          same = same && cpu.V[r] == batch.reg(lane, r);
+        }
+        for (size_t addr = 0; addr < image.size(); addr++) {
+          same = same && mems[lane].get(addr) == batch.read(lane, addr);
+        }
+        if (!same) {
+          return testing::AssertionFailure()
+                 << "rom " << rom << " lane " << lane << " frame " << frame
+                 << " PC " << cpu.PC << " vs " << batch.PC[lane];
+        }
+      }
+    }
+  }
+  return testing::AssertionSuccess();
+}
+
+TEST(Batch, LanesRunLikeSeparateMachines) {
+  for (BatchIsa isa : {BatchIsa::Scalar, BatchIsa::SSE2, BatchIsa::AVX2}) {
+    if (!Batch::supports(isa)) {
+      continue;
+    }
+    SCOPED_TRACE(int(isa));
+    Memory image(4096);
+    ASSERT_EQ(Batch(1, image, isa).isa(), isa);
+    EXPECT_TRUE(batchLikeChip8(isa));
+  }
+}
+
+TEST(DecodeCache, StoreOverTheNextInstructionRunsTheNewOne) {
+  for (Engine engine : ENGINES) {
+    Memory mem(4096);
+    Chip8 cpu(&mem, engine);
+    // every pass LD [I], V1 writes 6B<V1> over the instruction right after
+    // it, which the previous pass already ran, until VB reaches 3. V2 to V7
+    // hold the code after it, so storing them changes nothing else.
+    loadProgram(&mem, {0x606B, 0x623B, 0x6303, 0x6412, 0x6510, 0x6612, 0x671A,
+                       0xA214, 0x7101, 0xF155, 0x6B00, 0x3B03, 0x1210, 0x121A});
+    cpu.step(50);
+    EXPECT_EQ(cpu.V[0xB], 3);
+    EXPECT_EQ(cpu.PC, 0x21A);
+  }
+}
+
+TEST(DecodeCache, BcdOverTheNextInstructionRunsTheNewOne) {
+  for (Engine engine : ENGINES) {
+    Memory mem(4096);
+    Chip8 cpu(&mem, engine);
+    // every pass adds 100 to V0 and LD B, V0 writes its hundreds into the
+    // low byte of the 6B09 right after it, its tens and ones turn 6C07 into
+    // SYS 000, until VB reaches 2
+    loadProgram(&mem, {0x7064, 0xA207, 0xF033, 0x6B09, 0x6C07, 0x3B02, 0x1200,
+                       0x120E});
+    cpu.step(50);
+    EXPECT_EQ(cpu.V[0xB], 2);
+    EXPECT_EQ(cpu.V[0xC], 0);
+    EXPECT_EQ(cpu.PC, 0x20E);
+  }
+}
+
+TEST(DecodeCache, StoreOverCodeThatAlreadyRanInThePage) {
+  for (Engine engine : ENGINES) {
+    Memory mem(4096);
+    Chip8 cpu(&mem, engine);
+    // the first pass runs 6B01 at 0x210, then patches it to 6B42 and jumps
+    // back, the second pass parks on 0x216. V2 to V7 hold the code after it.
+    loadProgram(&mem, {0x1210, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+                       0x0000, 0x6B01, 0x4C00, 0x1220, 0x1216, 0x0000, 0x0000,
+                       0x0000, 0x0000, 0x7C01, 0x606B, 0x6142, 0x624C, 0x6300,
+                       0x6412, 0x6520, 0x6612, 0x6716, 0xA210, 0xF155, 0x1210});
+    cpu.step(50);
+    EXPECT_EQ(cpu.V[0xB], 0x42);
+    EXPECT_EQ(cpu.PC, 0x216);
+  }
+}
+
+TEST(DecodeCache, WritesFromOutsideFlushIt) {
+  for (Engine engine : ENGINES) {
+    Memory mem(4096);
+    Chip8 cpu(&mem, engine);
+    loadProgram(&mem, {0x7B01, 0x1200}); // ADD VB, 1 in a loop
+    cpu.step(10);
+    ASSERT_EQ(cpu.V[0xB], 5);
+    mem.set(0x201, 0x10);
+    cpu.step(10);
+    EXPECT_EQ(cpu.V[0xB], 5 + 5 * 0x10);
+  }
+}
+
+TEST(Screen, DrawXorsAndReportsCollisions) {
+  for (Engine engine : ENGINES) {
+    Memory mem(4096);
+    Chip8 cpu(&mem, engine);
+    // F0 90 at (2, 3), VE = VF, then 20 60 over it at (3, 3)
+    loadProgram(&mem, {0x6002, 0x6103, 0xA300, 0xD012, 0x8EF0, 0x6203,
+                       0xA302, 0xD212, 0x1210});
+    const uint8_t sprites[4] = {0xF0, 0x90, 0x20, 0x60};
+    for (size_t i = 0; i < 4; i++) {
+      mem.set(0x300 + i, sprites[i]);
+    }
+    // DRW ends a step
+    for (int i = 0; i < 8; i++) {
+      cpu.step(1);
+    }
+    EXPECT_EQ(cpu.V[0xE], 0);
+    EXPECT_EQ(cpu.V[0xF], 1);
+    // F0 at 2 XOR 20 at 3, then 90 at 2 XOR 60 at 3
+    EXPECT_TRUE(cpu.pixel(2, 3));
+    EXPECT_TRUE(cpu.pixel(3, 3));
+    EXPECT_TRUE(cpu.pixel(4, 3));
+    EXPECT_FALSE(cpu.pixel(5, 3));
+    EXPECT_TRUE(cpu.pixel(2, 4));
+    EXPECT_FALSE(cpu.pixel(3, 4));
+    EXPECT_TRUE(cpu.pixel(4, 4));
+    EXPECT_FALSE(cpu.pixel(5, 4));
+    EXPECT_FALSE(cpu.pixel(6, 4));
+  }
+  Screen screen;
+  const uint8_t sprite[1] = {0x18};
+  EXPECT_FALSE(screen.draw(0, 0, sprite, 1));
+  EXPECT_TRUE(screen.draw(0, 0, sprite, 1));
+  EXPECT_EQ(screen.Rows[0][0], 0u);
+  EXPECT_FALSE(screen.draw(0, 0, sprite, 1)) << "nothing was lit to collide";
+}
+
+TEST(Screen, SpritesWrapAndScrollsClip) {
+  const uint8_t sprite[2] = {0xFF, 0x81};
+  Screen screen;
+  // from (60, 31) the sprite wraps to the left edge and to the top row
+  EXPECT_FALSE(screen.draw(60, 31, sprite, 2));
+  for (size_t x = 0; x < 64; x++) {
+    EXPECT_EQ(screen.pixel(x, 31), x >= 60 || x < 4) << x;
+    EXPECT_EQ(screen.pixel(x, 0), x == 60 || x == 3) << x;
+  }
+  EXPECT_FALSE(screen.pixel(0, 1));
+  // low resolution never spills into the right half of the packed rows
+  EXPECT_EQ(screen.Rows[31][1], 0u);
+  EXPECT_EQ(screen.Rows[32][0], 0u);
+  // a start past the edge wraps before drawing
+  Screen wrapped, plain;
+  wrapped.draw(64 + 5, 32 + 1, sprite, 2);
+  plain.draw(5, 1, sprite, 2);
+  EXPECT_EQ(wrapped.hash(), plain.hash());
+
+  // high resolution, a wide sprite from (120, 63)
+  const uint8_t wide[4] = {0xFF, 0xFF, 0x80, 0x01};
+  screen.setHires(true);
+  EXPECT_FALSE(screen.draw(120, 63, wide, 2, true));
+  for (size_t x = 0; x < WIN_SIZE_X; x++) {
+    EXPECT_EQ(screen.pixel(x, 63), x >= 120 || x < 8) << x;
+    EXPECT_EQ(screen.pixel(x, 0), x == 120 || x == 7) << x;
+  }
+
+  // scrolling does not wrap, what moves off is lost
+  screen.scrollRight(4);
+  for (size_t x = 0; x < WIN_SIZE_X; x++) {
+    EXPECT_EQ(screen.pixel(x, 63), x >= 124 || (x >= 4 && x < 12)) << x;
+  }
+  screen.scrollDown(1);
+  for (size_t x = 0; x < WIN_SIZE_X; x++) {
+    EXPECT_FALSE(screen.pixel(x, 0)) << x;
+    EXPECT_EQ(screen.pixel(x, 1), x == 124 || x == 11) << x;
+    EXPECT_FALSE(screen.pixel(x, 63)) << x;
+  }
+}
+
+TEST(Screen, DamageIsTheRowsTouched) {
+  const auto rows = [](std::initializer_list<int> ys) {
+    uint64_t mask = 0;
+    for (int y : ys) {
+      mask |= uint64_t(1) << y;
+    }
+    return mask;
+  };
+  for (Engine engine : ENGINES) {
+    Memory mem(4096);
+    Chip8 cpu(&mem, engine, Profile::SChip);
+    const uint8_t zero[5] = {0xF0, 0x90, 0x90, 0x90, 0xF0};
+    for (size_t i = 0; i < 5; i++) {
+      mem.set(0x300 + i, zero[i]);
+    }
+    cpu.FrameBuffer.takeDamage();
+    // a 0 at (0, 30) wraps to the top, then CLS, DRW, SCD 2, HIGH
+    run(cpu, mem,
+        {0xA300, 0x6000, 0x611E, 0xD015, 0x00E0, 0xD015, 0x00C2, 0x00FF,
+         0x1210},
+        4);
+    EXPECT_EQ(cpu.FrameBuffer.takeDamage(), rows({30, 31, 0, 1, 2}));
+    EXPECT_FALSE(cpu.FrameBuffer.changed());
+    EXPECT_EQ(cpu.FrameBuffer.takeDamage(), 0u);
+    cpu.step(1);
+    EXPECT_EQ(cpu.FrameBuffer.takeDamage(), ALL_ROWS);
+    cpu.WaitTick = false;
+    cpu.step(1);
+    cpu.FrameBuffer.takeDamage();
+    cpu.WaitTick = false;
+    cpu.step(1);
+    // a low resolution scroll touches the 32 rows on screen
+    EXPECT_EQ(cpu.FrameBuffer.takeDamage(), 0xFFFFFFFFu);
+    cpu.step(1);
+    EXPECT_EQ(cpu.FrameBuffer.takeDamage(), ALL_ROWS);
+  }
+
+  // restoring damages the rows that differ, on top of what was owed
+  Memory mem(4096);
+  Chip8 cpu(&mem, Engine::Table);
+  const Snapshot before = cpu.snapshot();
+  const uint8_t dot[1] = {0x80};
+  cpu.FrameBuffer.draw(0, 7, dot, 1);
+  cpu.FrameBuffer.takeDamage();
+  cpu.FrameBuffer.draw(0, 20, dot, 1);
+  cpu.restore(before);
+  EXPECT_EQ(cpu.FrameBuffer.takeDamage(), rows({7, 20}));
+}
+
+TEST(Screen, HashIsStable) {
+  // FNV-1a over the rows, words big endian, computed independently
+  Screen screen;
+  EXPECT_EQ(screen.hash(), 0x51d88627df287325u);
+  const uint8_t dot[1] = {0x80};
+  screen.draw(0, 0, dot, 1);
+  EXPECT_EQ(screen.hash(), 0x8f34f45b813073a5u);
+  screen.draw(0, 0, dot, 1);
+  EXPECT_EQ(screen.hash(), 0x51d88627df287325u);
+
+  // the same pixels drawn another way hash the same
+  Screen a, b;
+  const uint8_t bar[2] = {0xF0, 0xF0};
+  a.draw(10, 5, bar, 2);
+  const uint8_t pair[1] = {0xC0};
+  b.draw(10, 5, pair, 1);
+  b.draw(12, 5, pair, 1);
+  b.draw(10, 6, bar, 1);
+  EXPECT_EQ(a.hash(), b.hash());
+  b.draw(63, 31, dot, 1);
+  EXPECT_NE(a.hash(), b.hash());
+
+  // a blank high resolution screen is not a blank low resolution one
+  Screen hires;
+  hires.setHires(true);
+  EXPECT_NE(hires.hash(), screen.hash());
+}
+
+TEST(SChip, HiresScrollAndBigSprites) {
+  for (Engine engine : ENGINES) {
+    Memory mem(4096);
+    Chip8 cpu(&mem, engine, Profile::SChip);
+    // HIGH, 16x16 sprite of the big font at (120, 0), scroll down 2, right 4
+    run(cpu, mem,
+        {0x00FF, 0x6078, 0x6100, 0xA050, 0xD010, 0x00C2, 0x00FB, 0x1210},
+        10);
+    EXPECT_TRUE(cpu.FrameBuffer.Hires);
+    EXPECT_EQ(cpu.FrameBuffer.width(), WIN_SIZE_X);
+    // the first row of the sprite is 16 pixels from 120 wrapping to 7, now
+    // two rows down and four to the right, the part past 127 is gone
+    EXPECT_FALSE(cpu.pixel(124, 1));
+    EXPECT_TRUE(cpu.pixel(124, 2));
+    EXPECT_FALSE(cpu.pixel(3, 2));
+    EXPECT_TRUE(cpu.pixel(4, 2));
+    EXPECT_TRUE(cpu.pixel(11, 2));
+    EXPECT_FALSE(cpu.pixel(12, 2));
+    EXPECT_EQ(cpu.V[0xF], 0);
+  }
+}
+
+TEST(SChip, RplFlagsAndBigFont) {
+  Memory mem(4096);
+  Chip8 cpu(&mem, Engine::Table, Profile::SChip);
+  run(cpu, mem, {0x6007, 0x6109, 0xF175, 0x6000, 0x6100, 0xF185, 0xF130},
+      7);
+  EXPECT_EQ(cpu.V[0], 7);
+  EXPECT_EQ(cpu.V[1], 9);
+  EXPECT_EQ(cpu.I, BIG_FONT_START + 9 * BIG_CHAR_SPRITE_SIZE);
+}
+
+TEST(XOChip, LongLoadIsSkippedWhole) {
+  for (Engine engine : ENGINES) {
+    Memory mem(quirksOf(Profile::XOChip).MemorySize);
+    Chip8 cpu(&mem, engine, Profile::XOChip);
+    // SE V0, 0 skips F000 1234 entirely, then I = 0xBEEF
+    run(cpu, mem, {0x3000, 0xF000, 0x1234, 0xF000, 0xBEEF, 0x120A}, 4);
+    EXPECT_EQ(cpu.I, 0xBEEF);
+    EXPECT_EQ(cpu.PC, 0x20A);
+  }
+}
+
+TEST(XOChip, PlanesDrawSeparately) {
+  Memory mem(quirksOf(Profile::XOChip).MemorySize);
+  Chip8 cpu(&mem, Engine::Table, Profile::XOChip);
+  mem.set(0x300, 0x80);
+  mem.set(0x301, 0xC0);
+  // plane 2 gets a pixel, then both planes get one byte each
+  run(cpu, mem, {0xF201, 0xA300, 0x6000, 0xD001, 0xF301, 0xD001}, 6);
+  EXPECT_EQ(cpu.color(0, 0), 1); // plane 2 cancelled, plane 1 set
+  EXPECT_EQ(cpu.color(1, 0), 2);
+  EXPECT_EQ(cpu.V[0xF], 1);
+  // CLS only clears the selected plane
+  run(cpu, mem, {0xF101, 0x00E0}, 2);
+  EXPECT_EQ(cpu.color(0, 0), 0);
+  EXPECT_EQ(cpu.color(1, 0), 2);
+  // save and load register ranges leave I alone
+  run(cpu, mem, {0x6005, 0x6106, 0xA400, 0x5012, 0x6000, 0x5103, 0x120C},
+      6);
+  EXPECT_EQ(cpu.I, 0x400);
+  EXPECT_EQ(mem.get(0x401), 6);
+  EXPECT_EQ(cpu.V[1], 5);
+  EXPECT_EQ(cpu.V[0], 6);
+}
+
+TEST(Profiles, SnapshotKeepsExtendedState) {
+  Memory mem(quirksOf(Profile::XOChip).MemorySize);
+  Chip8 cpu(&mem, Engine::Table, Profile::XOChip);
+  run(cpu, mem, {0x00FF, 0xF201, 0xF13A, 0xF075, 0xA000, 0xD005, 0x120C}, 6);
+  Snapshot snap;
+  ASSERT_TRUE(decodeSnapshot(encodeSnapshot(cpu.snapshot()), &snap));
+  Memory other(mem.size());
+  Chip8 restored(&other, Engine::Table, Profile::XOChip);
+  ASSERT_TRUE(restored.restore(snap));
+  EXPECT_EQ(restored.FrameBuffer.hash(), cpu.FrameBuffer.hash());
+  EXPECT_TRUE(restored.FrameBuffer.Hires);
+  EXPECT_EQ(restored.FrameBuffer.Planes, 2);
+  EXPECT_EQ(stateHash(restored), stateHash(cpu));
+  Memory small(4096);
+  Chip8 chip8(&small);
+  EXPECT_FALSE(chip8.restore(snap));
+}
+
+// runFrames plays frames of perFrame instructions with keys that only depend
+// on the instruction count, so a machine put back to an earlier point plays
+// the same frames again
+static void runFrames(Chip8 &cpu, int frames, int perFrame) {
+  for (int frame = 0; frame < frames; frame++) {
+    const uint64_t at = cpu.InstrCount / perFrame;
+    cpu.sendInput(at % 16, at % 3 == 0);
+    cpu.step(perFrame);
+    cpu.fixedUpdate();
+  }
+}
+
+TEST(Snapshot, RestoreReplaysTheSameOnEveryEngine) {
+  std::vector<uint16_t> program = EVERY_GROUP;
+  std::mt19937 rng(3);
+  for (int i = 0; i < 512; i++) {
+    program.push_back(rng());
+  }
+  std::vector<uint8_t> patch(2 * program.size());
+  for (uint8_t &byte : patch) {
+    byte = rng();
+  }
+  for (Engine engine : ENGINES) {
+    for (Profile profile : {Profile::Chip8, Profile::XOChip}) {
+      SCOPED_TRACE(int(engine) * 10 + int(profile));
+      Memory mem(quirksOf(profile).MemorySize);
+      Chip8 cpu(&mem, engine, profile);
+      loadProgram(&mem, program);
+      runFrames(cpu, 20, 50);
+      const Snapshot snap = cpu.snapshot();
+      const uint64_t atSnap = stateHash(cpu);
+      const std::vector<uint8_t> bytes = encodeSnapshot(snap);
+
+      // through the byte stream into a new machine
+      Snapshot decoded;
+      ASSERT_TRUE(decodeSnapshot(bytes, &decoded));
+      Memory refMem(mem.size());
+      Chip8 ref(&refMem, engine, profile);
+      ASSERT_TRUE(ref.restore(decoded));
+      EXPECT_EQ(stateHash(ref), atSnap);
+      EXPECT_EQ(encodeSnapshot(ref.snapshot()), bytes);
+      runFrames(ref, 20, 50);
+
+      // back into the first one after it ran other code from the same
+      // addresses, nothing it decoded or compiled may survive
+      mem.write(ROM_START, patch.data(), patch.size());
+      runFrames(cpu, 20, 50);
+      ASSERT_TRUE(cpu.restore(snap));
+      EXPECT_EQ(stateHash(cpu), atSnap);
+      runFrames(cpu, 20, 50);
+      EXPECT_EQ(stateHash(cpu), stateHash(ref));
+      for (size_t addr = 0; addr < mem.size(); addr++) {
+        ASSERT_EQ(mem.get(addr), refMem.get(addr)) << addr;
+      }
+    }
+  }
+}
+
+TEST(Snapshot, PagesAreCopiedOnWrite) {
+  Memory mem(4096);
+  Chip8 cpu(&mem, Engine::Table);
+  // V0 = 0xAB, I = 0x300, LD [I], V0
+  loadProgram(&mem, {0x60AB, 0xA300, 0xF055, 0x1206});
+  const Snapshot first = cpu.snapshot();
+  cpu.step(3);
+  mem.set(0x480, 0xCD);
+  const Snapshot second = cpu.snapshot();
+
+  EXPECT_EQ((*first.Pages[3])[0], 0);
+  EXPECT_EQ((*first.Pages[4])[0x80], 0);
+  EXPECT_EQ((*second.Pages[3])[0], 0xAB);
+  EXPECT_EQ((*second.Pages[4])[0x80], 0xCD);
+  // only the written pages are new copies
+  for (size_t i = 0; i < first.Pages.size(); i++) {
+    EXPECT_EQ(first.Pages[i] == second.Pages[i], i != 3 && i != 4) << i;
+  }
+  // restoring the first puts the old bytes back and leaves it alone
+  ASSERT_TRUE(cpu.restore(first));
+  EXPECT_EQ(mem.get(0x300), 0);
+  mem.set(0x300, 0xEF);
+  EXPECT_EQ((*first.Pages[3])[0], 0);
+  EXPECT_EQ((*second.Pages[3])[0], 0xAB);
+}
+
+TEST(Snapshot, DecodeRejectsCorruptData) {
+  Memory mem(4096);
+  Chip8 cpu(&mem, Engine::Table);
+  // CALL 0x206, V0 = 0xAB
+  run(cpu, mem, {0x2206, 0x1200, 0x0000, 0x60AB, 0x00EE}, 2);
+  const std::vector<uint8_t> good = encodeSnapshot(cpu.snapshot());
+  Snapshot s;
+  ASSERT_TRUE(decodeSnapshot(good, &s));
+  EXPECT_EQ(s.SP, 1);
+  EXPECT_EQ(s.V[0], 0xAB);
+
+  // every truncation, and one byte too many
+  for (size_t len = 0; len < good.size(); len++) {
+    EXPECT_FALSE(decodeSnapshot(
+        std::vector<uint8_t>(good.begin(), good.begin() + len), &s))
+        << len;
+  }
+  std::vector<uint8_t> longer = good;
+  longer.push_back(0);
+  EXPECT_FALSE(decodeSnapshot(longer, &s));
+
+  // "C8SS", version at 4, memory size at 8, profile at 12, SP at 37, the
+  // key wait register at 82
+  const auto corrupt = [&](size_t at, uint8_t val) {
+    std::vector<uint8_t> bad = good;
+    bad[at] = val;
+    return bad;
+  };
+  EXPECT_FALSE(decodeSnapshot(corrupt(0, 'X'), &s));
+  EXPECT_FALSE(decodeSnapshot(corrupt(4, SNAPSHOT_VERSION + 1), &s));
+  EXPECT_FALSE(decodeSnapshot(corrupt(12, PROFILE_COUNT), &s));
+  EXPECT_FALSE(decodeSnapshot(corrupt(37, STACK_SIZE + 1), &s));
+  EXPECT_TRUE(decodeSnapshot(corrupt(37, STACK_SIZE), &s));
+  EXPECT_FALSE(decodeSnapshot(corrupt(82, 0x10), &s));
+  EXPECT_TRUE(decodeSnapshot(corrupt(82, 0xF), &s));
+  // sizes that disagree with the memory bytes, or no Memory could have
+  EXPECT_FALSE(decodeSnapshot(corrupt(9, 0x20), &s));
+  EXPECT_FALSE(decodeSnapshot(corrupt(9, 0x08), &s));
+  std::vector<uint8_t> odd = corrupt(8, 0x01);
+  odd.push_back(0);
+  EXPECT_FALSE(decodeSnapshot(odd, &s));
+  std::vector<uint8_t> empty = corrupt(9, 0x00);
+  empty.resize(good.size() - 4096);
+  EXPECT_FALSE(decodeSnapshot(empty, &s));
+}
+
+// History is what a Rewind test expects back: the state hash and memory
+// after every recorded frame
+struct History {
+  std::vector<uint64_t> Hashes;
+  std::vector<std::vector<uint8_t>> Memories;
+
+  void record(Rewind &rewind, Chip8 &cpu, const Memory &mem) {
+    rewind.record(cpu);
+    Hashes.push_back(stateHash(cpu));
+    std::vector<uint8_t> bytes(mem.size());
+    mem.read(0, bytes.data(), bytes.size());
+    Memories.push_back(bytes);
+  }
+  // matches checks cpu against the frame ago frames before the newest
+  testing::AssertionResult matches(const Chip8 &cpu, const Memory &mem,
+                                   size_t ago) const {
+    const size_t frame = Hashes.size() - 1 - ago;
+    if (stateHash(cpu) != Hashes[frame]) {
+      return testing::AssertionFailure() << "registers or screen of " << ago;
+    }
+    for (size_t addr = 0; addr < mem.size(); addr++) {
+      if (mem.get(addr) != Memories[frame][addr]) {
+        return testing::AssertionFailure() << "memory at " << addr << " of "
+                                           << ago;
+      }
+    }
+    return testing::AssertionSuccess();
+  }
+};
+
+// rewindGame loads a program that draws, stores and loads every frame
+static void rewindGame(Memory &mem) {
+  std::vector<uint16_t> program = EVERY_GROUP;
+  std::mt19937 rng(11);
+  for (int i = 0; i < 256; i++) {
+    program.push_back(rng());
+  }
+  loadProgram(&mem, program);
+}
+
+TEST(Rewind, SeekAndBackRestoreEveryFrame) {
+  Memory mem(4096);
+  Chip8 cpu(&mem, Engine::Table);
+  rewindGame(mem);
+  Rewind rewind(100, 8);
+  History history;
+  for (int frame = 0; frame < 30; frame++) {
+    runFrames(cpu, 1, 100);
+    history.record(rewind, cpu, mem);
+  }
+  ASSERT_EQ(rewind.frames(), 30u);
+  ASSERT_NE(history.Hashes.front(), history.Hashes.back());
+  ASSERT_NE(history.Memories.front(), history.Memories.back());
+  for (size_t ago : {29, 0, 7, 8, 9, 16, 1}) {
+    ASSERT_TRUE(rewind.seek(cpu, ago));
+    EXPECT_TRUE(history.matches(cpu, mem, ago));
+  }
+  EXPECT_FALSE(rewind.seek(cpu, 30));
+  EXPECT_EQ(rewind.frames(), 30u);
+
+  // back steps over the keyframes at 24, 16 and 8 down to the first frame
+  for (size_t ago = 1; ago < 30; ago++) {
+    ASSERT_TRUE(rewind.back(cpu)) << ago;
+    EXPECT_TRUE(history.matches(cpu, mem, ago));
+    EXPECT_EQ(rewind.frames(), 30u - ago);
+  }
+  EXPECT_FALSE(rewind.back(cpu));
+
+  // a history recorded on from there plays back the new frames
+  history = History();
+  history.record(rewind, cpu, mem);
+  for (int frame = 0; frame < 10; frame++) {
+    runFrames(cpu, 1, 100);
+    history.record(rewind, cpu, mem);
+  }
+  for (size_t ago = 0; ago <= 10; ago++) {
+    ASSERT_TRUE(rewind.seek(cpu, ago));
+    EXPECT_TRUE(history.matches(cpu, mem, ago));
+  }
+}
+
+TEST(Rewind, KeepsAtLeastItsCapacity) {
+  Memory mem(4096);
+  Chip8 cpu(&mem, Engine::Table);
+  rewindGame(mem);
+  const size_t capacity = 10, interval = 4;
+  Rewind rewind(capacity, interval);
+  History history;
+  for (size_t frame = 1; frame <= 40; frame++) {
+    runFrames(cpu, 1, 100);
+    history.record(rewind, cpu, mem);
+    // whole groups are dropped, never taking the history under capacity
+    EXPECT_GE(rewind.frames(), std::min(frame, capacity)) << frame;
+    EXPECT_LT(rewind.frames(), capacity + interval) << frame;
+  }
+  const size_t bytes = rewind.bytes();
+  ASSERT_TRUE(rewind.seek(cpu, capacity - 1));
+  EXPECT_TRUE(history.matches(cpu, mem, capacity - 1));
+  rewind.clear();
+  EXPECT_EQ(rewind.frames(), 0u);
+  EXPECT_EQ(rewind.bytes(), 0u);
+  EXPECT_GT(bytes, 0u);
+}
+
+TEST(Rewind, OtherMemorySizeStartsAKeyframe) {
+  Memory small(4096);
+  Chip8 chip8(&small, Engine::Table);
+  rewindGame(small);
+  Memory big(quirksOf(Profile::XOChip).MemorySize);
+  Chip8 xochip(&big, Engine::Table, Profile::XOChip);
+  rewindGame(big);
+
+  Rewind rewind(100, 60);
+  History history;
+  runFrames(chip8, 1, 100);
+  history.record(rewind, chip8, small);
+  runFrames(chip8, 1, 100);
+  history.record(rewind, chip8, small);
+  // the XO-CHIP frame cannot be a delta against a CHIP-8 keyframe
+  runFrames(xochip, 1, 100);
+  history.record(rewind, xochip, big);
+  ASSERT_EQ(rewind.frames(), 3u);
+
+  ASSERT_TRUE(rewind.seek(xochip, 0));
+  EXPECT_TRUE(history.matches(xochip, big, 0));
+  EXPECT_FALSE(rewind.seek(xochip, 1));
+  ASSERT_TRUE(rewind.seek(chip8, 1));
+  EXPECT_TRUE(history.matches(chip8, small, 1));
+  ASSERT_TRUE(rewind.back(chip8));
+  EXPECT_TRUE(history.matches(chip8, small, 1));
+}
+
+TEST(Scheduler, TimersTickOnSixtyHertzBoundaries) {
+  Memory mem(4096);
+  Chip8 cpu(&mem);
+  loadProgram(&mem, {0x6064, 0xF015, 0x1204}); // DT = 100, spin
+  Scheduler scheduler(600);
+  scheduler.advance(cpu, 2);
+  ASSERT_EQ(cpu.DT, 100);
+  // a tick every 10 cycles at 600 ips
+  scheduler.advance(cpu, 7);
+  EXPECT_EQ(cpu.DT, 100);
+  scheduler.advance(cpu, 1);
+  EXPECT_EQ(cpu.DT, 99);
+  scheduler.advance(cpu, 600);
+  EXPECT_EQ(cpu.DT, 39);
+  EXPECT_EQ(scheduler.Ticks, 61u);
+  EXPECT_EQ(cpu.InstrCount, 610u);
+}
+
+TEST(Scheduler, TimersRunWhileWaitingForKey) {
+  Memory mem(4096);
+  Chip8 cpu(&mem);
+  loadProgram(&mem, {0x6064, 0xF015, 0xF00A}); // DT = 100, wait for key
+  Scheduler scheduler(700);
+  scheduler.advance(cpu, 700);
+  EXPECT_TRUE(cpu.Paused);
+  EXPECT_EQ(cpu.InstrCount, 3u);
+  EXPECT_EQ(scheduler.Ticks, 60u);
+  EXPECT_EQ(cpu.DT, 40);
+}
+
+TEST(Scheduler, RunKeepsTheRate) {
+  Memory mem(4096);
+  Chip8 cpu(&mem);
+  loadProgram(&mem, {0x1200});
+  Scheduler scheduler(1000);
+  for (int frame = 0; frame < 60; frame++) {
+    scheduler.run(cpu, 1.0 / 60);
+  }
+  EXPECT_NEAR(double(scheduler.Cycles), 1000, 1);
+  EXPECT_NEAR(double(scheduler.Ticks), 60, 1);
+  scheduler.setIps(300);
+  scheduler.run(cpu, 0.1);
+  EXPECT_NEAR(double(scheduler.Cycles), 1030, 1);
+}
+
+TEST(TripleBuffer, ConsumerSeesNewestValue) {
+  TripleBuffer<int> buf;
+  EXPECT_FALSE(buf.update());
+  buf.back() = 1;
+  buf.publish();
+  buf.back() = 2;
+  buf.publish();
+  ASSERT_TRUE(buf.update());
+  EXPECT_EQ(buf.front(), 2);
+  EXPECT_FALSE(buf.update());
+  EXPECT_EQ(buf.front(), 2);
+}
+
+TEST(TripleBuffer, ValuesAreNeverTorn) {
+  struct Pair {
+    uint64_t A = 0, B = 0;
+  };
+  TripleBuffer<Pair> buf;
+  std::thread producer([&] {
+    for (uint64_t i = 1; i <= 200000; i++) {
+      buf.back() = {i, ~i};
+      buf.publish();
+    }
+  });
+  uint64_t last = 0;
+  while (last != 200000) {
+    if (buf.update()) {
+      ASSERT_EQ(buf.front().B, ~buf.front().A);
+      ASSERT_GE(buf.front().A, last);
+      last = buf.front().A;
+    }
+  }
+  producer.join();
+}
+
+TEST(SpscQueue, KeepsOrderAndBounds) {
+  SpscQueue<int, 4> queue;
+  int item;
+  EXPECT_FALSE(queue.pop(&item));
+  for (int i = 0; i < 4; i++) {
+    EXPECT_TRUE(queue.push(i));
+  }
+  EXPECT_FALSE(queue.push(4));
+  for (int i = 0; i < 4; i++) {
+    ASSERT_TRUE(queue.pop(&item));
+    EXPECT_EQ(item, i);
+  }
+  EXPECT_FALSE(queue.pop(&item));
+}
+
+// waitFrame polls the CPU thread like the renderer until pred holds
+template <typename Pred> static bool waitFrame(CpuThread &thread, Pred pred) {
+  const auto end = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+  while (std::chrono::steady_clock::now() < end) {
+    thread.update();
+    if (pred(thread.frame())) {
+      return true;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  return false;
+}
+
+TEST(CpuThread, StepsKeysAndPublishes) {
+  Memory mem(4096);
+  Chip8 cpu(&mem);
+  loadProgram(&mem, KEY_GAME);
+  Scheduler scheduler;
+  CpuThread thread(cpu, scheduler);
+  thread.start();
+  ASSERT_TRUE(thread.update());
+  EXPECT_EQ(thread.frame().InstrCount, 0u);
+  thread.send(CpuOp::Step);
+  ASSERT_TRUE(waitFrame(thread, [](const CpuFrame &f) { return f.Paused; }));
+  thread.send(CpuOp::KeyDown, 0x5);
+  thread.send(CpuOp::Run, 1);
+  ASSERT_TRUE(waitFrame(thread, [](const CpuFrame &f) {
+    return !f.Paused && f.InstrCount > 100 && f.KeyPad[0x5];
+  }));
+  thread.stop();
+  EXPECT_EQ(cpu.V[0], 0x5);
+  EXPECT_GT(scheduler.Cycles, 100u);
+}
+
+TEST(CpuThread, PublishesOnlyFinishedFrames) {
+  Memory mem(4096);
+  Chip8 cpu(&mem);
+  // every frame: CLS, draw the 0 glyph, then wait out DT = 1
+  loadProgram(&mem, {0xA000, 0x00E0, 0xD015, 0x6201, 0xF215, 0xF307, 0x3300,
+                     0x120A, 0x1202});
+  Scheduler scheduler;
+  CpuThread thread(cpu, scheduler);
+  thread.start();
+  thread.send(CpuOp::Run, 1);
+  const auto end = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+  int frames = 0;
+  while (std::chrono::steady_clock::now() < end) {
+    if (thread.update() && thread.frame().InstrCount > 0) {
+      const CpuFrame &f = thread.frame();
+      frames++;
+      // taken on a timer tick, while the program waits with its sprite up
+      const uint64_t tick = f.InstrCount * TIMER_HZ / DEFAULT_IPS;
+      EXPECT_EQ((tick * DEFAULT_IPS + TIMER_HZ - 1) / TIMER_HZ, f.InstrCount);
+      EXPECT_TRUE(f.FrameBuffer.pixel(0, 0)) << f.InstrCount;
+      EXPECT_GE(f.PC, 0x20A);
+      // the code around PC came along, the program never writes to it
+      ASSERT_EQ(uint16_t(f.PC - f.CodeStart), CPU_FRAME_CODE / 2);
+      EXPECT_EQ(f.Code[CPU_FRAME_CODE / 2], mem.get(f.PC));
+      EXPECT_EQ(f.Code[CPU_FRAME_CODE / 2 + 1], mem.get(f.PC + 1));
+    }
+    std::this_thread::sleep_for(std::chrono::microseconds(500));
+  }
+  thread.stop();
+  EXPECT_GT(frames, 30);
+}
+
+TEST(ThreadPool, RunsEveryTaskBeforeWaitReturns) {
+  ThreadPool pool(4);
+  std::atomic<int> ran(0);
+  std::vector<int> finished(200, 0);
+  for (int round = 0; round < 2; round++) {
+    for (size_t i = 0; i < finished.size(); i++) {
+      pool.submit([&, i] {
+        if (i % 50 == 0) {
+          std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+        finished[i]++;
+        ran++;
+      });
+    }
+    pool.wait();
+    // wait has to see the slow tasks through, not just the queues emptying
+    EXPECT_EQ(ran.load(), 200 * (round + 1));
+    EXPECT_EQ(std::count(finished.begin(), finished.end(), round + 1), 200);
+  }
+}
+
+TEST(ThreadPool, IdleWorkersStealFromABusyOne) {
+  ThreadPool pool(2);
+  const int shortTasks = 64;
+  std::atomic<bool> started(false);
+  std::atomic<int> ran(0);
+  bool sawAllRun = false;
+  // the long task holds its worker until every short task ran, half of them
+  // are queued behind it and only get run by being stolen
+  pool.submit([&] {
+    started = true;
+    const auto deadline =
+        std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while (ran < shortTasks && std::chrono::steady_clock::now() < deadline) {
+      std::this_thread::yield();
+    }
+    sawAllRun = ran == shortTasks;
+  });
+  while (!started) {
+    std::this_thread::yield();
+  }
+  for (int i = 0; i < shortTasks; i++) {
+    pool.submit([&] { ran++; });
+  }
+  pool.wait();
+  EXPECT_TRUE(sawAllRun);
+  EXPECT_EQ(ran.load(), shortTasks);
+}
+
+TEST(Memory, BulkAccessWrapsAtTheEnd) {
+  Memory mem(3000); // rounded up to 4096
+  ASSERT_EQ(mem.size(), 4096u);
+  mem.set16(0x300, 0xF000);
+  EXPECT_EQ(mem.get(0x300), 0xF0);
+  EXPECT_EQ(mem.fetch16(0x300), 0xF000);
+  EXPECT_EQ(mem.fetch16(0x300 + 4096), 0xF000);
+
+  const uint8_t bytes[4] = {1, 2, 3, 4};
+  const uint32_t gen = mem.generation();
+  mem.write(4094, bytes, 4);
+  EXPECT_NE(mem.generation(), gen);
+  EXPECT_EQ(mem.get(4095), 2);
+  EXPECT_EQ(mem.get(0), 3);
+  EXPECT_EQ(mem.fetch16(4095), 0x0203);
+  uint8_t back[4];
+  mem.read(4094 + 4096, back, 4);
+  EXPECT_TRUE(std::equal(bytes, bytes + 4, back));
+}
+
+TEST(Stack, UnderflowAndOverflowPause) {
+  for (Engine engine : ENGINES) {
+    Memory memA(4096), memB(4096);
+    Chip8 ret(&memA, engine), call(&memB, engine);
+    run(ret, memA, {0x00EE}, 4);
+    EXPECT_TRUE(ret.errStackUnderflow);
+    EXPECT_TRUE(ret.Paused);
+    EXPECT_EQ(ret.SP, 0);
+    // CALL to itself until the stack is full
+    run(call, memB, {0x2200}, 20);
+    EXPECT_TRUE(call.errStackOverflow);
+    EXPECT_EQ(call.SP, STACK_SIZE);
+    EXPECT_EQ(call.Stack[STACK_SIZE - 1], 0x202);
+  }
+}
+
+TEST(Reset, BootsLikeANewCpu) {
+  for (Engine engine : ENGINES) {
+    MachinePool pool;
+    Machine *m = pool.get(engine, Profile::SChip);
+    // scribble over registers, stack, screen, memory and the decode cache
+    const std::vector<uint16_t> program = {0x00FF, 0x6A07, 0xFA29, 0xD015,
+                                           0xA000, 0xF955, 0x2212, 0x1202,
+                                           0x0000, 0x7B01, 0x00EE};
+    run(m->Cpu, m->Mem, program, 50);
+    ASSERT_NE(m->Mem.get(0), 0xF0);
+
+    uint8_t rom[64];
+    for (size_t i = 0; i < program.size(); i++) {
+      rom[2 * i] = program[i] >> 8;
+      rom[2 * i + 1] = program[i] & 0xFF;
+    }
+    ASSERT_EQ(pool.get(engine, Profile::SChip, rom, 2 * program.size()), m);
+    Memory mem(4096);
+    Chip8 fresh(&mem, engine, Profile::SChip);
+    loadProgram(&mem, program);
+    EXPECT_EQ(stateHash(m->Cpu), stateHash(fresh));
+    EXPECT_EQ(m->Cpu.InstrCount, 0u);
+    EXPECT_FALSE(m->Cpu.FrameBuffer.Hires);
+    for (size_t addr = 0; addr < mem.size(); addr++) {
+      ASSERT_EQ(m->Mem.get(addr), mem.get(addr)) << addr;
+    }
+    // and it runs the same from there
+    for (int i = 0; i < 20; i++) {
+      m->Cpu.step(1);
+      fresh.step(1);
+      ASSERT_EQ(stateHash(m->Cpu), stateHash(fresh));
+    }
+  }
+
+  MachinePool pool;
+  std::vector<uint8_t> big(4096);
+  EXPECT_EQ(pool.get(Engine::Table, Profile::Chip8, big.data(), big.size()),
+            nullptr);
+}
+
+TEST(Idle, TimerPollSkipsAheadExactly) {
+  // DT = 5, then spin until it reads 0 and park on a jump to itself
+  const std::vector<uint16_t> program = {0x6005, 0xF015, 0xF107,
+                                         0x3100, 0x1204, 0x120A};
+  for (Engine engine : ENGINES) {
+    Memory memA(4096), memB(4096);
+    Chip8 fast(&memA, engine), slow(&memB, engine);
+    loadProgram(&memA, program);
+    loadProgram(&memB, program);
+    for (int frame = 0; frame < 8; frame++) {
+      fast.step(1000);
+      for (int i = 0; i < 1000; i++) {
+        slow.step(1);
+      }
+      ASSERT_EQ(fast.InstrCount, slow.InstrCount);
+      ASSERT_EQ(stateHash(fast), stateHash(slow)) << frame;
+      fast.fixedUpdate();
+      slow.fixedUpdate();
+    }
+    EXPECT_EQ(fast.PC, 0x20A);
+    EXPECT_GT(fast.IdleSkipped, 7000u);
+    EXPECT_EQ(slow.IdleSkipped, 0u);
+  }
+}
+
+TEST(Idle, ResetStartsOver) {
+  // spin on DT, reset while the loop is being sampled and run it again
+  const std::vector<uint8_t> rom = {0x60, 0x05, 0xF0, 0x15, 0xF1, 0x07,
+                                    0x31, 0x00, 0x12, 0x04, 0x12, 0x0A};
+  for (Engine engine : ENGINES) {
+    Memory memA(4096), memB(4096);
+    Chip8 used(&memA, engine), fresh(&memB, engine);
+    used.reset(rom.data(), rom.size());
+    fresh.reset(rom.data(), rom.size());
+    used.step(1000);
+    used.fixedUpdate();
+    used.step(37);
+    used.reset(rom.data(), rom.size());
+    EXPECT_EQ(used.IdleSkipped, 0u);
+    for (int frame = 0; frame < 4; frame++) {
+      used.step(1000);
+      fresh.step(1000);
+      ASSERT_EQ(used.InstrCount, fresh.InstrCount);
+      ASSERT_EQ(used.IdleSkipped, fresh.IdleSkipped) << frame;
+      ASSERT_EQ(stateHash(used), stateHash(fresh)) << frame;
+      used.fixedUpdate();
+      fresh.fixedUpdate();
+    }
+  }
+}
+
+TEST(Idle, LoopsThatCountAreNotIdle) {
+  for (Engine engine : ENGINES) {
+    Memory mem(4096);
+    Chip8 cpu(&mem, engine);
+    loadProgram(&mem, {0x7001, 0x1200});
+    cpu.step(100);
+    EXPECT_EQ(cpu.V[0], 50);
+    EXPECT_EQ(cpu.IdleSkipped, 0u);
+  }
+}
+
+// CaptureSink keeps every sample for the tests to look at
+class CaptureSink : public AudioSink {
+public:
+  void write(const int16_t *samples, size_t n) override {
+    Samples.insert(Samples.end(), samples, samples + n);
+  }
+
+  std::vector<int16_t> Samples;
+};
+
+// sound runs program for cycles at 600 instructions a second, 80 samples a
+// cycle, and returns what it played
+static std::vector<int16_t> sound(Engine engine, Profile profile,
+                                  const std::vector<uint16_t> &program,
+                                  uint64_t cycles) {
+  Memory mem(quirksOf(profile).MemorySize);
+  Chip8 cpu(&mem, engine, profile);
+  loadProgram(&mem, program);
+  for (uint16_t addr = 0x300; addr < 0x310; addr++) {
+    mem.set(addr, 0xF0);
+  }
+  CaptureSink sink;
+  Audio audio(&sink);
+  Scheduler scheduler(600);
+  scheduler.onSync([&](const Chip8 &c, uint64_t cycle) {
+    audio.follow(c, cycle, scheduler.ips());
+  });
+  audio.follow(cpu, 0, scheduler.ips());
+  scheduler.advance(cpu, cycles);
+  return sink.Samples;
+}
+
+TEST(Audio, SoundTimerGatesTheBeepToTheSample) {
+  for (Engine engine : ENGINES) {
+    // ST = 6 on cycle 2, it runs out on the sixth tick, cycle 60
+    const auto samples =
+        sound(engine, Profile::Chip8, {0x6006, 0xF018, 0x1204}, 120);
+    ASSERT_EQ(samples.size(), 120u * 80);
+    for (size_t i = 0; i < samples.size(); i++) {
+      ASSERT_EQ(samples[i] != 0, i >= 2 * 80 && i < 60 * 80) << i;
+    }
+    EXPECT_EQ(samples[2 * 80], AUDIO_VOLUME);
+  }
+}
+
+TEST(Audio, XOChipPlaysThePatternAtItsPitch) {
+  for (Engine engine : ENGINES) {
+    // pattern 0xF0... from 0x300 at pitch 64, 4000 bits a second or 12
+    // samples a bit, ST = 2 on cycle 6 until the second tick, cycle 20
+    const auto samples = sound(engine, Profile::XOChip,
+                               {0xA300, 0xF002, 0x6040, 0xF03A, 0x6002,
+                                0xF018, 0x120C},
+                               30);
+    ASSERT_EQ(samples.size(), 30u * 80);
+    for (size_t i = 0; i < samples.size(); i++) {
+      int16_t want = 0;
+      if (i >= 6 * 80 && i < 20 * 80) {
+        want = (i - 6 * 80) / 48 % 2 == 0 ? AUDIO_VOLUME : -AUDIO_VOLUME;
+      }
+      ASSERT_EQ(samples[i], want) << i;
+    }
+  }
+}
+
+TEST(Audio, RingSinkDropsWhatDoesNotFit) {
+  RingSink ring;
+  std::vector<int16_t> in(AUDIO_RING_SIZE + 10);
+  for (size_t i = 0; i < in.size(); i++) {
+    in[i] = int16_t(i);
+  }
+  ring.write(in.data(), in.size());
+  EXPECT_EQ(ring.Dropped, 10u);
+  std::vector<int16_t> out(in.size());
+  ASSERT_EQ(ring.read(out.data(), out.size()), AUDIO_RING_SIZE);
+  EXPECT_TRUE(
+      std::equal(in.begin(), in.begin() + AUDIO_RING_SIZE, out.begin()));
+  EXPECT_EQ(ring.read(out.data(), out.size()), 0u);
+}
+
+TEST(Font, GlyphsAreFiveRowsWithoutGaps) {
+  Memory mem(4096);
+  Chip8 cpu(&mem);
+  // LD F, V0 for 8, DRW at (0, 0)
+  run(cpu, mem, {0x6008, 0xF029, 0x6000, 0xD005}, 4);
+  EXPECT_EQ(cpu.I, 8 * CHAR_SPRITE_SIZE);
+  for (size_t y = 0; y < 5; y++) {
+    EXPECT_TRUE(cpu.pixel(0, y)) << y;
+  }
+  EXPECT_FALSE(cpu.pixel(0, 5));
+}
+
+TEST(Fuzz, RandomInputsRunTheSameOnEveryEngine) {
+  std::mt19937 rng(7);
+  std::vector<uint8_t> coverage(FUZZ_COVERAGE_SIZE);
+  for (int i = 0; i < 200; i++) {
+    std::vector<uint8_t> input(rng() % 300);
+    for (auto &b : input) {
+      b = rng();
+    }
+    EXPECT_EQ(fuzzOne(input.data(), input.size(), 2000, coverage.data()), "");
+  }
+  EXPECT_GT(std::count_if(coverage.begin(), coverage.end(),
+                          [](uint8_t c) { return c != 0; }),
+            100);
+
+  const uint8_t rom[4] = {0xF0, 0x0A, 0x12, 0x00};
+  FuzzCase c;
+  c.Prof = Profile::XOChip;
+  c.Eng = Engine::Jit;
+  c.Seed = 0x1234;
+  c.Inputs = {{10, 5, true}, {300, 5, false}};
+  c.Rom = rom;
+  c.RomSize = sizeof(rom);
+  const std::vector<uint8_t> input = encodeFuzzCase(c);
+  const FuzzCase back = decodeFuzzCase(input.data(), input.size());
+  EXPECT_EQ(back.Prof, c.Prof);
+  EXPECT_EQ(back.Eng, c.Eng);
+  EXPECT_EQ(back.Seed, c.Seed);
+  ASSERT_EQ(back.Inputs.size(), 2u);
+  EXPECT_EQ(back.Inputs[1].At, 300u);
+  EXPECT_FALSE(back.Inputs[1].Down);
+  ASSERT_EQ(back.RomSize, sizeof(rom));
+  EXPECT_TRUE(std::equal(rom, rom + sizeof(rom), back.Rom));
+}
+
+TEST(Disassembler, GroupsDoNotFallThrough) {
+  Memory mem(4096);
+  Chip8 cpu(&mem);
+  const uint8_t shr[2] = {0x81, 0x26};
+  const uint8_t undefined8[2] = {0x80, 0x0F};
+  const uint8_t undefinedE[2] = {0xE0, 0x00};
+  EXPECT_EQ(cpu.dissasemble(shr), "SHR V01");
+  EXPECT_EQ(cpu.dissasemble(undefined8), "");
+  EXPECT_EQ(cpu.dissasemble(undefinedE), "");
+  EXPECT_EQ(disassemble(0xF1, 0x1E, quirksOf(Profile::Chip8)), "ADD I, V01");
+  // extended instructions only exist on their profiles
+  EXPECT_EQ(disassemble(0x00, 0xFF, quirksOf(Profile::Chip8)), "SYS 0ff");
+  EXPECT_EQ(disassemble(0x00, 0xFF, quirksOf(Profile::SChip)), "HIGH");
+  EXPECT_EQ(disassemble(0xF0, 0x00, quirksOf(Profile::XOChip), 0x1234),
+            "LD I, 00001234");
+}
+
+TEST(Analyser, FindsBlocksCallsAndJumpTables) {
+  const std::vector<uint8_t> rom = {
+      0x60, 0x02, // 200: LD V0, 2
+      0xB2, 0x06, // 202: JP V0, 0x206
+      0x00, 0x00, // 204: never reached
+      0x12, 0x0C, // 206: JP 0x20C     jump table
+      0x12, 0x0E, // 208: JP 0x20E
+      0x00, 0x00, // 20A: never reached
+      0x12, 0x0C, // 20C: JP 0x20C
+      0x22, 0x12, // 20E: CALL 0x212
+      0x12, 0x10, // 210: JP 0x210
+      0xA2, 0x16, // 212: LD I, 0x216
+      0x00, 0xEE, // 214: RET
+      0xF0, 0x90, // 216: sprite
+  };
+  const Analysis a =
+      analyseRom(rom.data(), rom.size(), quirksOf(Profile::Chip8));
+  EXPECT_TRUE(a.isCode(0x206));
+  EXPECT_TRUE(a.isCode(0x214));
+  EXPECT_FALSE(a.isCode(0x204));
+  EXPECT_FALSE(a.isCode(0x20A));
+  EXPECT_FALSE(a.isCode(0x216));
+  EXPECT_EQ(a.DataRefs.count(0x216), 1u);
+
+  ASSERT_EQ(a.JumpTables.size(), 1u);
+  EXPECT_EQ(a.JumpTables[0].At, 0x202);
+  EXPECT_EQ(a.JumpTables[0].Entries, (std::vector<uint16_t>{0x206, 0x208}));
+  ASSERT_EQ(a.Calls.count(0x212), 1u);
+  EXPECT_EQ(a.Calls.at(0x212), std::vector<uint16_t>{0x20E});
+
+  std::vector<uint16_t> starts;
+  for (const auto &block : a.Blocks) {
+    starts.push_back(block.Start);
+  }
+  EXPECT_EQ(starts, (std::vector<uint16_t>{0x200, 0x206, 0x208, 0x20C, 0x20E,
+                                           0x210, 0x212}));
+  EXPECT_EQ(a.Blocks[0].End, 0x204);
+  EXPECT_EQ(a.Blocks[0].Next, (std::vector<uint16_t>{0x206, 0x208}));
+  EXPECT_EQ(a.Blocks.back().End, 0x216);
+  EXPECT_TRUE(a.Blocks.back().Next.empty());
+
+  std::stringstream listing;
+  writeListing(listing, a, rom.data(), quirksOf(Profile::Chip8));
+  std::string header;
+  std::getline(listing, header);
+  EXPECT_EQ(header,
+            listingHeader(rom.data(), rom.size(), quirksOf(Profile::Chip8)));
+  EXPECT_NE(listing.str().find("sub_0212:"), std::string::npos);
+}
+
+TEST(Profiler, CountsKindsHeatStepsAndStacks) {
+  if (!PROFILER_ENABLED) {
+    GTEST_SKIP() << "built without CHIP8_PROFILER";
+  }
+  for (auto engine : {Engine::Table, Engine::Threaded}) {
+    Memory mem(4096);
+    Chip8 cpu(&mem, engine);
+    Profiler profiler(mem.size());
+    cpu.profiler = &profiler;
+    // CALL 0x206, CLS, JP 0x204 forever, the subroutine is LD V0, 1; RET
+    loadProgram(&mem, {0x2206, 0x00E0, 0x1204, 0x6001, 0x00EE});
+    cpu.step(10); // stops at the CLS
+    cpu.step(10);
+    EXPECT_EQ(profiler.Kinds[K_CALL], 1u);
+    EXPECT_EQ(profiler.Kinds[K_RET], 1u);
+    EXPECT_EQ(profiler.Kinds[K_JMP], 10u);
+    EXPECT_EQ(profiler.Heat[0x204], 10u);
+    EXPECT_EQ(profiler.Heat[0x206], 1u);
+    EXPECT_EQ(profiler.Steps[size_t(StepEnd::Clear)].Calls, 1u);
+    EXPECT_EQ(profiler.Steps[size_t(StepEnd::Clear)].Instructions, 4u);
+    EXPECT_EQ(profiler.Steps[size_t(StepEnd::Budget)].Instructions, 10u);
+
+    std::stringstream folded;
+    ASSERT_TRUE(profiler.writeFolded(folded));
+    EXPECT_EQ(folded.str(), "main 12\nmain;sub_0206 2\n");
+    std::stringstream json;
+    ASSERT_TRUE(profiler.writeJson(json));
+    EXPECT_NE(json.str().find("\"JMP\": 10"), std::string::npos);
+  }
+}
+
+static void writeFile(const std::string &path,
+                      const std::vector<uint8_t> &bytes) {
+  std::ofstream out(path, std::ios::binary);
+  out.write(reinterpret_cast<const char *>(bytes.data()), bytes.size());
+}
+
+TEST(Rom, LoadsWholeFileOrNothing) {
+  char dir[] = "/tmp/chip8-test-XXXXXX";
+  ASSERT_NE(mkdtemp(dir), nullptr);
+  const std::string fits = std::string(dir) + "/fits.ch8";
+  const std::string big = std::string(dir) + "/big.ch8";
+  writeFile(fits, std::vector<uint8_t>(4096 - ROM_START, 0xAB));
+  writeFile(big, std::vector<uint8_t>(4096 - ROM_START + 1, 0xCD));
+
+  Memory mem(4096);
+  std::string err;
+  EXPECT_EQ(loadRom(&mem, ROM_START, fits, &err), 4096u - ROM_START);
+  EXPECT_EQ(mem.get(ROM_START), 0xAB);
+  EXPECT_EQ(mem.get(4095), 0xAB);
+  // one byte too many would wrap over the font, nothing is loaded
+  EXPECT_EQ(loadRom(&mem, ROM_START, big, &err), 0u);
+  EXPECT_FALSE(err.empty());
+  EXPECT_EQ(mem.get(0), 0);
+  EXPECT_EQ(mem.get(ROM_START), 0xAB);
+  EXPECT_EQ(loadRom(&mem, ROM_START, std::string(dir) + "/missing.ch8"), 0u);
+
+  Memory xo(quirksOf(Profile::XOChip).MemorySize);
+  EXPECT_EQ(loadRom(&xo, ROM_START, big), 4096u - ROM_START + 1);
+  remove(fits.c_str());
+  remove(big.c_str());
+  rmdir(dir);
+}
+
+TEST(RomIndex, DetectsProfilesAndSkipsUnchangedRoms) {
+  char dir[] = "/tmp/chip8-test-XXXXXX";
+  ASSERT_NE(mkdtemp(dir), nullptr);
+  const std::string d(dir);
+  // CLS, JP 0x200, then sprite bytes that would read as SCHIP's HIGH
+  writeFile(d + "/plain_rom.ch8", {0x00, 0xE0, 0x12, 0x00, 0x00, 0xFF});
+  // the HIGH is only reached through a skip
+  writeFile(d + "/hires.ch8", {0x30, 0x01, 0x12, 0x00, 0x00, 0xFF});
+  // LD I, 0x0300 as the first instruction
+  writeFile(d + "/planes.ch8", {0xF0, 0x00, 0x03, 0x00});
+  writeFile(d + "/named.sc8", {0x12, 0x00});
+  writeFile(d + "/notes.txt", {'h', 'i'});
+
+  size_t read = 0;
+  const auto roms = indexRoms(d, {}, &read);
+  ASSERT_EQ(roms.size(), 4u);
+  EXPECT_EQ(read, 4u);
+  EXPECT_EQ(roms[0].Path, "hires.ch8");
+  EXPECT_EQ(roms[0].Prof, Profile::SChip);
+  EXPECT_EQ(roms[1].Prof, Profile::SChip); // named.sc8
+  EXPECT_EQ(roms[2].Prof, Profile::Chip8); // plain_rom.ch8
+  EXPECT_EQ(roms[2].Title, "plain rom");
+  EXPECT_EQ(roms[2].Size, 6u);
+  EXPECT_EQ(roms[3].Prof, Profile::XOChip); // planes.ch8
+
+  std::stringstream text;
+  ASSERT_TRUE(writeRomIndex(text, roms));
+  std::vector<RomInfo> back;
+  ASSERT_TRUE(readRomIndex(text, &back));
+  ASSERT_EQ(back.size(), roms.size());
+  for (size_t i = 0; i < roms.size(); i++) {
+    EXPECT_EQ(back[i].Path, roms[i].Path);
+    EXPECT_EQ(back[i].Hash, roms[i].Hash);
+    EXPECT_EQ(back[i].MTime, roms[i].MTime);
+    EXPECT_EQ(back[i].Prof, roms[i].Prof);
+    EXPECT_EQ(back[i].Title, roms[i].Title);
+  }
+
+  // nothing changed, the index answers for every ROM
+  read = 0;
+  EXPECT_EQ(indexRoms(d, back, &read).size(), 4u);
+  EXPECT_EQ(read, 0u);
+
+  for (const char *name :
+       {"plain_rom.ch8", "hires.ch8", "planes.ch8", "named.sc8", "notes.txt"}) {
+    remove((d + "/" + name).c_str());
+  }
+  rmdir(dir);
+}
+
+TEST(Farm, ReadsManifestsAndInputTraces) {
+  std::istringstream manifest("# roms to run\n"
+                              "\n"
+                              "a.ch8\n"
+                              "b.ch8 - 500\n"
+                              "  c.ch8 c.keys 42\n");
+  const auto jobs = readManifest(manifest);
+  ASSERT_EQ(jobs.size(), 3u);
+  EXPECT_EQ(jobs[0].Rom, "a.ch8");
+  EXPECT_EQ(jobs[0].Inputs, "");
+  EXPECT_EQ(jobs[0].Instructions, FARM_DEFAULT_INSTRUCTIONS);
+  EXPECT_EQ(jobs[1].Inputs, "");
+  EXPECT_EQ(jobs[1].Instructions, 500u);
+  EXPECT_EQ(jobs[2].Rom, "c.ch8");
+  EXPECT_EQ(jobs[2].Inputs, "c.keys");
+  EXPECT_EQ(jobs[2].Instructions, 42u);
+
+  char dir[] = "/tmp/chip8-test-XXXXXX";
+  ASSERT_NE(mkdtemp(dir), nullptr);
+  const std::string d(dir);
+  {
+    std::ofstream(d + "/good.keys") << "10 a down\n\n25 A up\n";
+    std::ofstream(d + "/bad.keys") << "10 a down\n20\n";
+  }
+  std::vector<InputEvent> events;
+  ASSERT_TRUE(readInputs(d + "/good.keys", &events));
+  ASSERT_EQ(events.size(), 2u);
+  EXPECT_EQ(events[0].At, 10u);
+  EXPECT_EQ(events[0].Key, 0xA);
+  EXPECT_TRUE(events[0].Down);
+  EXPECT_EQ(events[1].At, 25u);
+  EXPECT_EQ(events[1].Key, 0xA);
+  EXPECT_FALSE(events[1].Down);
+  events.clear();
+  EXPECT_FALSE(readInputs(d + "/bad.keys", &events));
+  EXPECT_FALSE(readInputs(d + "/missing.keys", &events));
+  remove((d + "/good.keys").c_str());
+  remove((d + "/bad.keys").c_str());
+  rmdir(dir);
+}
+
+TEST(Farm, ResultsKeepJobOrderAndMatchSingleRuns) {
+  char dir[] = "/tmp/chip8-test-XXXXXX";
+  ASSERT_NE(mkdtemp(dir), nullptr);
+  const std::string d(dir);
+  // wait for a key, draw its digit, loop
+  writeFile(d + "/digit.ch8", {0xF0, 0x0A, 0xF0, 0x29, 0xD1, 0x15, 0x12, 0x06});
+  {
+    std::ofstream(d + "/5.keys") << "50 5 down\n60 5 up\n";
+    std::ofstream(d + "/7.keys") << "50 7 down\n60 7 up\n";
+  }
+  std::vector<FarmJob> jobs;
+  for (const char *keys : {"5.keys", "7.keys", "", "5.keys"}) {
+    FarmJob job;
+    job.Rom = d + "/digit.ch8";
+    job.Inputs = *keys ? d + "/" + keys : "";
+    job.Instructions = 5000;
+    jobs.push_back(job);
+  }
+  jobs.push_back(FarmJob{d + "/missing.ch8", "", 5000});
+
+  const auto results = runFarm(jobs, 3, Engine::Table);
+  ASSERT_EQ(results.size(), jobs.size());
+  for (size_t i = 0; i < 4; i++) {
+    const FarmResult single = runJob(jobs[i], Engine::Table);
+    EXPECT_EQ(results[i].Job.Inputs, jobs[i].Inputs) << i;
+    ASSERT_TRUE(results[i].Ok) << i << ": " << results[i].Error;
+    EXPECT_EQ(results[i].Instructions, single.Instructions) << i;
+    EXPECT_EQ(results[i].FrameHash, single.FrameHash) << i;
+  }
+  EXPECT_EQ(results[0].Instructions, 5000u);
+  EXPECT_EQ(results[0].FrameHash, results[3].FrameHash);
+  EXPECT_NE(results[0].FrameHash, results[1].FrameHash);
+  // no key ever comes, the job stops waiting on the first instruction
+  EXPECT_LT(results[2].Instructions, 5u);
+  EXPECT_EQ(results[2].FrameHash, Screen().hash());
+  EXPECT_FALSE(results[4].Ok);
+  EXPECT_FALSE(results[4].Error.empty());
+
+  for (const char *name : {"digit.ch8", "5.keys", "7.keys"}) {
+    remove((d + "/" + name).c_str());
+  }
+  rmdir(dir);
+}
+
+// Sessions recorded with CHIP8_RECORD become regression tests: put rom.ch8
+// and rom.ch8.replay in a directory and point CHIP8_TEST_REPLAYS at it
+TEST(Replay, RecordedRoms) {
+  const char *dirname = getenv("CHIP8_TEST_REPLAYS");
+  if (dirname == nullptr) {
+    GTEST_SKIP();
+  }
+  DIR *dir = opendir(dirname);
+  ASSERT_NE(dir, nullptr) << dirname;
+  const std::string suffix = ".replay";
+  while (auto entry = readdir(dir)) {
+    const std::string name(entry->d_name);
+    if (name.size() <= suffix.size() ||
+        name.compare(name.size() - suffix.size(), suffix.size(), suffix) !=
+            0) {
+      continue;
+    }
+    const std::string path = std::string(dirname) + "/" + name;
+    const std::string rom = path.substr(0, path.size() - suffix.size());
+    std::ifstream in(path);
+    Recording rec;
+    ASSERT_TRUE(readRecording(in, &rec)) << path;
+    for (Engine engine : ENGINES) {
+      Memory mem(quirksOf(rec.Prof).MemorySize);
+      Chip8 cpu(&mem, engine, rec.Prof);
+      ASSERT_GT(loadRom(&mem, ROM_START, rom), 0u) << rom;
+      const ReplayResult result = replay(rec, cpu);
+      EXPECT_TRUE(result.Ok) << path << ": " << result.Error;
+    }
+  }
+  closedir(dir);
+}
 
 int main(int argc, char **argv) {
   testing::InitGoogleTest(&argc, argv);
@@ -0,0 +1,96 @@
+#include "thread_pool.hpp"
+
+#include <chrono>
+
+// waits are timed and looped: the untimed condition_variable::wait is a newer
+// libstdc++ symbol than the runtime some prebuilt gtest builds bring along,
+// the timed one is all in the headers
+static const std::chrono::milliseconds POOL_WAIT(100);
+
+ThreadPool::ThreadPool(size_t threads) {
+  if (threads == 0) {
+    threads = 1;
+  }
+  for (size_t i = 0; i < threads; i++) {
+    queues.emplace_back(new Queue);
+  }
+  for (size_t i = 0; i < threads; i++) {
+    workers.emplace_back(&ThreadPool::work, this, i);
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    stopping = true;
+  }
+  wake.notify_all();
+  for (auto &worker : workers) {
+    worker.join();
+  }
+}
+
+void ThreadPool::submit(std::function<void()> task) {
+  size_t q;
+  {
+    // counted before it can be taken, or a worker finishing it first would
+    // take unfinished below zero and let wait return early
+    std::lock_guard<std::mutex> guard(lock);
+    q = nextQueue++ % queues.size();
+    queued++;
+    unfinished++;
+  }
+  {
+    std::lock_guard<std::mutex> guard(queues[q]->lock);
+    queues[q]->tasks.push_back(std::move(task));
+  }
+  wake.notify_one();
+}
+
+void ThreadPool::wait() {
+  std::unique_lock<std::mutex> guard(lock);
+  while (!done.wait_for(guard, POOL_WAIT, [this] { return unfinished == 0; })) {
+  }
+}
+
+bool ThreadPool::take(size_t id, std::function<void()> *task) {
+  for (size_t i = 0; i < queues.size(); i++) {
+    Queue &q = *queues[(id + i) % queues.size()];
+    std::lock_guard<std::mutex> guard(q.lock);
+    if (q.tasks.empty()) {
+      continue;
+    }
+    if (i == 0) {
+      *task = std::move(q.tasks.back());
+      q.tasks.pop_back();
+    } else {
+      *task = std::move(q.tasks.front());
+      q.tasks.pop_front();
+    }
+    std::lock_guard<std::mutex> count(lock);
+    queued--;
+    return true;
+  }
+  return false;
+}
+
+void ThreadPool::work(size_t id) {
+  for (;;) {
+    std::function<void()> task;
+    if (take(id, &task)) {
+      task();
+      std::lock_guard<std::mutex> guard(lock);
+      if (--unfinished == 0) {
+        done.notify_all();
+      }
+      continue;
+    }
+    std::unique_lock<std::mutex> guard(lock);
+    while (!wake.wait_for(guard, POOL_WAIT,
+                          [this] { return stopping || queued > 0; })) {
+    }
+    if (stopping && queued == 0) {
+      return;
+    }
+  }
+}
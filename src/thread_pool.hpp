@@ -0,0 +1,49 @@
+#ifndef THREAD_POOL_HPP
+#define THREAD_POOL_HPP
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// ThreadPool is a work stealing pool, every worker owns a queue it takes
+// from the back of and idle workers steal from the front of the others
+class ThreadPool {
+public:
+  explicit ThreadPool(size_t threads);
+  ~ThreadPool();
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  void submit(std::function<void()> task);
+  // wait blocks until every submitted task has finished
+  void wait();
+
+  size_t size() const { return workers.size(); }
+
+private:
+  struct Queue {
+    std::mutex lock;
+    std::deque<std::function<void()>> tasks;
+  };
+
+  bool take(size_t id, std::function<void()> *task);
+  void work(size_t id);
+
+  std::vector<std::unique_ptr<Queue>> queues;
+  std::vector<std::thread> workers;
+
+  std::mutex lock;
+  std::condition_variable wake;
+  std::condition_variable done;
+  size_t queued = 0;     // submitted and not yet taken
+  size_t unfinished = 0; // submitted and not yet finished
+  size_t nextQueue = 0;
+  bool stopping = false;
+};
+
+#endif // THREAD_POOL_HPP
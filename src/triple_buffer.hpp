@@ -0,0 +1,41 @@
+#ifndef TRIPLE_BUFFER_HPP
+#define TRIPLE_BUFFER_HPP
+
+#include <atomic>
+#include <cstdint>
+
+// TripleBuffer hands values from one producer thread to one consumer thread
+// without locks or waiting. The producer fills back and publishes it, the
+// consumer picks up the newest published value with update, values published
+// in between are skipped.
+template <typename T> class TripleBuffer {
+public:
+  // back is the producer's slot, only valid until the next publish
+  T &back() { return slots[backIdx]; }
+  void publish() {
+    backIdx = middle.exchange(backIdx | FRESH, std::memory_order_acq_rel) &
+              INDEX;
+  }
+
+  // update swaps in the newest published value, returns false when nothing
+  // was published since the last update
+  bool update() {
+    if ((middle.load(std::memory_order_relaxed) & FRESH) == 0) {
+      return false;
+    }
+    frontIdx = middle.exchange(frontIdx, std::memory_order_acq_rel) & INDEX;
+    return true;
+  }
+  const T &front() const { return slots[frontIdx]; }
+
+private:
+  static constexpr uint8_t INDEX = 3;
+  static constexpr uint8_t FRESH = 4;
+
+  T slots[3];
+  uint8_t backIdx = 0;
+  std::atomic<uint8_t> middle{1}; // index of the spare slot and FRESH
+  uint8_t frontIdx = 2;
+};
+
+#endif // TRIPLE_BUFFER_HPP